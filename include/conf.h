@@ -26,6 +26,7 @@
 #include "autoconf.h"
 
 #include "util/list.h"
+#include "util/mem.h"
 
 typedef struct my_conf_s my_conf_t;
 
@@ -33,12 +34,18 @@ struct my_conf_s {
 	char *cfg_file;
 	char *log_file;
 	char *pid_file;
+	char *poller;
+	char *clock;
+	char *scheduler;
 	int log_level;
+	int reactors;
 	my_list_t *controls;
 	my_list_t *filters;
 	my_list_t *sources;
 	my_list_t *targets;
 	my_list_t *wirings;
+	/* holding the lists above & what they hold */
+	my_mem_arena_t *arena;
 };
 
 #define MY_CONF(p) ((my_conf_t *)(p))
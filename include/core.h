@@ -23,6 +23,7 @@
 #ifndef __MY_CORE_H
 #define __MY_CORE_H
 
+#include <stdint.h>
 #include <sys/time.h>
 
 #include "autoconf.h"
@@ -32,6 +33,7 @@
 #include "util/list.h"
 
 typedef struct my_core_s my_core_t;
+typedef struct my_loop_s my_loop_t;
 
 struct my_core_s {
 	my_list_t *controls;
@@ -51,12 +53,38 @@ extern int my_core_init(my_core_t *core, my_conf_t *conf);
 extern void my_core_loop(my_core_t *core);
 extern void my_core_stop(my_core_t *core);
 
-typedef int (*my_event_handler_t)(int fd, void *p);
+/* controls are served by the control loop, in the main thread */
+extern my_loop_t *my_core_get_control_loop(my_core_t *core);
+
+/* wirings are served by a pool of reactors, each in its own thread */
+extern int my_core_get_reactor_count(my_core_t *core);
+extern my_loop_t *my_core_get_reactor(my_core_t *core, int index);
+
+/* core time base, in nanoseconds */
+#define MY_SEC(n)  ((uint64_t)(n) * 1000000000ULL)
+#define MY_MSEC(n) ((uint64_t)(n) * 1000000ULL)
+#define MY_USEC(n) ((uint64_t)(n) * 1000ULL)
+
+extern uint64_t my_core_get_time(my_core_t *core);
+
+/* event interest & readiness masks */
+#define MY_EVENT_READ   0x0001
+#define MY_EVENT_WRITE  0x0002
+
+typedef int (*my_event_handler_t)(int fd, int events, void *p);
 typedef int (*my_alarm_handler_t)(void *p);
 
-extern int my_core_alarm_add(my_core_t *core, unsigned int timeout,
-			     int reoccurring, my_alarm_handler_t handler, void *p);
-extern int my_core_event_handler_add(my_core_t *core, int fd, my_event_handler_t handler, void *p);
+/* one-shot alarm handles are only valid until the alarm fires */
+typedef struct my_alarm_s my_alarm_t;
+
+/* on the control loop, see core/loop.h for the reactor ones */
+
+/* timeout in nanoseconds, see MY_MSEC() & co */
+extern my_alarm_t *my_core_alarm_add(my_core_t *core, uint64_t timeout,
+				     int reoccurring, my_alarm_handler_t handler, void *p);
+extern int my_core_alarm_del(my_core_t *core, my_alarm_t *alarm);
+extern int my_core_event_handler_add(my_core_t *core, int fd, int events, my_event_handler_t handler, void *p);
+extern int my_core_event_handler_mod(my_core_t *core, int fd, int events);
 extern int my_core_event_handler_del(my_core_t *core, int fd);
 
 extern int my_core_handle_command(my_core_t *core, void *buf, int len);
@@ -0,0 +1,69 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_GRAPH_H
+#define __MY_GRAPH_H
+
+#include <stdint.h>
+
+#include "autoconf.h"
+
+#include "core.h"
+
+#include "core/ports.h"
+
+/*
+ * Pull scheduler: the wirings are compiled once at startup into an array of
+ * ports in topological order, each port coming after those feeding it. The
+ * sinks of the graph (targets feeding nothing) then drive the sources they
+ * depend on: once per period, on their own hardware clock or else on an
+ * alarm, each of these sources is asked for exactly one period worth of
+ * data, which flows down to the sink. A source feeding several sinks is only
+ * driven by the first of them.
+ */
+
+typedef struct my_graph_s my_graph_t;
+typedef struct my_graph_node_s my_graph_node_t;
+
+/* ms */
+#define MY_GRAPH_PERIOD 20
+#define MY_GRAPH_RATE 44100
+#define MY_GRAPH_CHANNELS 2
+
+extern my_graph_t *my_graph_create(my_core_t *core);
+extern void my_graph_destroy(my_graph_t *graph);
+
+/* once the ports are opened */
+extern int my_graph_start(my_graph_t *graph);
+extern void my_graph_stop(my_graph_t *graph);
+
+/* whether 'port' is driven by the scheduler, rather than by its fd */
+extern int my_graph_is_scheduled(my_port_t *port);
+
+/* for sinks with a clock of their own, calling my_graph_pull() when ready */
+extern void my_graph_clock(my_port_t *port);
+extern uint64_t my_graph_get_interval(my_port_t *port);
+
+/* runs a period for the sink 'port', returns the number of bytes pulled */
+extern int my_graph_pull(my_port_t *port);
+
+#endif /* __MY_GRAPH_H */
@@ -0,0 +1,110 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_LOOP_H
+#define __MY_LOOP_H
+
+#include <stdint.h>
+
+#include "autoconf.h"
+
+#include "core.h"
+#include "core/poller.h"
+
+#include "util/buf.h"
+#include "util/list.h"
+
+/*
+ * An event loop: a poller, the fds it watches and a heap of pending alarms.
+ * The core runs a control loop in the main thread and a pool of reactor
+ * loops, each in its own thread. Apart from my_loop_stop(), a loop must only
+ * be operated from its own thread, or before it has been started.
+ */
+
+extern my_loop_t *my_loop_create(my_core_t *core, int index, char *poller);
+extern void my_loop_destroy(my_loop_t *loop);
+
+extern int my_loop_get_index(my_loop_t *loop);
+
+/* buffers for the ports served by the loop, so that pools are not shared between threads */
+#define MY_LOOP_BUF_SIZE 16384
+#define MY_LOOP_BUF_COUNT 16
+
+extern my_buf_pool_t *my_loop_get_buf_pool(my_loop_t *loop);
+
+/* run in the calling thread until stopped */
+extern void my_loop_run(my_loop_t *loop);
+
+/* run in a new thread, pinned to 'cpu' if >= 0 */
+extern int my_loop_start(my_loop_t *loop, int cpu);
+extern void my_loop_join(my_loop_t *loop);
+
+/* async-signal & thread safe */
+extern void my_loop_stop(my_loop_t *loop);
+
+/* timeout in nanoseconds, see MY_MSEC() & co */
+extern my_alarm_t *my_loop_alarm_add(my_loop_t *loop, uint64_t timeout,
+				     int reoccurring, my_alarm_handler_t handler, void *p);
+extern int my_loop_alarm_del(my_loop_t *loop, my_alarm_t *alarm);
+
+/*
+ * Deferred calls run once at the end of the current loop round, after every
+ * alarm & event handler, so that work requested several times in a round,
+ * such as flushing output, is done only once. A my_deferred_t lives in the
+ * caller data, and deferring it again while pending does nothing.
+ */
+
+typedef struct my_deferred_s my_deferred_t;
+
+struct my_deferred_s {
+	my_link_t link;
+	my_alarm_handler_t handler;
+	void *data;
+};
+
+extern void my_loop_deferred_init(my_deferred_t *deferred, my_alarm_handler_t handler, void *p);
+extern void my_loop_defer(my_loop_t *loop, my_deferred_t *deferred);
+extern void my_loop_defer_cancel(my_deferred_t *deferred);
+
+/*
+ * Asynchronous I/O, on loops whose poller does it: my_loop_io_submit() reads
+ * (MY_POLLER_IO_READ or _RECV) or writes (MY_POLLER_IO_WRITE) 'len' bytes of
+ * 'buf' from 'off' along with the next wait, holding a reference to 'buf'
+ * until 'handler' is called, from the round it completed in, with the count
+ * of bytes transferred or -errno. The returned handle is valid until then,
+ * my_loop_io_cancel() making sure the handler won't be called at all.
+ */
+
+typedef struct my_loop_io_s my_loop_io_t;
+
+typedef void (*my_loop_io_handler_t)(my_buf_t *buf, int res, void *p);
+
+extern int my_loop_can_submit(my_loop_t *loop);
+extern my_loop_io_t *my_loop_io_submit(my_loop_t *loop, int op, int fd, my_buf_t *buf, int off, int len,
+				       my_loop_io_handler_t handler, void *p);
+extern void my_loop_io_cancel(my_loop_t *loop, my_loop_io_t *io);
+
+extern int my_loop_event_handler_add(my_loop_t *loop, int fd, int events, my_event_handler_t handler, void *p);
+extern int my_loop_event_handler_mod(my_loop_t *loop, int fd, int events);
+extern int my_loop_event_handler_del(my_loop_t *loop, int fd);
+
+#endif /* __MY_LOOP_H */
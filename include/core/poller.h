@@ -0,0 +1,124 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_POLLER_H
+#define __MY_POLLER_H
+
+#include <stdint.h>
+
+#include "autoconf.h"
+
+#include "core.h"
+
+/*
+ * A poller watches file descriptors on behalf of the core loop. Each fd is
+ * registered with an interest mask (MY_EVENT_READ, MY_EVENT_WRITE) and an
+ * opaque pointer, which is handed back as is along with the ready events
+ * when the fd becomes ready, so that the core can dispatch without any
+ * lookup. Errors and hang-ups are reported as both read & write readiness.
+ */
+
+typedef struct my_poller_s my_poller_t;
+typedef struct my_poller_impl_s my_poller_impl_t;
+typedef struct my_poller_event_s my_poller_event_t;
+typedef struct my_poller_io_s my_poller_io_t;
+
+struct my_poller_event_s {
+	void *data;
+	int events;
+};
+
+/*
+ * Some pollers do the I/O themselves too: a read or write submitted with
+ * my_poller_submit() goes to the kernel along with the next wait, and its
+ * completion is returned by that wait, or a later one, like readiness is,
+ * with 'data' pointing to the my_poller_io_t, 'events' being MY_EVENT_IO
+ * and its result (bytes, or -errno) left in 'res'. Once submitted, an I/O
+ * always completes, even when canceled, and its memory must live until
+ * then. Pollers without a submit method fail with ENOTSUP.
+ */
+
+#define MY_EVENT_IO 0x0100
+
+#define MY_POLLER_IO_READ  1
+#define MY_POLLER_IO_WRITE 2
+#define MY_POLLER_IO_RECV  3
+
+struct my_poller_io_s {
+	int op;
+	int fd;
+	void *addr;
+	int len;
+	int res;
+};
+
+struct my_poller_s {
+	my_poller_impl_t *impl;
+};
+
+#define MY_POLLER(p) ((my_poller_t *)(p))
+
+typedef my_poller_t *(*my_poller_create_fn_t)(void);
+typedef void (*my_poller_destroy_fn_t)(my_poller_t *poller);
+typedef int (*my_poller_add_fn_t)(my_poller_t *poller, int fd, int events, void *data);
+typedef int (*my_poller_mod_fn_t)(my_poller_t *poller, int fd, int events, void *data);
+typedef int (*my_poller_del_fn_t)(my_poller_t *poller, int fd, void *data);
+typedef int (*my_poller_wait_fn_t)(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout);
+typedef int (*my_poller_submit_fn_t)(my_poller_t *poller, my_poller_io_t *io);
+typedef int (*my_poller_cancel_fn_t)(my_poller_t *poller, my_poller_io_t *io);
+
+struct my_poller_impl_s {
+	char *name;
+	char *desc;
+	my_poller_create_fn_t create;
+	my_poller_destroy_fn_t destroy;
+	my_poller_add_fn_t add;
+	my_poller_mod_fn_t mod;
+	my_poller_del_fn_t del;
+	my_poller_wait_fn_t wait;
+	my_poller_submit_fn_t submit;
+	my_poller_cancel_fn_t cancel;
+};
+
+#define MY_POLLER_IMPL(p) ((my_poller_impl_t *)(p))
+
+extern void my_poller_register_all(void);
+
+extern my_poller_t *my_poller_create(char *name);
+extern void my_poller_destroy(my_poller_t *poller);
+
+extern int my_poller_add(my_poller_t *poller, int fd, int events, void *data);
+extern int my_poller_mod(my_poller_t *poller, int fd, int events, void *data);
+extern int my_poller_del(my_poller_t *poller, int fd, void *data);
+
+/* wait at most 'timeout' nsecs (forever if < 0), store up to 'max' ready events, return their count */
+extern int my_poller_wait(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout);
+
+extern int my_poller_can_submit(my_poller_t *poller);
+extern int my_poller_submit(my_poller_t *poller, my_poller_io_t *io);
+extern int my_poller_cancel(my_poller_t *poller, my_poller_io_t *io);
+
+#ifdef MY_DEBUGGING
+extern void my_poller_dump_all(void);
+#endif
+
+#endif /* __MY_POLLER_H */
@@ -25,9 +25,16 @@
 
 #include "autoconf.h"
 
+#include <limits.h>
+
 #include "core.h"
+#include "core/loop.h"
 
+#include "util/audio.h"
+#include "util/buf.h"
 #include "util/list.h"
+#include "util/prop.h"
+#include "util/rbuf.h"
 
 /* generic port */
 
@@ -37,6 +44,7 @@ typedef struct my_port_impl_s my_port_impl_t;
 
 struct my_port_s {
 	my_core_t *core;
+	my_loop_t *loop;
 	my_port_conf_t *conf;
 	my_port_impl_t *impl;
 };
@@ -44,7 +52,7 @@ struct my_port_s {
 struct my_port_conf_s {
 	int index;
 	char *name;
-	my_list_t *properties;
+	my_props_t *properties;
 };
 
 typedef my_port_t *(*my_port_create_fn_t)(my_core_t *core, my_port_conf_t *conf);
@@ -56,6 +64,13 @@ typedef int (*my_port_close_fn_t)(my_port_t *port);
 typedef int (*my_port_get_fn_t)(my_port_t *port, void *buf, int len);
 typedef int (*my_port_put_fn_t)(my_port_t *port, void *buf, int len);
 
+typedef my_buf_t *(*my_port_pull_buf_fn_t)(my_port_t *port, int len);
+typedef int (*my_port_push_buf_fn_t)(my_port_t *port, my_port_t *from, my_buf_t *buf);
+
+typedef int (*my_port_set_fn_t)(my_port_t *port, char *name, char *value);
+
+typedef int (*my_port_pause_fn_t)(my_port_t *port, int paused);
+
 struct my_port_impl_s {
 	char *name;
 	char *desc;
@@ -65,6 +80,10 @@ struct my_port_impl_s {
 	my_port_close_fn_t close;
 	my_port_get_fn_t get;
 	my_port_put_fn_t put;
+	my_port_pull_buf_fn_t pull_buf;
+	my_port_push_buf_fn_t push_buf;
+	my_port_set_fn_t set;
+	my_port_pause_fn_t pause;
 	my_event_handler_t handler;
 };
 
@@ -80,7 +99,7 @@ extern my_port_conf_t *my_port_conf_create(int port_index, char *port_name);
 extern void my_port_conf_destroy(my_port_conf_t *port_conf);
 
 extern my_port_impl_t *my_port_impl_lookup(my_list_t *list, char *name);
-extern void my_port_impl_register(my_list_t *list, my_port_impl_t *impl);
+extern int my_port_impl_register(my_list_t *list, my_port_impl_t *impl);
 
 extern my_port_t *my_port_create_priv(int size);
 extern void my_port_destroy_priv(my_port_t *port);
@@ -88,8 +107,13 @@ extern void my_port_destroy_priv(my_port_t *port);
 extern my_port_t *my_port_create(my_core_t *core, my_port_conf_t *conf, my_port_impl_t *impl);
 extern void my_port_destroy(my_port_t *port);
 
+/* adds a port to 'list', where it can then be looked up by name in O(1) */
+extern int my_port_register(my_list_t *list, my_port_t *port);
 extern my_port_t *my_port_lookup_by_name(my_list_t *list, char *name);
 
+/* changes a setting at runtime, from the control loop while the port may be running elsewhere */
+extern int my_port_set(my_port_t *port, char *name, char *value);
+
 extern int my_port_destroy_all(my_list_t *list);
 
 extern int my_port_open_all(my_list_t *list);
@@ -113,18 +137,153 @@ struct my_cport_s {
 
 typedef struct my_dport_s my_dport_t;
 
+typedef struct my_graph_node_s my_graph_node_t;
+
 struct my_dport_s {
 	my_port_t _inherited;
-	my_port_t *peer;
+	/* ports fed by this one, & feeding this one */
+	my_list_t *peers;
+	my_list_t *inputs;
+	/* with the pull scheduler, see core/graph.h */
+	my_graph_node_t *node;
+	my_rbuf_t *queue;
+	int queue_high;
+	int queue_low;
+	int congested;
+	/* number of peers downstream asking for a pause */
+	int throttled;
+	/* decoding sources, see my_port_decoder_create() */
+	my_audio_codec_t *codec;
+	char *ibuf;
+	int ibuf_size;
+	int ibuf_len;
+	/* the last output was as large as asked, the codec may have more */
+	int codec_full;
+	my_buf_pool_t *obuf_pool;
+	/* asynchronous i/o, see my_port_aio_open() */
+	int aio_op;
+	int aio_fd;
+	my_loop_io_t *aio_io;
+	my_deferred_t aio_deferred;
+	int aio_paused;
+	int aio_eof;
+	int aio_error;
+	/* sources: read & not consumed yet, targets: written next, then the others in order */
+	my_buf_t *aio_head;
+	my_buf_t *aio_tail;
+	int aio_off;
+	/* targets: bytes queued, & at most */
+	int aio_len;
+	int aio_size;
 };
 
 #define MY_DPORT(p) ((my_dport_t *)(p))
 
-extern void my_port_link(my_port_t *port, my_port_t *peer);
+/*
+ * A port may feed several peers, each of them keeping its own output queue,
+ * so that a slow one never holds back the others.
+ */
+
+extern int my_port_link(my_port_t *port, my_port_t *peer);
+extern void my_port_unlink(my_port_t *port, my_port_t *peer);
+
+extern int my_port_is_linked(my_port_t *port);
 
 extern int my_port_get(my_port_t *port, void *buf, int len);
 extern int my_port_put(my_port_t *port, void *buf, int len);
 
+/*
+ * Buffer transfer: ports implementing pull_buf/push_buf exchange buffers by
+ * reference, the others fall back to get/put, through a buffer from the
+ * pool of the port loop. my_port_pull_buf() returns a new reference to at
+ * most 'len' bytes, or NULL if no data is available. my_port_push_buf() only lends 'buf' to the port,
+ * which must take its own reference to keep it; 'from' is the pushing port,
+ * if any, so that a port fed by several others can tell them apart.
+ */
+
+/* for a pull as large as a single buffer holds */
+#define MY_PORT_PULL_ANY INT_MAX
+
+extern my_buf_t *my_port_pull_buf(my_port_t *port, int len);
+extern int my_port_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf);
+
+/* the get fallback, for a pull_buf handling only some of its cases */
+extern my_buf_t *my_port_get_buf(my_port_t *port, int len);
+
+/* the same buffer to every peer, shared rather than copied */
+extern int my_port_push_buf_peers(my_port_t *port, my_buf_t *buf);
+
+/*
+ * How many bytes every peer downstream of 'port' can take without dropping
+ * any, through filters, the least room left in their output queues, so
+ * that sources never pull more than that (MY_PORT_PULL_ANY if unbounded).
+ */
+extern int my_port_get_room(my_port_t *port);
+
+/*
+ * Decoding sources: with an 'audio-format' property, what a source reads is
+ * decoded by my_port_pull_buf(). Input is read into a cache-aligned buffer
+ * allocated once with the port, where whatever the codec didn't consume is
+ * kept for the next call, and output goes to buffers from a pool of the port.
+ * Their sizes are set by the 'input-buffer-size' & 'output-buffer-size'
+ * properties. Both functions are no-ops for ports without 'audio-format'.
+ */
+
+#define MY_PORT_DECODER_IBUF_SIZE 16384
+#define MY_PORT_DECODER_OBUF_SIZE 196608
+#define MY_PORT_DECODER_OBUF_COUNT 4
+
+extern int my_port_decoder_create(my_port_t *port, my_port_conf_t *conf);
+extern void my_port_decoder_destroy(my_port_t *port);
+
+/*
+ * Output queue for targets: data which can't be written right away is kept
+ * there, and the target fd is watched for write readiness until it has been
+ * drained, so that sources never block on a slow device or socket.
+ *
+ * Once a queue fills past its high watermark, every source upstream is
+ * paused (see the pause hook), until it drains below its low watermark.
+ */
+
+#define MY_PORT_QUEUE_SIZE 65536
+
+extern int my_port_queue_create(my_port_t *port);
+extern void my_port_queue_destroy(my_port_t *port);
+
+extern int my_port_queue_write(my_port_t *port, int fd, void *buf, int len);
+extern int my_port_queue_flush(my_port_t *port, int fd);
+
+/* to be called by targets handling their queue themselves, when its level changed */
+extern void my_port_queue_update(my_port_t *port);
+
+/* whether some port downstream asked for a pause */
+extern int my_port_is_throttled(my_port_t *port);
+
+/*
+ * Asynchronous i/o: on loops whose poller does the i/o itself, and unless
+ * driven by the pull scheduler, a port may have its fd read or written by
+ * the loop rather than be called when it is ready, see my_loop_io_submit().
+ * my_port_aio_open() returns 1 if it does, the fd being made blocking then,
+ * 0 if the port must keep watching it, or -1 on error. Targets call it
+ * before my_port_queue_create(), their output queue being a list of loop
+ * buffers then, written one after the other by my_port_queue_write().
+ *
+ * Sources keep a read in flight, into a buffer of their loop, and get their
+ * handler called once it completed, as if their fd was ready. That buffer
+ * is handed over as is by my_port_get_buf(), or copied by my_port_aio_get()
+ * which their get method calls instead of reading, and the next read is
+ * submitted once it is consumed. Their pause method calls my_port_aio_pause().
+ */
+
+extern int my_port_aio_open(my_port_t *port, int fd, int op);
+extern void my_port_aio_close(my_port_t *port);
+
+extern int my_port_aio_get(my_port_t *port, void *buf, int len);
+extern int my_port_aio_pause(my_port_t *port, int paused);
+
+/* calls the handler of a source again, at the end of the loop round */
+extern void my_port_aio_kick(my_port_t *port);
+
 
 /* controls */
 
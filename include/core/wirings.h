@@ -32,6 +32,7 @@ typedef struct my_wiring_conf_s my_wiring_conf_t;
 
 struct my_wiring_s {
 	my_core_t *core;
+	my_loop_t *loop;
 	my_port_t *source;
 	my_port_t *target;
 };
@@ -41,6 +42,7 @@ struct my_wiring_conf_s {
 	char *name;
 	char *source;
 	char *target;
+	int reactor;
 };
 
 #define MY_WIRING(p) ((my_wiring_t *)(p))
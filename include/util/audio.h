@@ -23,6 +23,20 @@
 #ifndef __MY_AUDIO_H
 #define __MY_AUDIO_H
 
+/* sample encodings, in host byte order */
+#define MY_AUDIO_ENCODING_NONE 0
+#define MY_AUDIO_ENCODING_S16  1
+#define MY_AUDIO_ENCODING_S32  2
+#define MY_AUDIO_ENCODING_F32  3
+
+typedef struct my_audio_format_s my_audio_format_t;
+
+struct my_audio_format_s {
+	int rate;
+	int channels;
+	int encoding;
+};
+
 typedef struct my_audio_codec_s my_audio_codec_t;
 typedef struct my_audio_codec_impl_s my_audio_codec_impl_t;
 
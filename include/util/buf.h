@@ -0,0 +1,79 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_UTIL_BUF_H
+#define __MY_UTIL_BUF_H
+
+#include <stdint.h>
+
+#include "util/audio.h"
+#include "util/mem.h"
+
+/*
+ * Reference-counted audio buffers, handed from port to port instead of being
+ * copied at each hop. A buffer is taken from a pool with one reference; any
+ * holder which keeps it past the call it got it from takes its own with
+ * my_buf_ref(), and the last my_buf_unref() gives it back to its pool.
+ *
+ * A buffer with more than one reference is shared, and must be considered
+ * read-only. References may be taken & dropped from any thread.
+ */
+
+typedef struct my_buf_s my_buf_t;
+typedef struct my_buf_pool_s my_buf_pool_t;
+
+struct my_buf_s {
+	my_buf_pool_t *pool;
+	my_buf_t *next;
+	int refs;
+	int size;
+	int len;
+	/* in nanoseconds, see my_core_get_time() */
+	uint64_t timestamp;
+	/* of the packet carried, for sources receiving them numbered, see MY_BUF_SEQUENCED */
+	int flags;
+	uint16_t seq;
+	uint32_t media_time;
+	my_audio_format_t format;
+	char *data;
+} MY_CACHE_ALIGNED;
+
+#define MY_BUF(p) ((my_buf_t *)(p))
+
+/* 'seq' & 'media_time' are set, as sent by the remote end */
+#define MY_BUF_SEQUENCED 0x01
+
+/* 'count' buffers of 'size' bytes are allocated up front, more on demand */
+extern my_buf_pool_t *my_buf_pool_create(int size, int count);
+/* may be called while buffers are still held, which keep the pool around */
+extern void my_buf_pool_destroy(my_buf_pool_t *pool);
+
+extern int my_buf_pool_get_size(my_buf_pool_t *pool);
+
+extern my_buf_t *my_buf_alloc(my_buf_pool_t *pool);
+
+extern my_buf_t *my_buf_ref(my_buf_t *buf);
+extern void my_buf_unref(my_buf_t *buf);
+
+extern int my_buf_is_shared(my_buf_t *buf);
+
+#endif /* __MY_UTIL_BUF_H */
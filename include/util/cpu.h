@@ -0,0 +1,71 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_UTIL_CPU_H
+#define __MY_UTIL_CPU_H
+
+/*
+ * Run time selection of vectorized kernels: each family of them has one
+ * variant per instruction set extension it was built for, the first call
+ * picking, once and for all, the best one the cpu supports.
+ */
+
+/* extensions kernels can be built for, whatever the compiler flags for AVX2 */
+#if defined(__x86_64__) || defined(__i386__)
+# ifdef __SSE2__
+#  define MY_CPU_HAVE_SSE2
+# endif
+# ifdef __GNUC__
+#  define MY_CPU_HAVE_AVX2
+#  define MY_CPU_TARGET_AVX2 __attribute__((target("avx2")))
+# endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define MY_CPU_HAVE_NEON
+#endif
+
+#define MY_CPU_SSE2 0x01
+#define MY_CPU_AVX2 0x02
+#define MY_CPU_NEON 0x04
+
+typedef struct my_cpu_impl_s my_cpu_impl_t;
+
+/* what variants of a family start with */
+struct my_cpu_impl_s {
+	const char *name;
+	/* extensions required, see MY_CPU_* */
+	int features;
+};
+
+#define MY_CPU_IMPL(p) ((my_cpu_impl_t *)(p))
+
+/* extensions the cpu supports */
+extern int my_cpu_get_features(void);
+
+/*
+ * The last of the 'count' variants in 'impls' the cpu supports, ordered from
+ * the least to the most wanted, cached in 'cache' for later calls.
+ */
+extern void *my_cpu_impl_select(void **cache, void **impls, int count);
+
+#endif /* __MY_UTIL_CPU_H */
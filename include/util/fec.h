@@ -0,0 +1,89 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_UTIL_FEC_H
+#define __MY_UTIL_FEC_H
+
+#include <stdint.h>
+
+#include "util/buf.h"
+
+/*
+ * Forward error correction for numbered packets: every 'k' packets, a parity
+ * packet is sent, the XOR of their payloads, lengths & media times, from
+ * which the receiving end rebuilds any single one of them that went missing.
+ * The XOR kernels are vectorized with SSE2/AVX2 on x86 and NEON on ARM when
+ * available, the best variant being picked at run time.
+ *
+ * A parity payload is a MY_FEC_HDR_SIZE bytes header, then the XOR of the
+ * group payloads, as long as the longest of them:
+ *
+ *   0-1   sequence number of the first packet of the group
+ *   2     number of packets in the group
+ *   3     reserved, 0
+ *   4-7   XOR of the media times
+ *   8-9   XOR of the payload lengths
+ *   10-11 reserved, 0
+ */
+
+#define MY_FEC_HDR_SIZE 12
+#define MY_FEC_K_MAX 64
+
+/* dst[i] ^= src[i] */
+extern void my_fec_xor(void *dst, const void *src, int n);
+
+/* name of the variant in use, for diagnostics */
+extern const char *my_fec_get_impl(void);
+
+typedef struct my_fec_enc_s my_fec_enc_t;
+
+/* groups of 'k' packets, each one of at most 'size' bytes */
+extern my_fec_enc_t *my_fec_enc_create(int k, int size);
+extern void my_fec_enc_destroy(my_fec_enc_t *enc);
+
+/*
+ * Adds a packet to the current group. Once it is complete, returns the
+ * length of its parity payload, left in 'parity' until the next call, and
+ * 0 otherwise.
+ */
+extern int my_fec_enc_add(my_fec_enc_t *enc, uint16_t seq, uint32_t media_time, const void *data, int len, char **parity);
+
+typedef struct my_fec_dec_s my_fec_dec_t;
+
+/* keeps references to the last 'window' packets received, at least twice 'k' */
+extern my_fec_dec_t *my_fec_dec_create(int window);
+extern void my_fec_dec_destroy(my_fec_dec_t *dec);
+
+/* 'buf' must be sequenced, see MY_BUF_SEQUENCED */
+extern void my_fec_dec_add(my_fec_dec_t *dec, my_buf_t *buf);
+
+/*
+ * Returns a new buffer from 'pool', with the packet missing from the group
+ * protected by 'parity', or NULL if none or more than one is. The buffer
+ * is added to the window, as by my_fec_dec_add().
+ */
+extern my_buf_t *my_fec_dec_recover(my_fec_dec_t *dec, const void *parity, int len, my_buf_pool_t *pool);
+
+extern uint64_t my_fec_dec_get_recovered(my_fec_dec_t *dec);
+extern uint64_t my_fec_dec_get_unrecoverable(my_fec_dec_t *dec);
+
+#endif /* __MY_UTIL_FEC_H */
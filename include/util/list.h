@@ -23,6 +23,8 @@
 #ifndef __MY_UTIL_LIST_H
 #define __MY_UTIL_LIST_H
 
+#include <stddef.h>
+
 typedef struct my_list my_list_t;
 typedef struct my_node my_node_t;
 
@@ -73,4 +75,38 @@ extern void my_list_purge(my_list_t *list, int flags);
 #define my_list_for_each(list, node, p) \
 	for ((node) = (list)->head; (node) && ((p) = (node)->data); (node) = (node)->next)
 
+
+/*
+ * Intrusive lists: elements embed the my_link_t linking them, so that
+ * adding & removing them never allocates, and removing them doesn't need
+ * a lookup. A list is a circular chain through a head link, which must be
+ * initialized by my_ilist_init() before use.
+ */
+
+typedef struct my_link my_link_t;
+
+struct my_link {
+	my_link_t *prev, *next;
+};
+
+/* the element embedding 'link' as its 'member' field */
+#define my_link_entry(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+extern void my_ilist_init(my_link_t *head);
+extern int my_ilist_is_empty(my_link_t *head);
+
+extern void my_ilist_add_head(my_link_t *head, my_link_t *link);
+extern void my_ilist_add_tail(my_link_t *head, my_link_t *link);
+extern void my_ilist_remove(my_link_t *link);
+
+/**
+ * my_ilist_for_each_safe - iterate over an intrusive list, allowing removals
+ * @head:             the head link of the list.
+ * @link:             the my_link_t to use as a loop cursor.
+ * @next:             another my_link_t, for temporary storage.
+ */
+#define my_ilist_for_each_safe(head, link, next) \
+	for ((link) = (head)->next, (next) = (link)->next; (link) != (head); (link) = (next), (next) = (link)->next)
+
 #endif /* __MY_UTIL_LIST_H */
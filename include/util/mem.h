@@ -23,10 +23,36 @@
 #ifndef __MY_UTIL_MEM_H
 #define __MY_UTIL_MEM_H
 
+#define MY_CACHE_LINE_SIZE 64
+
+/* aligned on a cache line, to keep data touched by different threads apart */
+#define MY_CACHE_ALIGNED __attribute__((aligned(MY_CACHE_LINE_SIZE)))
+
+/* blocks are zeroed, except those from my_mem_alloc_nozero() */
 extern void *my_mem_alloc(int n);
+extern void *my_mem_alloc_nozero(int n);
+extern void *my_mem_alloc_aligned(int align, int n);
 extern void my_mem_free(void *p);
 
 extern void my_mem_zero(void *p, int n);
 extern void my_mem_copy(void *pt, void *ps, int n);
 
+/*
+ * Arenas, for objects living as long as each other, such as configuration:
+ * between my_mem_arena_enter() & my_mem_arena_leave(), the blocks allocated
+ * by the calling thread come from the arena, my_mem_free() ignores them, and
+ * they are all released at once by my_mem_arena_destroy().
+ */
+
+typedef struct my_mem_arena_s my_mem_arena_t;
+
+#define MY_MEM_ARENA_CHUNK_SIZE 16384
+
+extern my_mem_arena_t *my_mem_arena_create(int chunk_size);
+extern void my_mem_arena_destroy(my_mem_arena_t *arena);
+
+/* returns the arena previously in use, to be given back to my_mem_arena_leave() */
+extern my_mem_arena_t *my_mem_arena_enter(my_mem_arena_t *arena);
+extern void my_mem_arena_leave(my_mem_arena_t *prev);
+
 #endif /* __MY_UTIL_MEM_H */
@@ -0,0 +1,46 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MY_UTIL_MIX_H
+#define __MY_UTIL_MIX_H
+
+#include <stdint.h>
+
+/*
+ * Sample mixing kernels, vectorized with SSE2/AVX2 on x86 and NEON on ARM
+ * when available, the best variant being picked at run time. There are no
+ * alignment requirements on the buffers.
+ */
+
+/* dst[i] = dst[i] + src[i], saturated */
+extern void my_mix_add_s16(int16_t *dst, const int16_t *src, int n);
+
+/* dst[i] = dst[i] + src[i] */
+extern void my_mix_add_f32(float *dst, const float *src, int n);
+
+/* dst[i] clamped to [-1.0, 1.0] */
+extern void my_mix_clamp_f32(float *dst, int n);
+
+/* name of the variant in use, for diagnostics */
+extern const char *my_mix_get_impl(void);
+
+#endif /* __MY_UTIL_MIX_H */
@@ -23,18 +23,42 @@
 #ifndef __MY_UTIL_PROP_H
 #define __MY_UTIL_PROP_H
 
+#include <stdint.h>
+
 #include "util/list.h"
 
-extern int my_prop_add(my_list_t *list, char *name, char *value);
+/*
+ * Property stores: an open addressing hash over entries kept in the order
+ * they were added, with names interned so that every store shares them.
+ * Typed lookups parse a value once, on first access, and return the cached
+ * result afterwards; they return 'def' for missing or unparsable values.
+ */
+
+typedef struct my_props_s my_props_t;
+
+extern my_props_t *my_props_create(void);
+extern void my_props_destroy(my_props_t *props);
+
+extern int my_prop_add(my_props_t *props, char *name, char *value);
+
+extern char *my_prop_lookup(my_props_t *props, char *name);
+
+extern int my_prop_lookup_int(my_props_t *props, char *name, int def);
+extern double my_prop_lookup_float(my_props_t *props, char *name, double def);
+extern int my_prop_lookup_bool(my_props_t *props, char *name, int def);
+
+/* in ns, from a number of ms, or suffixed with one of "ns", "us", "ms" & "s" */
+extern uint64_t my_prop_lookup_duration(my_props_t *props, char *name, uint64_t def);
 
-extern char *my_prop_lookup(my_list_t *list, char *name);
+/* the same, for values set at run time; returns -1 if 'value' isn't a duration */
+extern int my_prop_parse_duration(char *value, uint64_t *duration);
 
-extern void my_prop_purge(my_list_t *list);
+extern void my_prop_purge(my_props_t *props);
 
 
 typedef int (*my_prop_iter_fn_t)(char *name, char *value, void *user, int flags);
 
-extern int my_prop_iter(my_list_t *list, my_prop_iter_fn_t func, void *user);
+extern int my_prop_iter(my_props_t *props, my_prop_iter_fn_t func, void *user);
 
 extern int my_prop_is_true(char *value);
 
@@ -23,16 +23,41 @@
 #ifndef __MY_UTIL_RBUF_H
 #define __MY_UTIL_RBUF_H
 
+#include <sys/uio.h>
+
+#include "util/mem.h"
+
+/*
+ * Ring buffer. Offsets run freely and are masked on access, so the size is
+ * always rounded up to a power of two.
+ *
+ * With MY_RBUF_FLAG_SPSC, one producer thread (put) and one consumer thread
+ * (get, peek, consume) may use it concurrently without locking: each side
+ * publishes its own offset with release semantics and reads the other one
+ * with acquire semantics.
+ *
+ * With MY_RBUF_FLAG_MIRRORED, the buffer pages are mapped twice in a row, so
+ * that any region, even across the wrap point, is a single contiguous span
+ * (the second iovec of the zero-copy calls is then always empty). The size
+ * is also rounded up to the page size.
+ */
+
+#define MY_RBUF_FLAG_SPSC      0x0001
+#define MY_RBUF_FLAG_MIRRORED  0x0002
+
 typedef struct my_rbuf_s my_rbuf_t;
 
 struct my_rbuf_s {
 	char *data;
-	int size;
-	int off_get;
-	int off_put;
-};
+	unsigned int size;
+	unsigned int mask;
+	int flags;
+	/* producer & consumer offsets live on their own cache lines */
+	unsigned int off_put MY_CACHE_ALIGNED;
+	unsigned int off_get MY_CACHE_ALIGNED;
+} MY_CACHE_ALIGNED;
 
-extern my_rbuf_t *my_rbuf_create(int size);
+extern my_rbuf_t *my_rbuf_create(int size, int flags);
 extern void my_rbuf_destroy(my_rbuf_t *rbuf);
 
 extern int my_rbuf_get_avail(my_rbuf_t *rbuf);
@@ -42,5 +67,19 @@ extern int my_rbuf_get(my_rbuf_t *rbuf, char *data, int size);
 extern int my_rbuf_put(my_rbuf_t *rbuf, char *data, int size);
 
 extern int my_rbuf_peek(my_rbuf_t *rbuf, char *data, int size);
+extern int my_rbuf_consume(my_rbuf_t *rbuf, int size);
+
+/*
+ * Zero-copy access: the region is described by two iovecs, the second one
+ * being empty unless it wraps, so that it can be handed to readv() & co.
+ * Both return the region size, at most 'size' bytes.
+ */
+
+/* free space to fill, made readable by my_rbuf_commit_write() */
+extern int my_rbuf_reserve_write(my_rbuf_t *rbuf, struct iovec *iov, int size);
+extern int my_rbuf_commit_write(my_rbuf_t *rbuf, int size);
+
+/* pending data, released by my_rbuf_consume() */
+extern int my_rbuf_peek_read(my_rbuf_t *rbuf, struct iovec *iov, int size);
 
 #endif /* __MY_UTIL_RBUF_H */
@@ -140,6 +140,7 @@ static int my_conf_parse_wirings(my_conf_t *conf, config_setting_t *list)
 	int i, n;
 	config_setting_t *item;
 	const char *str_value;
+	long int int_value;
 	my_wiring_conf_t *wiring;
 	
 
@@ -153,6 +154,7 @@ static int my_conf_parse_wirings(my_conf_t *conf, config_setting_t *list)
 		}
 
 		wiring->index = i;
+		wiring->reactor = -1;
 
 		if (config_setting_lookup_string(item, "name", &str_value) != CONFIG_FALSE) {
 			wiring->name = strdup(str_value);
@@ -168,6 +170,10 @@ static int my_conf_parse_wirings(my_conf_t *conf, config_setting_t *list)
 			wiring->target = strdup(str_value);
 		}
 
+		if (config_setting_lookup_int(item, "reactor", &int_value) != CONFIG_FALSE) {
+			wiring->reactor = (int)int_value;
+		}
+
 		if (my_list_enqueue(conf->wirings, wiring)) {
 			MY_ERROR("conf: error queuing wiring #%d '%s'" , wiring->index, wiring->name);
 			goto _MY_ERR_queue;
@@ -186,12 +192,22 @@ my_conf_t *my_conf_create(void)
 {
 	my_conf_t *conf;
 
+	my_mem_arena_t *prev;
+
 	conf = my_mem_alloc(sizeof(*conf));
 	if (!conf) {
 		MY_ERROR("conf: error creating data (%s)" , strerror(errno));
 		goto _MY_ERR_alloc;
 	}
 
+	/* everything parsed lives as long as the configuration itself */
+	conf->arena = my_mem_arena_create(0);
+	if (!conf->arena) {
+		MY_ERROR("conf: error creating arena (%s)" , strerror(errno));
+		goto _MY_ERR_arena_create;
+	}
+	prev = my_mem_arena_enter(conf->arena);
+
 	conf->controls = my_list_create();
 	if (conf->controls == NULL) {
 		MY_ERROR("conf: error creating control list (%s)" , strerror(errno));
@@ -222,18 +238,18 @@ my_conf_t *my_conf_create(void)
 		goto _MY_ERR_create_wirings;
 	}
 
+	my_mem_arena_leave(prev);
+
 	return conf;
 
-	my_list_destroy(conf->wirings);
 _MY_ERR_create_wirings:
-	my_list_destroy(conf->targets);
 _MY_ERR_create_targets:
-	my_list_destroy(conf->sources);
 _MY_ERR_create_sources:
-	my_list_destroy(conf->filters);
 _MY_ERR_create_filters:
-	my_list_destroy(conf->controls);
 _MY_ERR_create_controls:
+	my_mem_arena_leave(prev);
+	my_mem_arena_destroy(conf->arena);
+_MY_ERR_arena_create:
 	my_mem_free(conf);
 _MY_ERR_alloc:
 	return NULL;
@@ -257,6 +273,7 @@ void my_conf_destroy(my_conf_t *conf)
 	my_list_purge(conf->controls, MY_LIST_PURGE_FLAG_FREE_DATA);
 	my_list_destroy(conf->controls);
 
+	my_mem_arena_destroy(conf->arena);
 	my_mem_free(conf);
 }
 
@@ -266,8 +283,10 @@ int my_conf_parse(my_conf_t *conf)
 	config_setting_t *item;
 	const char *str_value;
 	long int int_value;
+	my_mem_arena_t *prev;
 
 	config_init(&config);
+	prev = my_mem_arena_enter(conf->arena);
 
 	if (config_read_file(&config, conf->cfg_file) == CONFIG_FALSE) {
 		MY_ERROR("error reading configuration file '%s' (%s, line %d)", conf->cfg_file, config_error_text(&config), config_error_line(&config));
@@ -290,6 +309,22 @@ int my_conf_parse(my_conf_t *conf)
 		conf->log_level = (int)int_value;
 	}
 
+	if (config_lookup_string(&config, "poller", &str_value) != CONFIG_FALSE) {
+		conf->poller = strdup(str_value);
+	}
+
+	if (config_lookup_string(&config, "clock", &str_value) != CONFIG_FALSE) {
+		conf->clock = strdup(str_value);
+	}
+
+	if (config_lookup_string(&config, "scheduler", &str_value) != CONFIG_FALSE) {
+		conf->scheduler = strdup(str_value);
+	}
+
+	if (config_lookup_int(&config, "reactors", &int_value) != CONFIG_FALSE) {
+		conf->reactors = (int)int_value;
+	}
+
 	item = config_lookup(&config, "controls");
 	if (item) {
 		if (my_conf_parse_controls(conf, item) != 0) {
@@ -325,6 +360,7 @@ int my_conf_parse(my_conf_t *conf)
 		}
 	}
 
+	my_mem_arena_leave(prev);
 	config_destroy(&config);
 
 	return 0;
@@ -335,6 +371,7 @@ _MY_ERR_parse_sources:
 _MY_ERR_parse_filters:
 _MY_ERR_parse_controls:
 _MY_ERR_read_file:
+	my_mem_arena_leave(prev);
 	config_destroy(&config);
 	return -1;
 }
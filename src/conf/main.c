@@ -61,6 +61,7 @@ static int my_conf_dump_wiring_fn(void *data, void *user, int flags)
 	MY_DEBUG("\t\tname=\"%s\";", wiring->name);
 	MY_DEBUG("\t\tsource=\"%s\";", wiring->source);
 	MY_DEBUG("\t\ttarget=\"%s\";", wiring->target);
+	MY_DEBUG("\t\treactor=%d;", wiring->reactor);
 	MY_DEBUG("\t}%s", flags & MY_LIST_ITER_FLAG_LAST ? "" : ",");
 
 	return 0;
@@ -72,6 +73,10 @@ void my_conf_dump(my_conf_t *conf)
 	MY_DEBUG("log-file = \"%s\";", conf->log_file);
 	MY_DEBUG("log-level = %d;", conf->log_level);
 	MY_DEBUG("pid-file = \"%s\";", conf->pid_file);
+	MY_DEBUG("poller = \"%s\";", conf->poller ? conf->poller : MY_POLLER_DEFAULT);
+	MY_DEBUG("clock = \"%s\";", conf->clock ? conf->clock : "monotonic");
+	MY_DEBUG("reactors = %d;", conf->reactors);
+	MY_DEBUG("scheduler = \"%s\";", conf->scheduler ? conf->scheduler : "push");
 
 	MY_DEBUG("controls = (");
 	my_list_iter(conf->controls, my_conf_dump_port_fn, "control");
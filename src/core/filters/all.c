@@ -20,7 +20,9 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/ports.h"
 
@@ -33,7 +35,9 @@ static my_list_t my_filters;
 
 #define MY_FILTER_REGISTER(x) { \
 	extern my_port_impl_t my_filter_##x; \
-	my_port_impl_register(&my_filters, &my_filter_##x); \
+	if (my_port_impl_register(&my_filters, &my_filter_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/filters: error registering '%s' (%s)", my_filter_##x.name, strerror(errno)); \
+	} \
 }
 
 static my_port_impl_t *my_filter_impl_find(my_port_conf_t *conf)
@@ -69,7 +73,9 @@ static int my_filter_create_fn(void *data, void *user, int flags)
 
 	port = my_port_create(core, conf, impl);
 	if (port) {
-		my_list_enqueue(core->filters, port);
+		/* until wired */
+		port->loop = my_core_get_reactor(core, 0);
+		my_port_register(core->filters, port);
 	}
 
 	return 0;
@@ -91,6 +97,8 @@ void my_filter_register_all(void)
 {
 	MY_FILTER_REGISTER(null);
 	MY_FILTER_REGISTER(delay);
+	MY_FILTER_REGISTER(mix);
+	MY_FILTER_REGISTER(jitter);
 }
 
 #ifdef MY_DEBUGGING
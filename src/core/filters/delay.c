@@ -20,24 +20,410 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/ports.h"
 
+#include "util/audio.h"
+#include "util/buf.h"
 #include "util/list.h"
 #include "util/log.h"
 #include "util/mem.h"
+#include "util/prop.h"
+
+/*
+ * Delay line: the buffers received over the last 'max-delay' ms are kept
+ * referenced rather than copied, and each output buffer is built with a
+ * single copy out of them, 'delay' ms behind. When the delay changes, the
+ * output crossfades from the old position in the stream to the new one over
+ * 'crossfade' ms.
+ */
+
+#define MY_DELAY_MAX 1000
+#define MY_DELAY_CROSSFADE 10
+#define MY_DELAY_QUEUE_LEN 64
 
 typedef struct my_filter_priv_s my_filter_priv_t;
 
 struct my_filter_priv_s {
 	my_dport_t _inherited;
+	int max_delay;
+	int crossfade;
+	/* in ms, as requested from the control loop */
+	int delay;
+	/* in ms, as last taken into account */
+	int applied;
+	my_audio_format_t format;
+	/* not one we can delay, buffers are dropped until it changes */
+	int unsupported;
+	int sample_size;
+	int frame_size;
+	/* frames of history kept */
+	int hist;
+	/* frames per output buffer */
+	int chunk;
+	/* buffers held, & their first frame in the stream */
+	my_buf_t **bufs;
+	int64_t *starts;
+	int size;
+	int head;
+	int count;
+	/* frames received since the format was set */
+	int64_t pos;
+	/* current delay, in frames, & the one being faded to */
+	int tap;
+	int tap_next;
+	int fade_pos;
+	int fade_len;
 };
 
 #define MY_FILTER(p) ((my_filter_priv_t *)(p))
 #define MY_FILTER_SIZE (sizeof(my_filter_priv_t))
 
 
+static int my_filter_delay_ms_to_frames(my_filter_priv_t *delay, int ms)
+{
+	int64_t frames = (int64_t)ms * delay->format.rate / 1000;
+
+	return frames < delay->hist ? frames : delay->hist;
+}
+
+static void my_filter_delay_drop(my_filter_priv_t *delay)
+{
+	my_buf_unref(delay->bufs[delay->head]);
+	delay->head = (delay->head + 1) % delay->size;
+	delay->count--;
+}
+
+static int my_filter_delay_hold(my_filter_priv_t *delay, my_buf_t *buf)
+{
+	my_buf_t **bufs;
+	int64_t *starts;
+	int i, k;
+
+	/* more, smaller buffers than expected */
+	if (delay->count == delay->size) {
+		bufs = my_mem_alloc(2 * delay->size * sizeof(my_buf_t *));
+		starts = my_mem_alloc(2 * delay->size * sizeof(int64_t));
+		if (!bufs || !starts) {
+			my_mem_free(bufs);
+			my_mem_free(starts);
+			return -1;
+		}
+		for (i = 0; i < delay->count; i++) {
+			k = (delay->head + i) % delay->size;
+			bufs[i] = delay->bufs[k];
+			starts[i] = delay->starts[k];
+		}
+		my_mem_free(delay->bufs);
+		my_mem_free(delay->starts);
+		delay->bufs = bufs;
+		delay->starts = starts;
+		delay->size *= 2;
+		delay->head = 0;
+	}
+
+	k = (delay->head + delay->count) % delay->size;
+	delay->bufs[k] = my_buf_ref(buf);
+	delay->starts[k] = delay->pos;
+	delay->count++;
+
+	delay->pos += buf->len / delay->frame_size;
+
+	return 0;
+}
+
+/* where frame 'frame' of the stream is held, & how many frames follow it there, NULL for silence */
+static char *my_filter_delay_at(my_filter_priv_t *delay, int64_t frame, int *run)
+{
+	my_buf_t *buf;
+	int64_t start, end;
+	int i, k;
+
+	/* before the stream started */
+	if (frame < 0) {
+		*run = (-frame < INT_MAX) ? -frame : INT_MAX;
+		return NULL;
+	}
+
+	for (i = 0; i < delay->count; i++) {
+		k = (delay->head + i) % delay->size;
+		buf = delay->bufs[k];
+		start = delay->starts[k];
+		end = start + buf->len / delay->frame_size;
+		if ((frame >= start) && (frame < end)) {
+			*run = end - frame;
+			return buf->data + (frame - start) * delay->frame_size;
+		}
+	}
+
+	*run = INT_MAX;
+	return NULL;
+}
+
+static void my_filter_delay_read(my_filter_priv_t *delay, int64_t frame, char *dst, int n)
+{
+	char *src;
+	int run;
+
+	while (n > 0) {
+		src = my_filter_delay_at(delay, frame, &run);
+		if (run > n) {
+			run = n;
+		}
+		if (src) {
+			my_mem_copy(dst, src, run * delay->frame_size);
+		} else {
+			my_mem_zero(dst, run * delay->frame_size);
+		}
+		dst += run * delay->frame_size;
+		frame += run;
+		n -= run;
+	}
+}
+
+/* a sample 'pos' steps of 'len' into the fade from 'a' to 'b' */
+static void my_filter_delay_fade(my_filter_priv_t *delay, char *dst, char *a, char *b, int pos, int len)
+{
+	switch (delay->format.encoding) {
+	case MY_AUDIO_ENCODING_S16:
+		*(int16_t *)dst = *(int16_t *)a + ((int32_t)*(int16_t *)b - *(int16_t *)a) * pos / len;
+		break;
+	case MY_AUDIO_ENCODING_S32:
+		*(int32_t *)dst = *(int32_t *)a + ((int64_t)*(int32_t *)b - *(int32_t *)a) * pos / len;
+		break;
+	case MY_AUDIO_ENCODING_F32:
+		*(float *)dst = *(float *)a + (*(float *)b - *(float *)a) * pos / len;
+		break;
+	}
+}
+
+/* fades the 'n' frames read in 'dst' to those from 'frame' on */
+static void my_filter_delay_fade_to(my_filter_priv_t *delay, int64_t frame, char *dst, int n)
+{
+	int fs = delay->frame_size;
+	int ss = delay->sample_size;
+	int64_t silence = 0;
+	char *src;
+	int run, i, j;
+
+	while (n > 0) {
+		src = my_filter_delay_at(delay, frame, &run);
+		if (run > n) {
+			run = n;
+		}
+		for (j = 0; j < run; j++) {
+			delay->fade_pos++;
+			for (i = 0; i < fs; i += ss) {
+				my_filter_delay_fade(delay, dst + i, dst + i, src ? src + j * fs + i : (char *)&silence,
+						     delay->fade_pos, delay->fade_len);
+			}
+			dst += fs;
+		}
+		frame += run;
+		n -= run;
+	}
+}
+
+static int my_filter_delay_start(my_port_t *port, my_audio_format_t *format)
+{
+	my_filter_priv_t *delay = MY_FILTER(port);
+
+	while (delay->count > 0) {
+		my_filter_delay_drop(delay);
+	}
+	delay->pos = 0;
+
+	switch (format->encoding) {
+	case MY_AUDIO_ENCODING_S16:
+		delay->sample_size = sizeof(int16_t);
+		break;
+	case MY_AUDIO_ENCODING_S32:
+		delay->sample_size = sizeof(int32_t);
+		break;
+	case MY_AUDIO_ENCODING_F32:
+		delay->sample_size = sizeof(float);
+		break;
+	default:
+		my_log(MY_LOG_ERROR, "core/%s: unsupported sample encoding (%d)", port->conf->name, format->encoding);
+		return -1;
+	}
+
+	if ((format->rate <= 0) || (format->channels <= 0)) {
+		my_log(MY_LOG_ERROR, "core/%s: unsupported format (%d Hz, %d channels)", port->conf->name, format->rate, format->channels);
+		return -1;
+	}
+
+	delay->format = *format;
+	delay->frame_size = delay->sample_size * format->channels;
+
+	delay->chunk = my_buf_pool_get_size(my_loop_get_buf_pool(port->loop)) / delay->frame_size;
+	if (delay->chunk < 1) {
+		my_log(MY_LOG_ERROR, "core/%s: buffers too small for %d channels", port->conf->name, format->channels);
+		return -1;
+	}
+	delay->hist = (int64_t)delay->max_delay * format->rate / 1000;
+
+	/* starting from silence */
+	delay->applied = __atomic_load_n(&delay->delay, __ATOMIC_RELAXED);
+	delay->tap = my_filter_delay_ms_to_frames(delay, delay->applied);
+	delay->fade_len = 0;
+
+	MY_DEBUG("core/%s: delaying %d Hz, %d channels by %d frames", port->conf->name, format->rate, format->channels, delay->tap);
+
+	return 0;
+}
+
+/* pick up a new delay, unless still fading to the previous one */
+static void my_filter_delay_update(my_port_t *port)
+{
+	my_filter_priv_t *delay = MY_FILTER(port);
+	int ms;
+
+	ms = __atomic_load_n(&delay->delay, __ATOMIC_RELAXED);
+	if ((ms == delay->applied) || (delay->fade_len > 0)) {
+		return;
+	}
+
+	delay->applied = ms;
+	delay->tap_next = my_filter_delay_ms_to_frames(delay, ms);
+	if (delay->tap_next == delay->tap) {
+		return;
+	}
+
+	delay->fade_pos = 0;
+	delay->fade_len = (int64_t)delay->crossfade * delay->format.rate / 1000;
+	if (delay->fade_len < 1) {
+		delay->fade_len = 1;
+	}
+
+	MY_DEBUG("core/%s: delay changing from %d to %d frames", port->conf->name, delay->tap, delay->tap_next);
+}
+
+/* output the 'n' frames matching those received from 'frame' on */
+static void my_filter_delay_output(my_port_t *port, my_buf_t *out, int64_t frame, int n)
+{
+	my_filter_priv_t *delay = MY_FILTER(port);
+	int fs = delay->frame_size;
+	char *dst = out->data;
+	int j, m;
+
+	for (j = 0; (j < n) && (delay->fade_len > 0); j += m) {
+		m = n - j;
+		if (m > delay->fade_len - delay->fade_pos) {
+			m = delay->fade_len - delay->fade_pos;
+		}
+
+		my_filter_delay_read(delay, frame + j - delay->tap, dst, m);
+		my_filter_delay_fade_to(delay, frame + j - delay->tap_next, dst, m);
+		dst += m * fs;
+
+		if (delay->fade_pos == delay->fade_len) {
+			delay->tap = delay->tap_next;
+			delay->fade_len = 0;
+		}
+	}
+
+	if (j < n) {
+		my_filter_delay_read(delay, frame + j - delay->tap, dst, n - j);
+	}
+
+	out->len = n * fs;
+}
+
+static int my_filter_delay_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	my_filter_priv_t *delay = MY_FILTER(port);
+	my_buf_t *out;
+	int64_t frame;
+	int frames, off, n;
+
+	if (memcmp(&buf->format, &delay->format, sizeof(delay->format)) != 0) {
+		delay->unsupported = (my_filter_delay_start(port, &buf->format) != 0);
+		delay->format = buf->format;
+	}
+
+	/* reported once, when the format changed */
+	if (delay->unsupported) {
+		return buf->len;
+	}
+
+	frames = buf->len / delay->frame_size;
+	if (frames == 0) {
+		return buf->len;
+	}
+
+	frame = delay->pos;
+	if (my_filter_delay_hold(delay, buf) != 0) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating data (%s)", port->conf->name, strerror(errno));
+		return -1;
+	}
+
+	my_filter_delay_update(port);
+
+	for (off = 0; off < frames; off += n) {
+		n = frames - off;
+		if (n > delay->chunk) {
+			n = delay->chunk;
+		}
+
+		out = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+		if (!out) {
+			my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+			break;
+		}
+		out->format = delay->format;
+		out->timestamp = buf->timestamp + (uint64_t)off * 1000000000ULL / delay->format.rate;
+
+		my_filter_delay_output(port, out, frame + off, n);
+
+		my_port_push_buf_peers(port, out);
+		my_buf_unref(out);
+	}
+
+	/* no longer within reach of the longest delay */
+	while ((delay->count > 0) &&
+	       (delay->starts[delay->head] + delay->bufs[delay->head]->len / delay->frame_size <= delay->pos - delay->hist)) {
+		my_filter_delay_drop(delay);
+	}
+
+	return buf->len;
+}
+
+static int my_filter_delay_set(my_port_t *port, char *name, char *value)
+{
+	my_filter_priv_t *delay = MY_FILTER(port);
+	uint64_t duration;
+	int ms;
+
+	if (strcmp(name, "delay") != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* as at creation, in ms unless suffixed */
+	if (my_prop_parse_duration(value, &duration) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (duration / MY_MSEC(1) > delay->max_delay) {
+		errno = ERANGE;
+		return -1;
+	}
+	ms = duration / MY_MSEC(1);
+
+	/* picked up by the reactor with the next buffer */
+	__atomic_store_n(&delay->delay, ms, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
 static my_port_t *my_filter_delay_create(my_core_t *core, my_port_conf_t *conf)
 {
 	my_port_t *port;
@@ -48,8 +434,35 @@ static my_port_t *my_filter_delay_create(my_core_t *core, my_port_conf_t *conf)
 		goto _MY_ERR_alloc;
 	}
 
+	/* in ms */
+	MY_FILTER(port)->max_delay = my_prop_lookup_duration(conf->properties, "max-delay", MY_MSEC(MY_DELAY_MAX)) / MY_MSEC(1);
+	MY_FILTER(port)->crossfade = my_prop_lookup_duration(conf->properties, "crossfade", MY_MSEC(MY_DELAY_CROSSFADE)) / MY_MSEC(1);
+
+	/* or in seconds for 'value' */
+	if (my_prop_lookup(conf->properties, "delay")) {
+		MY_FILTER(port)->delay = my_prop_lookup_duration(conf->properties, "delay", 0) / MY_MSEC(1);
+	} else {
+		MY_FILTER(port)->delay = my_prop_lookup_float(conf->properties, "value", 0) * 1000;
+	}
+	if ((MY_FILTER(port)->delay < 0) || (MY_FILTER(port)->delay > MY_FILTER(port)->max_delay)) {
+		my_log(MY_LOG_ERROR, "core/%s: delay out of range (0 - %d ms)", conf->name, MY_FILTER(port)->max_delay);
+		goto _MY_ERR_conf;
+	}
+
+	MY_FILTER(port)->size = MY_DELAY_QUEUE_LEN;
+	MY_FILTER(port)->bufs = my_mem_alloc(MY_DELAY_QUEUE_LEN * sizeof(my_buf_t *));
+	MY_FILTER(port)->starts = my_mem_alloc(MY_DELAY_QUEUE_LEN * sizeof(int64_t));
+	if (!MY_FILTER(port)->bufs || !MY_FILTER(port)->starts) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating data", conf->name);
+		goto _MY_ERR_alloc_queue;
+	}
+
 	return port;
 
+_MY_ERR_alloc_queue:
+	my_mem_free(MY_FILTER(port)->bufs);
+	my_mem_free(MY_FILTER(port)->starts);
+_MY_ERR_conf:
 	my_port_destroy_priv(port);
 _MY_ERR_alloc:
 	return NULL;
@@ -57,6 +470,11 @@ _MY_ERR_alloc:
 
 static void my_filter_delay_destroy(my_port_t *port)
 {
+	while (MY_FILTER(port)->count > 0) {
+		my_filter_delay_drop(MY_FILTER(port));
+	}
+	my_mem_free(MY_FILTER(port)->bufs);
+	my_mem_free(MY_FILTER(port)->starts);
 	my_port_destroy_priv(port);
 }
 
@@ -65,4 +483,6 @@ my_port_impl_t my_filter_delay = {
 	.desc = "Delay filter",
 	.create = my_filter_delay_create,
 	.destroy = my_filter_delay_destroy,
+	.push_buf = my_filter_delay_push_buf,
+	.set = my_filter_delay_set,
 };
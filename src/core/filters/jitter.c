@@ -0,0 +1,517 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/ports.h"
+
+#include "util/audio.h"
+#include "util/buf.h"
+#include "util/log.h"
+#include "util/mem.h"
+#include "util/prop.h"
+
+/*
+ * Jitter buffer, for packets numbered by the remote end (see MY_BUF_SEQUENCED),
+ * such as those of a udp source with rtp framing. Packets are kept in a slot
+ * array indexed by their sequence number, and played out in order, one packet
+ * duration apart, starting once the first one has been held for the target
+ * latency. The target follows the interarrival jitter (RFC 3550) measured on
+ * the media timestamps, 'jitter-factor' times it on top of a packet duration,
+ * within 'min-latency' & 'max-latency': when more than that is buffered, a
+ * packet is skipped, and when less, a concealment packet is inserted.
+ *
+ * A packet missing when due is concealed, repeating the last one played with
+ * its gain halved each time, or as silence if its format isn't known, and
+ * dropped when it eventually comes, so that losses never stall the stream.
+ * Once 'max-latency' worth of packets has been concealed in a row, the stream
+ * is considered stopped, and buffered again from the next packet. Anything
+ * unnumbered is passed through as is.
+ */
+
+#define MY_JITTER_SLOTS 256
+#define MY_JITTER_SLOTS_MASK (MY_JITTER_SLOTS - 1)
+
+#define MY_JITTER_CLOCK_RATE 48000
+#define MY_JITTER_PERIOD 20
+#define MY_JITTER_MIN_LATENCY 20
+#define MY_JITTER_MAX_LATENCY 200
+#define MY_JITTER_FACTOR 3
+
+/* playout resolution, in ms */
+#define MY_JITTER_TICK 2
+/* packets played between latency adjustments */
+#define MY_JITTER_SETTLE 8
+/* counters are logged, when they changed, every so many seconds while playing, & when stopping */
+#define MY_JITTER_REPORT 10
+
+typedef struct my_filter_priv_s my_filter_priv_t;
+
+struct my_filter_priv_s {
+	my_dport_t _inherited;
+	int clock_rate;
+	uint64_t min_latency;
+	uint64_t max_latency;
+	/* as requested from the control loop */
+	int factor;
+	my_alarm_t *alarm;
+	my_buf_t *slots[MY_JITTER_SLOTS];
+	int count;
+	int playing;
+	/* next packet to play, due at 'play_at', & the newest one received */
+	uint16_t next_seq;
+	uint16_t high_seq;
+	uint64_t play_at;
+	/* nominal packet duration, as measured, & playout target, in ns */
+	uint64_t period;
+	uint64_t target;
+	/* interarrival jitter, in ns, from the last packet in sequence */
+	int64_t jitter;
+	int have_last;
+	uint16_t last_seq;
+	uint32_t last_media_time;
+	uint64_t last_arrival;
+	/* for concealment */
+	my_buf_t *last_played;
+	int concealed_run;
+	int settle;
+	/* counters */
+	uint64_t received;
+	uint64_t late;
+	uint64_t lost;
+	uint64_t concealed;
+	uint64_t duplicate;
+	uint64_t skipped;
+	uint64_t inserted;
+	uint64_t underruns;
+	uint64_t reported;
+	uint64_t report_at;
+};
+
+#define MY_FILTER(p) ((my_filter_priv_t *)(p))
+#define MY_FILTER_SIZE (sizeof(my_filter_priv_t))
+
+
+static void my_filter_jitter_flush(my_filter_priv_t *jb)
+{
+	int i;
+
+	for (i = 0; (i < MY_JITTER_SLOTS) && (jb->count > 0); i++) {
+		if (jb->slots[i]) {
+			my_buf_unref(jb->slots[i]);
+			jb->slots[i] = NULL;
+			jb->count--;
+		}
+	}
+}
+
+/* packets from the next one to play to the newest one, lost ones included */
+static int my_filter_jitter_depth(my_filter_priv_t *jb)
+{
+	if (jb->count == 0) {
+		return 0;
+	}
+
+	return (int16_t)(jb->high_seq - jb->next_seq) + 1;
+}
+
+static void my_filter_jitter_update(my_filter_priv_t *jb, my_buf_t *buf)
+{
+	int factor = __atomic_load_n(&jb->factor, __ATOMIC_RELAXED);
+	int64_t media, d;
+
+	if (jb->have_last && ((int16_t)(buf->seq - jb->last_seq) <= 0)) {
+		return;
+	}
+
+	if (jb->have_last) {
+		media = (int64_t)(int32_t)(buf->media_time - jb->last_media_time) * 1000000000LL / jb->clock_rate;
+		d = (int64_t)(buf->timestamp - jb->last_arrival) - media;
+		if (d < 0) {
+			d = -d;
+		}
+		jb->jitter += (d - jb->jitter) / 16;
+
+		if (((uint16_t)(buf->seq - jb->last_seq) == 1) && (media > 0)) {
+			jb->period = media;
+		}
+	}
+
+	jb->have_last = 1;
+	jb->last_seq = buf->seq;
+	jb->last_media_time = buf->media_time;
+	jb->last_arrival = buf->timestamp;
+
+	jb->target = jb->period + factor * jb->jitter;
+	if (jb->target < jb->min_latency) {
+		jb->target = jb->min_latency;
+	} else if (jb->target > jb->max_latency) {
+		jb->target = jb->max_latency;
+	}
+}
+
+static void my_filter_jitter_output(my_port_t *port, my_buf_t *buf)
+{
+	if (!my_buf_is_shared(buf)) {
+		buf->timestamp = MY_FILTER(port)->play_at;
+	}
+
+	my_port_push_buf_peers(port, buf);
+}
+
+static void my_filter_jitter_play(my_port_t *port, my_buf_t *buf)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+
+	my_filter_jitter_output(port, buf);
+
+	if (jb->last_played) {
+		my_buf_unref(jb->last_played);
+	}
+	jb->last_played = buf;
+	jb->concealed_run = 0;
+}
+
+static void my_filter_jitter_conceal(my_port_t *port)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+	my_buf_t *last = jb->last_played;
+	my_buf_t *buf;
+	int shift = jb->concealed_run + 1;
+	float gain;
+	int i, n;
+
+	jb->concealed_run++;
+	jb->concealed++;
+
+	/* nothing to go by yet */
+	if (!last) {
+		return;
+	}
+
+	buf = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return;
+	}
+
+	buf->len = (last->len < buf->size) ? last->len : buf->size;
+	buf->format = last->format;
+
+	switch (last->format.encoding) {
+	case MY_AUDIO_ENCODING_S16:
+		n = buf->len / sizeof(int16_t);
+		if (shift > 15) {
+			shift = 15;
+		}
+		for (i = 0; i < n; i++) {
+			((int16_t *)buf->data)[i] = ((int16_t *)last->data)[i] >> shift;
+		}
+		break;
+	case MY_AUDIO_ENCODING_F32:
+		n = buf->len / sizeof(float);
+		gain = 1.0f / (1 << (shift < 24 ? shift : 24));
+		for (i = 0; i < n; i++) {
+			((float *)buf->data)[i] = ((float *)last->data)[i] * gain;
+		}
+		break;
+	default:
+		my_mem_zero(buf->data, buf->len);
+		break;
+	}
+
+	my_filter_jitter_output(port, buf);
+	my_buf_unref(buf);
+}
+
+static void my_filter_jitter_report(my_port_t *port, uint64_t now, int force)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+	uint64_t events = jb->late + jb->concealed + jb->duplicate + jb->skipped + jb->underruns;
+
+	if (!force && ((int64_t)(now - jb->report_at) < 0)) {
+		return;
+	}
+	jb->report_at = now + MY_SEC(MY_JITTER_REPORT);
+
+	if (events == jb->reported) {
+		return;
+	}
+	jb->reported = events;
+
+	my_log(MY_LOG_INFO, "core/%s: jitter %d us, target latency %d ms, %llu received, %llu late, %llu lost, "
+	       "%llu concealed, %llu duplicate, %llu skipped, %llu inserted, %llu underruns", port->conf->name,
+	       (int)(jb->jitter / 1000), (int)(jb->target / MY_MSEC(1)), (unsigned long long)jb->received,
+	       (unsigned long long)jb->late, (unsigned long long)jb->lost, (unsigned long long)jb->concealed,
+	       (unsigned long long)jb->duplicate,
+	       (unsigned long long)jb->skipped, (unsigned long long)jb->inserted, (unsigned long long)jb->underruns);
+}
+
+/* plays, or conceals, the packets due by 'now' */
+static void my_filter_jitter_run(my_port_t *port, uint64_t now)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+	my_buf_t *buf;
+	uint64_t level;
+	int k;
+
+	while (jb->playing && ((int64_t)(now - jb->play_at) >= 0)) {
+		k = jb->next_seq & MY_JITTER_SLOTS_MASK;
+		buf = jb->slots[k];
+		if (buf && (buf->seq != jb->next_seq)) {
+			buf = NULL;
+		}
+
+		level = (uint64_t)my_filter_jitter_depth(jb) * jb->period;
+
+		if (!buf && (jb->count == 0) && (jb->concealed_run * jb->period >= jb->max_latency)) {
+			/* the stream stopped, start over with the next packet */
+			jb->playing = 0;
+			jb->underruns++;
+			MY_DEBUG("core/%s: stream stopped, buffering again", port->conf->name);
+			my_loop_alarm_del(port->loop, jb->alarm);
+			jb->alarm = NULL;
+			my_filter_jitter_report(port, now, 1);
+			break;
+		}
+
+		if (buf && jb->settle > 0) {
+			jb->settle--;
+		} else if (buf && (level > jb->target + 2 * jb->period)) {
+			/* too much buffered, catch up */
+			jb->slots[k] = NULL;
+			jb->count--;
+			jb->next_seq++;
+			jb->skipped++;
+			jb->settle = MY_JITTER_SETTLE;
+			my_buf_unref(buf);
+			continue;
+		} else if (buf && (level + jb->period < jb->target)) {
+			/* not enough, hold this one back */
+			my_filter_jitter_conceal(port);
+			jb->play_at += jb->period;
+			jb->inserted++;
+			jb->settle = MY_JITTER_SETTLE;
+			continue;
+		}
+
+		if (buf) {
+			jb->slots[k] = NULL;
+			jb->count--;
+			my_filter_jitter_play(port, buf);
+		} else {
+			/* lost if others came after it, late otherwise, & dropped when it comes */
+			my_filter_jitter_conceal(port);
+			if (jb->count > 0) {
+				jb->lost++;
+			}
+		}
+
+		jb->next_seq++;
+		jb->play_at += jb->period;
+	}
+}
+
+static int my_filter_jitter_alarm_handler(void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	uint64_t now;
+
+	now = my_core_get_time(port->core);
+
+	my_filter_jitter_run(port, now);
+	my_filter_jitter_report(port, now, 0);
+
+	return 0;
+}
+
+static int my_filter_jitter_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+	int16_t delta;
+	int k;
+
+	if (!(buf->flags & MY_BUF_SEQUENCED)) {
+		my_port_push_buf_peers(port, buf);
+		return buf->len;
+	}
+
+	/* ticking only while playing */
+	if (!jb->alarm) {
+		jb->alarm = my_loop_alarm_add(port->loop, MY_MSEC(MY_JITTER_TICK), 1, my_filter_jitter_alarm_handler, port);
+		if (!jb->alarm) {
+			my_log(MY_LOG_ERROR, "core/%s: error adding alarm", port->conf->name);
+			return -1;
+		}
+		if (!jb->report_at) {
+			jb->report_at = buf->timestamp + MY_SEC(MY_JITTER_REPORT);
+		}
+	}
+
+	jb->received++;
+	my_filter_jitter_update(jb, buf);
+
+	if (!jb->playing) {
+		my_filter_jitter_flush(jb);
+		jb->next_seq = jb->high_seq = buf->seq;
+		jb->play_at = buf->timestamp + jb->target;
+		jb->concealed_run = 0;
+		jb->settle = 0;
+		jb->playing = 1;
+	}
+
+	delta = buf->seq - jb->next_seq;
+	if (delta < 0) {
+		jb->late++;
+		MY_DEBUG("core/%s: dropping late packet %u", port->conf->name, buf->seq);
+		return buf->len;
+	}
+
+	/* way ahead, the sender must have started over */
+	if (delta >= MY_JITTER_SLOTS) {
+		MY_DEBUG("core/%s: sequence jumped from %u to %u, resyncing", port->conf->name, jb->next_seq, buf->seq);
+		my_filter_jitter_flush(jb);
+		jb->next_seq = jb->high_seq = buf->seq;
+		jb->play_at = buf->timestamp + jb->target;
+	}
+
+	k = buf->seq & MY_JITTER_SLOTS_MASK;
+	if (jb->slots[k]) {
+		jb->duplicate++;
+		return buf->len;
+	}
+
+	jb->slots[k] = my_buf_ref(buf);
+	jb->count++;
+	if ((int16_t)(buf->seq - jb->high_seq) > 0) {
+		jb->high_seq = buf->seq;
+	}
+
+	/* it may be due already */
+	my_filter_jitter_run(port, my_core_get_time(port->core));
+
+	return buf->len;
+}
+
+static int my_filter_jitter_set(my_port_t *port, char *name, char *value)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+	char *end;
+	long factor;
+
+	if (strcmp(name, "jitter-factor") != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* as at creation */
+	errno = 0;
+	factor = strtol(value, &end, 0);
+	if ((end == value) || (*end != '\0') || errno) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((factor < 0) || (factor > INT_MAX)) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	/* picked up by the reactor with the next packet */
+	__atomic_store_n(&jb->factor, factor, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+static my_port_t *my_filter_jitter_create(my_core_t *core, my_port_conf_t *conf)
+{
+	my_port_t *port;
+	my_filter_priv_t *jb;
+
+	port = my_port_create_priv(MY_FILTER_SIZE);
+	if (!port) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating data", conf->name);
+		goto _MY_ERR_alloc;
+	}
+	jb = MY_FILTER(port);
+
+	jb->clock_rate = my_prop_lookup_int(conf->properties, "clock-rate", MY_JITTER_CLOCK_RATE);
+	if (jb->clock_rate <= 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'clock-rate' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+
+	jb->min_latency = my_prop_lookup_duration(conf->properties, "min-latency", MY_MSEC(MY_JITTER_MIN_LATENCY));
+	jb->max_latency = my_prop_lookup_duration(conf->properties, "max-latency", MY_MSEC(MY_JITTER_MAX_LATENCY));
+	if (jb->max_latency < jb->min_latency) {
+		my_log(MY_LOG_ERROR, "core/%s: 'max-latency' lower than 'min-latency'", conf->name);
+		goto _MY_ERR_conf;
+	}
+
+	jb->factor = my_prop_lookup_int(conf->properties, "jitter-factor", MY_JITTER_FACTOR);
+	if (jb->factor < 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'jitter-factor' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+
+	/* until measured */
+	jb->period = MY_MSEC(MY_JITTER_PERIOD);
+	jb->target = jb->min_latency;
+
+	return port;
+
+_MY_ERR_conf:
+	my_port_destroy_priv(port);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_filter_jitter_destroy(my_port_t *port)
+{
+	my_filter_priv_t *jb = MY_FILTER(port);
+
+	if (jb->alarm) {
+		my_loop_alarm_del(port->loop, jb->alarm);
+		my_filter_jitter_report(port, 0, 1);
+	}
+
+	my_filter_jitter_flush(jb);
+	if (jb->last_played) {
+		my_buf_unref(jb->last_played);
+	}
+
+	my_port_destroy_priv(port);
+}
+
+my_port_impl_t my_filter_jitter = {
+	.name = "jitter",
+	.desc = "Jitter buffer filter",
+	.create = my_filter_jitter_create,
+	.destroy = my_filter_jitter_destroy,
+	.push_buf = my_filter_jitter_push_buf,
+	.set = my_filter_jitter_set,
+};
@@ -0,0 +1,383 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/ports.h"
+
+#include "util/audio.h"
+#include "util/buf.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/mem.h"
+#include "util/mix.h"
+#include "util/prop.h"
+
+/*
+ * Mixes the streams of all the ports wired to it. The output is produced on
+ * a fixed clock, one 'period' at a time, once 'latency' has passed since the
+ * end of the period: input frames are placed on the output timeline by their
+ * timestamp, and whatever hasn't arrived by then is mixed in as silence and
+ * dropped when it eventually comes, so that a late input never stalls the
+ * others. All inputs must share the format of the first buffer received.
+ */
+
+#define MY_MIX_INPUTS_MAX 8
+#define MY_MIX_QUEUE_LEN 16
+
+#define MY_MIX_PERIOD 20
+#define MY_MIX_LATENCY 60
+
+typedef struct my_mix_input_s my_mix_input_t;
+
+struct my_mix_input_s {
+	my_port_t *port;
+	my_buf_t *bufs[MY_MIX_QUEUE_LEN];
+	/* first frame of each buffer, on the output timeline */
+	int64_t starts[MY_MIX_QUEUE_LEN];
+	int head;
+	int count;
+	/* where the next buffer is expected to start, if any */
+	int64_t next;
+	int contiguous;
+	int late;
+};
+
+typedef struct my_filter_priv_s my_filter_priv_t;
+
+struct my_filter_priv_s {
+	my_dport_t _inherited;
+	int period;
+	int latency;
+	my_alarm_t *alarm;
+	my_audio_format_t format;
+	int frame_size;
+	int frames;
+	/* time of frame #0 of the output timeline */
+	uint64_t base;
+	/* first frame of the next period */
+	int64_t pos;
+	my_mix_input_t inputs[MY_MIX_INPUTS_MAX];
+	int input_count;
+};
+
+#define MY_FILTER(p) ((my_filter_priv_t *)(p))
+#define MY_FILTER_SIZE (sizeof(my_filter_priv_t))
+
+
+static int64_t my_filter_mix_time_to_frame(my_filter_priv_t *mix, uint64_t t)
+{
+	int64_t ns = (int64_t)(t - mix->base);
+	int64_t half = ns < 0 ? -500000000LL : 500000000LL;
+
+	return (ns * mix->format.rate + half) / 1000000000LL;
+}
+
+static uint64_t my_filter_mix_frame_to_time(my_filter_priv_t *mix, int64_t frame)
+{
+	return mix->base + frame * 1000000000LL / mix->format.rate;
+}
+
+static void my_filter_mix_input_drop(my_mix_input_t *input)
+{
+	my_buf_unref(input->bufs[input->head]);
+	input->head = (input->head + 1) % MY_MIX_QUEUE_LEN;
+	input->count--;
+}
+
+static my_mix_input_t *my_filter_mix_input_get(my_port_t *port, my_port_t *from)
+{
+	my_filter_priv_t *mix = MY_FILTER(port);
+	my_mix_input_t *input;
+	int i;
+
+	for (i = 0; i < mix->input_count; i++) {
+		if (mix->inputs[i].port == from) {
+			return &mix->inputs[i];
+		}
+	}
+
+	if (mix->input_count == MY_MIX_INPUTS_MAX) {
+		return NULL;
+	}
+
+	input = &mix->inputs[mix->input_count++];
+	input->port = from;
+
+	return input;
+}
+
+/* add the input frames falling in [pos, pos + frames) to 'out' */
+static void my_filter_mix_input(my_filter_priv_t *mix, my_mix_input_t *input, char *out)
+{
+	int channels = mix->format.channels;
+	int64_t start, end, from, to;
+	my_buf_t *buf;
+	char *src, *dst;
+	int i, k;
+
+	for (i = 0; i < input->count; i++) {
+		k = (input->head + i) % MY_MIX_QUEUE_LEN;
+		buf = input->bufs[k];
+		start = input->starts[k];
+		end = start + buf->len / mix->frame_size;
+
+		from = start > mix->pos ? start : mix->pos;
+		to = end < mix->pos + mix->frames ? end : mix->pos + mix->frames;
+		if (from >= to) {
+			continue;
+		}
+
+		src = buf->data + (from - start) * mix->frame_size;
+		dst = out + (from - mix->pos) * mix->frame_size;
+		if (mix->format.encoding == MY_AUDIO_ENCODING_S16) {
+			my_mix_add_s16((int16_t *)dst, (int16_t *)src, (to - from) * channels);
+		} else {
+			my_mix_add_f32((float *)dst, (float *)src, (to - from) * channels);
+		}
+	}
+
+	/* done with those ending in this period */
+	while (input->count > 0) {
+		buf = input->bufs[input->head];
+		end = input->starts[input->head] + buf->len / mix->frame_size;
+		if (end > mix->pos + mix->frames) {
+			break;
+		}
+		my_filter_mix_input_drop(input);
+	}
+}
+
+static int my_filter_mix_period(my_port_t *port)
+{
+	my_filter_priv_t *mix = MY_FILTER(port);
+	my_buf_t *buf;
+	int i, pending = 0;
+
+	for (i = 0; i < mix->input_count; i++) {
+		pending += mix->inputs[i].count;
+	}
+
+	/* nothing to mix, don't send silence around */
+	if (pending == 0) {
+		return 0;
+	}
+
+	buf = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return -1;
+	}
+
+	buf->len = mix->frames * mix->frame_size;
+	buf->timestamp = my_filter_mix_frame_to_time(mix, mix->pos);
+	buf->format = mix->format;
+	my_mem_zero(buf->data, buf->len);
+
+	for (i = 0; i < mix->input_count; i++) {
+		my_filter_mix_input(mix, &mix->inputs[i], buf->data);
+	}
+
+	if (mix->format.encoding == MY_AUDIO_ENCODING_F32) {
+		my_mix_clamp_f32((float *)buf->data, mix->frames * mix->format.channels);
+	}
+
+	my_port_push_buf_peers(port, buf);
+	my_buf_unref(buf);
+
+	return 0;
+}
+
+static int my_filter_mix_alarm_handler(void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	my_filter_priv_t *mix = MY_FILTER(port);
+	uint64_t now;
+
+	now = my_core_get_time(port->core);
+
+	/* every period whose inputs had their 'latency' worth of time to arrive */
+	while ((int64_t)(now - my_filter_mix_frame_to_time(mix, mix->pos + mix->frames)) >= (int64_t)MY_MSEC(mix->latency)) {
+		my_filter_mix_period(port);
+		mix->pos += mix->frames;
+	}
+
+	return 0;
+}
+
+static int my_filter_mix_start(my_port_t *port, my_buf_t *buf)
+{
+	my_filter_priv_t *mix = MY_FILTER(port);
+	int sample_size;
+	int max;
+
+	if (buf->format.encoding == MY_AUDIO_ENCODING_S16) {
+		sample_size = sizeof(int16_t);
+	} else if (buf->format.encoding == MY_AUDIO_ENCODING_F32) {
+		sample_size = sizeof(float);
+	} else {
+		my_log(MY_LOG_ERROR, "core/%s: unsupported sample encoding (%d)", port->conf->name, buf->format.encoding);
+		return -1;
+	}
+
+	if ((buf->format.rate <= 0) || (buf->format.channels <= 0)) {
+		my_log(MY_LOG_ERROR, "core/%s: unsupported format (%d Hz, %d channels)", port->conf->name, buf->format.rate, buf->format.channels);
+		return -1;
+	}
+
+	mix->format = buf->format;
+	mix->frame_size = sample_size * mix->format.channels;
+
+	/* a period has to fit in a buffer */
+	mix->frames = (int64_t)mix->format.rate * mix->period / 1000;
+	max = my_buf_pool_get_size(my_loop_get_buf_pool(port->loop)) / mix->frame_size;
+	if (mix->frames > max) {
+		my_log(MY_LOG_WARNING, "core/%s: period shortened to %d frames", port->conf->name, max);
+		mix->frames = max;
+	}
+	if (mix->frames < 1) {
+		mix->frames = 1;
+	}
+
+	mix->base = buf->timestamp;
+	mix->pos = 0;
+
+	mix->alarm = my_loop_alarm_add(port->loop, MY_MSEC(mix->period), 1, my_filter_mix_alarm_handler, port);
+	if (!mix->alarm) {
+		my_log(MY_LOG_ERROR, "core/%s: error adding alarm", port->conf->name);
+		return -1;
+	}
+
+	MY_DEBUG("core/%s: mixing %d Hz, %d channels, %d frames per period (%s)", port->conf->name,
+		 mix->format.rate, mix->format.channels, mix->frames, my_mix_get_impl());
+
+	return 0;
+}
+
+static int my_filter_mix_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	my_filter_priv_t *mix = MY_FILTER(port);
+	my_mix_input_t *input;
+	int64_t start, end;
+	int k;
+
+	if (!mix->alarm) {
+		if (my_filter_mix_start(port, buf) != 0) {
+			return -1;
+		}
+	} else if (memcmp(&buf->format, &mix->format, sizeof(mix->format)) != 0) {
+		MY_DEBUG("core/%s: dropping buffer in another format", port->conf->name);
+		return 0;
+	}
+
+	input = my_filter_mix_input_get(port, from);
+	if (!input) {
+		my_log(MY_LOG_WARNING, "core/%s: too many inputs, ignoring '%s'", port->conf->name, from ? from->conf->name : "?");
+		return 0;
+	}
+
+	/* timestamps jitter, keep back-to-back buffers back to back */
+	start = my_filter_mix_time_to_frame(mix, buf->timestamp);
+	if (input->contiguous && llabs(start - input->next) <= mix->frames) {
+		start = input->next;
+	}
+	end = start + buf->len / mix->frame_size;
+
+	input->next = end;
+	input->contiguous = 1;
+
+	/* too late, already mixed as silence */
+	if (end <= mix->pos) {
+		input->late++;
+		MY_DEBUG("core/%s: dropping late buffer (%d so far)", port->conf->name, input->late);
+		return buf->len;
+	}
+
+	if (input->count == MY_MIX_QUEUE_LEN) {
+		MY_DEBUG("core/%s: input queue full, dropping oldest buffer", port->conf->name);
+		my_filter_mix_input_drop(input);
+	}
+
+	k = (input->head + input->count) % MY_MIX_QUEUE_LEN;
+	input->bufs[k] = my_buf_ref(buf);
+	input->starts[k] = start;
+	input->count++;
+
+	return buf->len;
+}
+
+
+static my_port_t *my_filter_mix_create(my_core_t *core, my_port_conf_t *conf)
+{
+	my_port_t *port;
+
+	port = my_port_create_priv(MY_FILTER_SIZE);
+	if (!port) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating data", conf->name);
+		goto _MY_ERR_alloc;
+	}
+
+	/* in ms */
+	MY_FILTER(port)->period = my_prop_lookup_duration(conf->properties, "period", MY_MSEC(MY_MIX_PERIOD)) / MY_MSEC(1);
+	if (MY_FILTER(port)->period <= 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'period' property '%s'", conf->name, my_prop_lookup(conf->properties, "period"));
+		goto _MY_ERR_conf;
+	}
+
+	MY_FILTER(port)->latency = my_prop_lookup_duration(conf->properties, "latency", MY_MSEC(MY_MIX_LATENCY)) / MY_MSEC(1);
+
+	return port;
+
+_MY_ERR_conf:
+	my_port_destroy_priv(port);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_filter_mix_destroy(my_port_t *port)
+{
+	my_filter_priv_t *mix = MY_FILTER(port);
+	int i;
+
+	if (mix->alarm) {
+		my_loop_alarm_del(port->loop, mix->alarm);
+	}
+
+	for (i = 0; i < mix->input_count; i++) {
+		while (mix->inputs[i].count > 0) {
+			my_filter_mix_input_drop(&mix->inputs[i]);
+		}
+	}
+
+	my_port_destroy_priv(port);
+}
+
+my_port_impl_t my_filter_mix = {
+	.name = "mix",
+	.desc = "Mixer filter",
+	.create = my_filter_mix_create,
+	.destroy = my_filter_mix_destroy,
+	.push_buf = my_filter_mix_push_buf,
+};
@@ -60,9 +60,20 @@ static void my_filter_null_destroy(my_port_t *port)
 	my_port_destroy_priv(port);
 }
 
+/* pass through untouched, without copying */
+static int my_filter_null_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	if (my_port_push_buf_peers(port, buf) != 0) {
+		return -1;
+	}
+
+	return buf->len;
+}
+
 my_port_impl_t my_filter_null = {
 	.name = "null",
 	.desc = "Null filter",
 	.create = my_filter_null_create,
 	.destroy = my_filter_null_destroy,
+	.push_buf = my_filter_null_push_buf,
 };
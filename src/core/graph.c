@@ -0,0 +1,437 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/graph.h"
+
+#include "core/loop.h"
+#include "core/ports.h"
+
+#include "util/buf.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/mem.h"
+#include "util/prop.h"
+
+struct my_graph_node_s {
+	my_graph_t *graph;
+	my_port_t *port;
+	int inputs;
+	/* sinks */
+	int period;
+	uint64_t interval;
+	int clocked;
+	my_alarm_t *alarm;
+	my_port_t **sources;
+	int source_count;
+	/* sources, the sink driving them */
+	my_graph_node_t *sink;
+	int visited;
+};
+
+struct my_graph_s {
+	my_core_t *core;
+	/* in topological order */
+	my_graph_node_t *nodes;
+	int count;
+};
+
+#define MY_GRAPH_NODE(p) (MY_DPORT(p)->node)
+
+
+static int my_graph_collect(my_list_t *list, my_port_t **ports, int count)
+{
+	my_node_t *node;
+	my_port_t *port;
+
+	my_list_for_each(list, node, port) {
+		if (my_port_is_linked(port)) {
+			ports[count++] = port;
+		}
+	}
+
+	return count;
+}
+
+static int my_graph_lookup(my_list_t *list, my_port_t *port)
+{
+	my_node_t *node;
+	my_port_t *p;
+
+	my_list_for_each(list, node, p) {
+		if (p == port) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int my_graph_count(my_list_t *list)
+{
+	my_node_t *node;
+	my_port_t *port;
+	int count = 0;
+
+	my_list_for_each(list, node, port) {
+		count++;
+	}
+
+	return count;
+}
+
+/* Kahn's algorithm: repeatedly take a port nothing feeds anymore */
+static int my_graph_sort(my_graph_t *graph, my_port_t **ports, int count)
+{
+	my_graph_node_t *tmp;
+	my_node_t *node;
+	my_port_t *peer;
+	int head, tail;
+	int i;
+
+	tmp = my_mem_alloc(count * sizeof(*tmp));
+	if (!tmp) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		MY_GRAPH_NODE(ports[i]) = &tmp[i];
+	}
+	for (i = 0; i < count; i++) {
+		if (MY_DPORT(ports[i])->peers) {
+			my_list_for_each(MY_DPORT(ports[i])->peers, node, peer) {
+				MY_GRAPH_NODE(peer)->inputs++;
+			}
+		}
+	}
+
+	tail = 0;
+	for (i = 0; i < count; i++) {
+		if (tmp[i].inputs == 0) {
+			graph->nodes[tail++].port = ports[i];
+		}
+	}
+
+	for (head = 0; head < tail; head++) {
+		if (!MY_DPORT(graph->nodes[head].port)->peers) {
+			continue;
+		}
+		my_list_for_each(MY_DPORT(graph->nodes[head].port)->peers, node, peer) {
+			if (--MY_GRAPH_NODE(peer)->inputs == 0) {
+				graph->nodes[tail++].port = peer;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		MY_GRAPH_NODE(ports[i]) = NULL;
+	}
+	my_mem_free(tmp);
+
+	/* whatever is left is part of a cycle */
+	if (tail < count) {
+		errno = ELOOP;
+		return -1;
+	}
+
+	return 0;
+}
+
+static my_graph_node_t *my_graph_find_sink(my_graph_node_t *gnode)
+{
+	my_graph_node_t *sink;
+	my_node_t *node;
+	my_port_t *peer;
+
+	if (gnode->visited) {
+		return NULL;
+	}
+	gnode->visited = 1;
+
+	if (!MY_DPORT(gnode->port)->peers) {
+		return gnode;
+	}
+
+	my_list_for_each(MY_DPORT(gnode->port)->peers, node, peer) {
+		sink = my_graph_find_sink(MY_GRAPH_NODE(peer));
+		if (sink) {
+			return sink;
+		}
+	}
+
+	return NULL;
+}
+
+static int my_graph_sink_setup(my_graph_node_t *gnode)
+{
+	my_port_conf_t *conf = gnode->port->conf;
+	char *period;
+	uint64_t frames;
+	int rate, channels;
+
+	/* a duration, as for the mix filter */
+	gnode->interval = MY_MSEC(MY_GRAPH_PERIOD);
+	period = my_prop_lookup(conf->properties, "period");
+	if (period && ((my_prop_parse_duration(period, &gnode->interval) != 0) || (gnode->interval == 0))) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'period' property '%s'", conf->name, period);
+		return -1;
+	}
+
+	rate = my_prop_lookup_int(conf->properties, "rate", MY_GRAPH_RATE);
+	if (rate <= 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'rate' property", conf->name);
+		return -1;
+	}
+
+	channels = my_prop_lookup_int(conf->properties, "channels", MY_GRAPH_CHANNELS);
+	if (channels <= 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'channels' property", conf->name);
+		return -1;
+	}
+
+	/* in frames of 16 bits samples */
+	frames = (gnode->interval < UINT64_MAX / rate) ? gnode->interval * rate / MY_SEC(1) : 0;
+	if ((frames == 0) || (frames > INT_MAX / (channels * sizeof(int16_t)))) {
+		my_log(MY_LOG_ERROR, "core/%s: 'period' property out of range", conf->name);
+		return -1;
+	}
+	gnode->period = frames * channels * sizeof(int16_t);
+
+	return 0;
+}
+
+my_graph_t *my_graph_create(my_core_t *core)
+{
+	my_graph_t *graph;
+	my_graph_node_t *gnode, *sink;
+	my_port_t **ports;
+	int count;
+	int i, j;
+
+	graph = my_mem_alloc(sizeof(*graph));
+	if (!graph) {
+		MY_ERROR("core/graph: error allocating data (%s)", strerror(errno));
+		goto _MY_ERR_alloc;
+	}
+	graph->core = core;
+
+	count = my_graph_count(core->sources) + my_graph_count(core->filters) + my_graph_count(core->targets);
+	ports = my_mem_alloc((count + 1) * sizeof(my_port_t *));
+	if (!ports) {
+		MY_ERROR("core/graph: error allocating data (%s)", strerror(errno));
+		goto _MY_ERR_alloc_ports;
+	}
+
+	count = my_graph_collect(core->sources, ports, 0);
+	count = my_graph_collect(core->filters, ports, count);
+	count = my_graph_collect(core->targets, ports, count);
+
+	graph->nodes = my_mem_alloc((count + 1) * sizeof(my_graph_node_t));
+	if (!graph->nodes) {
+		MY_ERROR("core/graph: error allocating data (%s)", strerror(errno));
+		goto _MY_ERR_alloc_nodes;
+	}
+	graph->count = count;
+
+	if (my_graph_sort(graph, ports, count) != 0) {
+		MY_ERROR("core/graph: error ordering wirings (%s)", strerror(errno));
+		goto _MY_ERR_sort;
+	}
+
+	for (i = 0; i < count; i++) {
+		gnode = &graph->nodes[i];
+		gnode->graph = graph;
+		MY_GRAPH_NODE(gnode->port) = gnode;
+		if (!MY_DPORT(gnode->port)->peers && (my_graph_sink_setup(gnode) != 0)) {
+			goto _MY_ERR_sink_setup;
+		}
+	}
+
+	/* hand each source to the first sink it reaches */
+	for (i = 0; i < count; i++) {
+		if (!my_graph_lookup(core->sources, graph->nodes[i].port)) {
+			continue;
+		}
+		for (j = 0; j < count; j++) {
+			graph->nodes[j].visited = 0;
+		}
+
+		gnode = &graph->nodes[i];
+		sink = my_graph_find_sink(gnode);
+		if (!sink) {
+			continue;
+		}
+
+		if (!sink->sources) {
+			sink->sources = my_mem_alloc(count * sizeof(my_port_t *));
+			if (!sink->sources) {
+				MY_ERROR("core/graph: error allocating data (%s)", strerror(errno));
+				goto _MY_ERR_alloc_sources;
+			}
+		}
+		sink->sources[sink->source_count++] = gnode->port;
+		gnode->sink = sink;
+
+		MY_DEBUG("core/graph: '%s' driven by '%s'", gnode->port->conf->name, sink->port->conf->name);
+	}
+
+	my_mem_free(ports);
+
+	return graph;
+
+_MY_ERR_alloc_sources:
+_MY_ERR_sink_setup:
+	for (i = 0; i < count; i++) {
+		my_mem_free(graph->nodes[i].sources);
+		MY_GRAPH_NODE(graph->nodes[i].port) = NULL;
+	}
+_MY_ERR_sort:
+	my_mem_free(graph->nodes);
+_MY_ERR_alloc_nodes:
+	my_mem_free(ports);
+_MY_ERR_alloc_ports:
+	my_mem_free(graph);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+void my_graph_destroy(my_graph_t *graph)
+{
+	int i;
+
+	my_graph_stop(graph);
+
+	for (i = 0; i < graph->count; i++) {
+		my_mem_free(graph->nodes[i].sources);
+		MY_GRAPH_NODE(graph->nodes[i].port) = NULL;
+	}
+
+	my_mem_free(graph->nodes);
+	my_mem_free(graph);
+}
+
+
+static int my_graph_alarm_handler(void *p)
+{
+	my_graph_node_t *gnode = p;
+
+	my_graph_pull(gnode->port);
+
+	return 0;
+}
+
+/* sinks without a clock of their own run on an alarm, on their reactor */
+int my_graph_start(my_graph_t *graph)
+{
+	my_graph_node_t *gnode;
+	int i;
+
+	for (i = 0; i < graph->count; i++) {
+		gnode = &graph->nodes[i];
+		if (!gnode->sources || gnode->clocked) {
+			continue;
+		}
+
+		gnode->alarm = my_loop_alarm_add(gnode->port->loop, gnode->interval, 1, my_graph_alarm_handler, gnode);
+		if (!gnode->alarm) {
+			my_log(MY_LOG_ERROR, "core/%s: error adding alarm", gnode->port->conf->name);
+			goto _MY_ERR_alarm_add;
+		}
+
+		MY_DEBUG("core/%s: pulling %d bytes every %llu ns", gnode->port->conf->name, gnode->period, (unsigned long long)gnode->interval);
+	}
+
+	return 0;
+
+_MY_ERR_alarm_add:
+	my_graph_stop(graph);
+	return -1;
+}
+
+void my_graph_stop(my_graph_t *graph)
+{
+	my_graph_node_t *gnode;
+	int i;
+
+	for (i = 0; i < graph->count; i++) {
+		gnode = &graph->nodes[i];
+		if (gnode->alarm) {
+			my_loop_alarm_del(gnode->port->loop, gnode->alarm);
+			gnode->alarm = NULL;
+		}
+	}
+}
+
+
+int my_graph_is_scheduled(my_port_t *port)
+{
+	return MY_GRAPH_NODE(port) != NULL;
+}
+
+void my_graph_clock(my_port_t *port)
+{
+	MY_GRAPH_NODE(port)->clocked = 1;
+}
+
+uint64_t my_graph_get_interval(my_port_t *port)
+{
+	return MY_GRAPH_NODE(port)->interval;
+}
+
+int my_graph_pull(my_port_t *port)
+{
+	my_graph_node_t *gnode = MY_GRAPH_NODE(port);
+	my_buf_t *buf;
+	int total = 0;
+	int i, len;
+
+	for (i = 0; i < gnode->source_count; i++) {
+		/* some other sink is backed up */
+		if (my_port_is_throttled(gnode->sources[i])) {
+			continue;
+		}
+
+		/* never more than what every sink downstream can take */
+		len = my_port_get_room(gnode->sources[i]);
+		if (len > gnode->period) {
+			len = gnode->period;
+		} else if (len == 0) {
+			continue;
+		}
+
+		buf = my_port_pull_buf(gnode->sources[i], len);
+		if (!buf) {
+			continue;
+		}
+
+		total += buf->len;
+		my_port_push_buf_peers(gnode->sources[i], buf);
+		my_buf_unref(buf);
+	}
+
+	return total;
+}
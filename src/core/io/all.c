@@ -20,6 +20,7 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -36,17 +37,23 @@ static my_list_t my_targets;
 
 #define MY_CONTROL_REGISTER(x) { \
 	extern my_port_impl_t my_control_##x; \
-	my_port_impl_register(&my_controls, &my_control_##x); \
+	if (my_port_impl_register(&my_controls, &my_control_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/controls: error registering '%s' (%s)", my_control_##x.name, strerror(errno)); \
+	} \
 }
 
 	#define MY_SOURCE_REGISTER(x) { \
 	extern my_port_impl_t my_source_##x; \
-	my_port_impl_register(&my_sources, &my_source_##x); \
+	if (my_port_impl_register(&my_sources, &my_source_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/sources: error registering '%s' (%s)", my_source_##x.name, strerror(errno)); \
+	} \
 }
 
 #define MY_TARGET_REGISTER(x) { \
 	extern my_port_impl_t my_target_##x; \
-	my_port_impl_register(&my_targets, &my_target_##x); \
+	if (my_port_impl_register(&my_targets, &my_target_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/targets: error registering '%s' (%s)", my_target_##x.name, strerror(errno)); \
+	} \
 }
 
 
@@ -82,7 +89,8 @@ static int my_control_create_fn(void *data, void *user, int flags)
 
 	port = my_port_create(core, conf, impl);
 	if (port) {
-		my_list_enqueue(core->controls, port);
+		port->loop = my_core_get_control_loop(core);
+		my_port_register(core->controls, port);
 	}
 
 	return 0;
@@ -182,7 +190,9 @@ static int my_source_create_fn(void *data, void *user, int flags)
 
 	port = my_port_create(core, conf, impl);
 	if (port) {
-		my_list_enqueue(core->sources, port);
+		/* until wired */
+		port->loop = my_core_get_reactor(core, 0);
+		my_port_register(core->sources, port);
 	}
 
 	return 0;
@@ -283,7 +293,9 @@ static int my_target_create_fn(void *data, void *user, int flags)
 
 	port = my_port_create(core, conf, impl);
 	if (port) {
-		my_list_enqueue(core->targets, port);
+		/* until wired */
+		port->loop = my_core_get_reactor(core, 0);
+		my_port_register(core->targets, port);
 	}
 
 	return 0;
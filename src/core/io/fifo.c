@@ -48,7 +48,7 @@ struct my_control_priv_s {
 
 #define MY_CONTROL_BUF_SIZE  255
 
-static int my_control_fifo_event_handler(int fd, void *p)
+static int my_control_fifo_event_handler(int fd, int events, void *p)
 {
 	my_port_t *port = (my_port_t *)p;
 	char buf[MY_CONTROL_BUF_SIZE + 1];
@@ -122,7 +122,7 @@ static int my_control_fifo_open(my_port_t *port)
 		goto _MY_ERR_open_fifo;
 	}
 
-	my_core_event_handler_add(port->core, MY_CONTROL(port)->fd, my_control_fifo_event_handler, port);
+	my_loop_event_handler_add(port->loop, MY_CONTROL(port)->fd, MY_EVENT_READ, my_control_fifo_event_handler, port);
 
 	return 0;
 
@@ -133,7 +133,7 @@ _MY_ERR_create_fifo:
 
 static int my_control_fifo_close(my_port_t *port)
 {
-	my_core_event_handler_del(port->core, MY_CONTROL(port)->fd);
+	my_loop_event_handler_del(port->loop, MY_CONTROL(port)->fd);
 
 	MY_DEBUG("core/%s: closing fifo '%s'", port->conf->name, MY_CONTROL(port)->path);
 	if (close(MY_CONTROL(port)->fd) == -1) {
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "core/graph.h"
 #include "core/ports.h"
 
 #include "util/log.h"
@@ -40,24 +41,69 @@ struct my_file_priv_s {
 	my_dport_t _inherited;
 	char *path;
 	int fd;
+	/* read() returned 0, a decoder may still have output left though */
+	int eof;
 };
 
 #define MY_FILE(p) ((my_file_priv_t *)(p))
 #define MY_FILE_SIZE (sizeof(my_file_priv_t))
 
-static int my_source_file_event_handler(int fd, void *p)
+static int my_source_file_event_handler(int fd, int events, void *p)
 {
-	my_file_priv_t *source = MY_FILE(p);
+	my_port_t *port = MY_PORT(p);
+	my_buf_t *buf;
+	int len;
+
+	/* decoded data can be much larger than what was read, don't drop any */
+	len = my_port_get_room(port);
+	if (len == 0) {
+		return 0;
+	}
+
+	buf = my_port_pull_buf(port, len);
+	if (!buf) {
+		/* the decoder may only need more input, or be skipping some */
+		if (!MY_FILE(port)->eof && !MY_DPORT(port)->aio_eof) {
+			return 0;
+		}
+		MY_DEBUG("core/%s: end of file '%s'", port->conf->name, MY_FILE(port)->path);
+		my_loop_event_handler_mod(port->loop, fd, 0);
+		return 0;
+	}
+
+	my_port_push_buf_peers(port, buf);
+	my_buf_unref(buf);
+
+	/* read by the loop, until the decoder has nothing left */
+	if (MY_DPORT(port)->aio_eof) {
+		my_port_aio_kick(port);
+	}
 
-	/* do something */
 	return 0;
 }
 
-static int my_target_file_event_handler(int fd, void *p)
+static int my_source_file_pause(my_port_t *port, int paused)
+{
+	if (MY_DPORT(port)->aio_op) {
+		return my_port_aio_pause(port, paused);
+	}
+
+	/* not watched when scheduled, the scheduler skips it instead */
+	if (my_graph_is_scheduled(port)) {
+		return 0;
+	}
+
+	return my_loop_event_handler_mod(port->loop, MY_FILE(port)->fd, paused ? 0 : MY_EVENT_READ);
+}
+
+static int my_target_file_event_handler(int fd, int events, void *p)
 {
-	my_file_priv_t *source = MY_FILE(p);
+	my_port_t *port = MY_PORT(p);
+
+	if (events & MY_EVENT_WRITE) {
+		my_port_queue_flush(port, fd);
+	}
 
-	/* do something */
 	return 0;
 }
 
@@ -91,11 +137,41 @@ static void my_io_file_destroy(my_port_t *port)
 	my_port_destroy_priv(port);
 }
 
+static my_port_t *my_source_file_create(my_core_t *core, my_port_conf_t *conf)
+{
+	my_port_t *port;
+
+	port = my_io_file_create(core, conf);
+	if (!port) {
+		goto _MY_ERR_create;
+	}
+
+	if (my_port_decoder_create(port, conf) != 0) {
+		goto _MY_ERR_decoder_create;
+	}
+
+	return port;
+
+_MY_ERR_decoder_create:
+	my_io_file_destroy(port);
+_MY_ERR_create:
+	return NULL;
+}
+
+static void my_source_file_destroy(my_port_t *port)
+{
+	my_port_decoder_destroy(port);
+	my_io_file_destroy(port);
+}
+
 static int my_io_file_open(my_port_t *port)
 {
+	int events;
+	int aio;
 	int rc;
 
 	MY_DEBUG("core/%s: opening file '%s'", port->conf->name, MY_FILE(port)->path);
+	MY_FILE(port)->eof = 0;
 	MY_FILE(port)->fd = open(MY_FILE(port)->path, O_RDWR, 0);
 	if (MY_FILE(port)->fd == -1) {
 		my_log(MY_LOG_ERROR, "core/%s: error opening file '%s' (%s)", port->conf->name, MY_FILE(port)->path, strerror(errno));
@@ -109,11 +185,39 @@ static int my_io_file_open(my_port_t *port)
 		goto _MY_ERR_set_nonblock;
 	}
 
-	my_core_event_handler_add(port->core, MY_FILE(port)->fd, MY_PORT_GET_IMPL(port)->handler, port);
+	/* or read & written by the loop itself, where it can */
+	aio = my_port_aio_open(port, MY_FILE(port)->fd, MY_PORT_GET_IMPL(port)->put ? MY_POLLER_IO_WRITE : MY_POLLER_IO_READ);
+	if (aio < 0) {
+		goto _MY_ERR_aio_open;
+	}
+
+	/* targets only watch for write readiness while their output queue isn't empty */
+	if (MY_PORT_GET_IMPL(port)->put) {
+		if (my_port_queue_create(port) != 0) {
+			goto _MY_ERR_queue_create;
+		}
+		events = 0;
+	} else if (aio || my_graph_is_scheduled(port)) {
+		/* read when pulled */
+		events = 0;
+	} else {
+		events = MY_EVENT_READ;
+	}
+
+	if (my_loop_event_handler_add(port->loop, MY_FILE(port)->fd, events, MY_PORT_GET_IMPL(port)->handler, port) != 0) {
+		goto _MY_ERR_event_handler_add;
+	}
+
 	return 0;
 
-_MY_ERR_open_file:
+_MY_ERR_event_handler_add:
+	my_port_queue_destroy(port);
+_MY_ERR_queue_create:
+	my_port_aio_close(port);
+_MY_ERR_aio_open:
 _MY_ERR_set_nonblock:
+	close(MY_FILE(port)->fd);
+_MY_ERR_open_file:
 	return -1;
 }
 
@@ -121,7 +225,9 @@ static int my_io_file_close(my_port_t *port)
 {
 	int ret;
 
-	my_core_event_handler_del(port->core, MY_FILE(port)->fd);
+	my_port_aio_close(port);
+	my_loop_event_handler_del(port->loop, MY_FILE(port)->fd);
+	my_port_queue_destroy(port);
 	MY_DEBUG("core/%s: closing file '%s'", port->conf->name, MY_FILE(port)->path);
 
 	ret = close(MY_FILE(port)->fd);
@@ -135,6 +241,11 @@ static int my_io_file_get(my_port_t *port, void *buf, int len)
 {
 	int ret;
 
+	if (MY_DPORT(port)->aio_op) {
+		ret = my_port_aio_get(port, buf, len);
+		goto out;
+	}
+
 	ret = read(MY_FILE(port)->fd, buf, len);
 	if (ret < 0) {
 		if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
@@ -146,6 +257,10 @@ static int my_io_file_get(my_port_t *port, void *buf, int len)
 		return ret;
 	}
 
+	if ((ret == 0) && (len > 0)) {
+		MY_FILE(port)->eof = 1;
+	}
+
 out:
 	MY_DEBUG("core/%s: read %d bytes from file '%s'", port->conf->name, ret, MY_FILE(port)->path);
 	return ret;
@@ -155,18 +270,13 @@ static int my_io_file_put(my_port_t *port, void *buf, int len)
 {
 	int ret;
 
-	ret = write(MY_FILE(port)->fd, buf, len);
+	ret = my_port_queue_write(port, MY_FILE(port)->fd, buf, len);
 	if (ret < 0) {
-		if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
-			ret = 0;
-			goto out;
-		}
-
-		my_log(MY_LOG_ERROR, "core/%s: error writing to file '%s' (%d: %s)", port->conf->name, MY_FILE(port)->path, errno, strerror(errno));
+		my_log(MY_LOG_ERROR, "core/%s: error writing to file '%s'", port->conf->name, MY_FILE(port)->path);
 		goto out;
 	}
 
-	MY_DEBUG("core/%s: wrote %d bytes to file '%s'", port->conf->name, ret, MY_FILE(port)->path);
+	MY_DEBUG("core/%s: queued %d bytes to file '%s'", port->conf->name, ret, MY_FILE(port)->path);
 
 out:
 	return ret;
@@ -175,11 +285,12 @@ out:
 my_port_impl_t my_source_file = {
 	.name = "file",
 	.desc = "Regular file source",
-	.create = my_io_file_create,
-	.destroy = my_io_file_destroy,
+	.create = my_source_file_create,
+	.destroy = my_source_file_destroy,
 	.open = my_io_file_open,
 	.close = my_io_file_close,
 	.get = my_io_file_get,
+	.pause = my_source_file_pause,
 	.handler = my_source_file_event_handler,
 };
 
@@ -29,6 +29,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "core/graph.h"
 #include "core/ports.h"
 
 #include "util/log.h"
@@ -43,16 +44,48 @@ struct my_target_priv_s {
 	int channels;
 	int rate;
 	int fd;
+	my_alarm_t *retry;
 };
 
 #define MY_TARGET(p) ((my_target_priv_t *)(p))
 #define MY_TARGET_SIZE (sizeof(my_target_priv_t))
 
-static int my_target_oss_event_handler(int fd, void *p)
+static int my_target_oss_retry_handler(void *p)
 {
-	my_target_priv_t *target = MY_TARGET(p);
+	my_port_t *port = MY_PORT(p);
 
-	/* do something */
+	MY_TARGET(port)->retry = NULL;
+	my_loop_event_handler_mod(port->loop, MY_TARGET(port)->fd, MY_EVENT_WRITE);
+
+	return 0;
+}
+
+static int my_target_oss_event_handler(int fd, int events, void *p)
+{
+	my_port_t *port = MY_PORT(p);
+
+	if (events & MY_EVENT_WRITE) {
+		my_port_queue_flush(port, fd);
+
+		/* with the pull scheduler, the device clock drives the graph */
+		if (my_graph_is_scheduled(port) && (my_rbuf_get_avail(MY_DPORT(port)->queue) == 0)) {
+			if (my_graph_pull(port) > 0) {
+				my_loop_event_handler_mod(port->loop, fd, MY_EVENT_WRITE);
+			} else if (!MY_TARGET(port)->retry) {
+				/* starving, try again a period later rather than spin */
+				MY_TARGET(port)->retry = my_loop_alarm_add(port->loop, my_graph_get_interval(port), 0,
+									   my_target_oss_retry_handler, port);
+				if (MY_TARGET(port)->retry) {
+					my_loop_event_handler_mod(port->loop, fd, 0);
+				} else {
+					my_log(MY_LOG_ERROR, "core/%s: error adding alarm, polling the device", port->conf->name);
+				}
+			} else {
+				/* woken up by some other source's data, the retry is pending */
+				my_loop_event_handler_mod(port->loop, fd, 0);
+			}
+		}
+	}
 
 	return 0;
 }
@@ -74,19 +107,9 @@ static my_port_t *my_target_oss_create(my_core_t *core, my_port_conf_t *conf)
 	}
 	MY_TARGET(port)->path = prop;
 
-	prop = my_prop_lookup(conf->properties, "channels");
-	if (prop) {
-		MY_TARGET(port)->channels = atoi(prop);
-	} else {
-		MY_TARGET(port)->channels = -1;
-	}
-
-	prop = my_prop_lookup(conf->properties, "rate");
-	if (prop) {
-		MY_TARGET(port)->rate = atoi(prop);
-	} else {
-		MY_TARGET(port)->rate = -1;
-	}
+	/* or left to the device */
+	MY_TARGET(port)->channels = my_prop_lookup_int(conf->properties, "channels", -1);
+	MY_TARGET(port)->rate = my_prop_lookup_int(conf->properties, "rate", -1);
 
 	return port;
 
@@ -103,11 +126,12 @@ static void my_target_oss_destroy(my_port_t *port)
 
 static int my_target_oss_open(my_port_t *port)
 {
+	int events;
 	int val;
 	int rc;
 
 	MY_DEBUG("core/%s: opening device '%s'", port->conf->name, MY_TARGET(port)->path);
-	MY_TARGET(port)->fd = open(MY_TARGET(port)->path, O_WRONLY, 0);
+	MY_TARGET(port)->fd = open(MY_TARGET(port)->path, O_WRONLY | O_NONBLOCK, 0);
 	if (MY_TARGET(port)->fd == -1) {
 		my_log(MY_LOG_ERROR, "core/%s: error opening device '%s' (%d: %s)", port->conf->name, MY_TARGET(port)->path, errno, strerror(errno));
 		goto _MY_ERR_open_file;
@@ -142,12 +166,31 @@ static int my_target_oss_open(my_port_t *port)
 		goto _MY_ERR_ioctl_SNDCTL_DSP_SETFMT;
 	}
 
-	my_core_event_handler_add(port->core, MY_TARGET(port)->fd, my_target_oss_event_handler, port);
+	/* written by the loop itself where it can, unless the device clock drives the graph */
+	if (my_port_aio_open(port, MY_TARGET(port)->fd, MY_POLLER_IO_WRITE) < 0) {
+		goto _MY_ERR_aio_open;
+	}
+
+	if (my_port_queue_create(port) != 0) {
+		goto _MY_ERR_queue_create;
+	}
+
+	if (my_graph_is_scheduled(port)) {
+		my_graph_clock(port);
+		events = MY_EVENT_WRITE;
+	} else {
+		events = 0;
+	}
+
+	my_loop_event_handler_add(port->loop, MY_TARGET(port)->fd, events, my_target_oss_event_handler, port);
 
 	MY_DEBUG("core/%s: device '%s' opened", port->conf->name, MY_TARGET(port)->path);
 
 	return 0;
 
+_MY_ERR_queue_create:
+	my_port_aio_close(port);
+_MY_ERR_aio_open:
 _MY_ERR_ioctl_SNDCTL_DSP_SETFMT:
 _MY_ERR_ioctl_SNDCTL_DSP_SPEED:
 _MY_ERR_ioctl_SNDCTL_DSP_CHANNELS:
@@ -158,7 +201,14 @@ _MY_ERR_open_file:
 
 static int my_target_oss_close(my_port_t *port)
 {
-	my_core_event_handler_del(port->core, MY_TARGET(port)->fd);
+	if (MY_TARGET(port)->retry) {
+		my_loop_alarm_del(port->loop, MY_TARGET(port)->retry);
+		MY_TARGET(port)->retry = NULL;
+	}
+
+	my_port_aio_close(port);
+	my_loop_event_handler_del(port->loop, MY_TARGET(port)->fd);
+	my_port_queue_destroy(port);
 
 	MY_DEBUG("core/%s: closing device '%s'", port->conf->name, MY_TARGET(port)->path);
 	if (close(MY_TARGET(port)->fd) == -1) {
@@ -172,13 +222,13 @@ static int my_target_oss_put(my_port_t *port, void *buf, int len)
 {
 	int n;
 
-	n = write(MY_TARGET(port)->fd, buf, len);
+	n = my_port_queue_write(port, MY_TARGET(port)->fd, buf, len);
 	if (n == -1) {
-		my_log(MY_LOG_ERROR, "core/%s: error writing to device '%s' (%d: %s)", port->conf->name, MY_TARGET(port)->path, errno, strerror(errno));
+		my_log(MY_LOG_ERROR, "core/%s: error writing to device '%s'", port->conf->name, MY_TARGET(port)->path);
 		return -1;
 	}
 
-	MY_DEBUG("core/%s: wrote %d bytes to device '%s'", port->conf->name, n, MY_TARGET(port)->path);
+	MY_DEBUG("core/%s: queued %d bytes to device '%s'", port->conf->name, n, MY_TARGET(port)->path);
 
 	return n;
 }
@@ -191,4 +241,5 @@ my_port_impl_t my_target_oss = {
 	.open = my_target_oss_open,
 	.close = my_target_oss_close,
 	.put = my_target_oss_put,
+	.handler = my_target_oss_event_handler,
 };
@@ -20,22 +20,30 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "core/graph.h"
 #include "core/ports.h"
 
 #include "util/audio.h"
+#include "util/fec.h"
 #include "util/log.h"
 #include "util/mem.h"
 #include "util/prop.h"
+#include "util/rbuf.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 
 typedef struct my_udp_priv_s my_udp_priv_t;
 
@@ -47,24 +55,329 @@ struct my_udp_priv_s {
 	int sa_len;
 	struct sockaddr *sa_local;
 	struct sockaddr *sa_group;
+	/* what datagrams carry, see MY_UDP_FRAMING_* */
+	int framing;
+	/* sources: datagrams received per call, & room for each of them */
+	int batch;
+	int dgram_size;
+	char **slots;
+	int *lens;
+	struct iovec *iovs;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgs;
+#endif
+	/* rtp sources: headers of the datagrams received, the buffers they land in, & packets not pulled yet */
+	unsigned char *rtp_hdrs;
+	my_buf_t **rtp_bufs;
+	my_buf_pool_t *rtp_pool;
+	my_buf_t *pending;
+	my_buf_t *pending_tail;
+	int pending_count;
+	/*
+	 * with error correction, pending packets are kept in sequence, those
+	 * behind a missing one being held back from the codec until it has
+	 * been recovered, or the parity packet of its group has come (or must
+	 * have been lost) without it
+	 */
+	int fec_window;
+	int fec_started;
+	uint16_t fec_next;
+	uint16_t fec_done;
+	/* rtp targets */
+	int payload_type;
+	int clock_rate;
+	/* set on the first packet sent */
+	int marker;
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t media_base;
+	uint32_t media_time;
+	int media_rate;
+	uint64_t media_pos;
+	/* parity packets, sent by targets every 'fec' packets, used by sources */
+	int fec_payload_type;
+	my_fec_enc_t *fec_enc;
+	my_fec_dec_t *fec_dec;
+	uint16_t fec_seq;
+	/* targets: datagrams sent per call, flushed every round or 'flush-interval' */
+	int gso;
+	uint64_t flush_interval;
+	my_deferred_t flush;
+	my_alarm_t *flush_alarm;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr *out_msgs;
+	struct iovec *out_iovs;
+	char *out_cmsgs;
+	int *out_ends;
+#endif
 };
 
 #define MY_UDP(p) ((my_udp_priv_t *)(p))
 #define MY_UDP_SIZE (sizeof(my_udp_priv_t))
 
-static int my_source_udp_event_handler(int fd, void *p)
+/* queued datagrams are prefixed with their length, so that boundaries are kept */
+#define MY_UDP_DGRAM_HDR_SIZE 2
+#define MY_UDP_DGRAM_MAX 65535
+
+/* one datagram per call, as large as the buffer it is read to */
+#define MY_UDP_BATCH 1
+#define MY_UDP_BATCH_MAX 64
+
+/* raw bytes, or rtp packets (RFC 3550) */
+#define MY_UDP_FRAMING_RAW 0
+#define MY_UDP_FRAMING_RTP 1
+
+#define MY_UDP_RTP_HDR_SIZE 12
+/* payloads of a typical mtu, each packet being held in a buffer of its own */
+#define MY_UDP_RTP_DGRAM_SIZE 2048
+#define MY_UDP_RTP_VERSION 2
+#define MY_UDP_RTP_PAYLOAD_TYPE 96
+/* for streams of unknown sample rate, as for mpeg audio (RFC 2250) */
+#define MY_UDP_RTP_CLOCK_RATE 90000
+#define MY_UDP_FEC_PAYLOAD_TYPE 127
+
+/* equal size datagrams sent at once with UDP_SEGMENT, as the kernel allows */
+#ifdef UDP_SEGMENT
+#define MY_UDP_GSO_SEGMENTS 64
+#else
+#define MY_UDP_GSO_SEGMENTS 1
+#endif
+#define MY_UDP_GSO_MAX 65000
+#define MY_UDP_CMSG_SIZE CMSG_SPACE(sizeof(uint16_t))
+
+/* drop 'n' leading bytes from a two entries iovec */
+static void my_io_udp_iov_skip(struct iovec *iov, int n)
+{
+	if (n >= iov[0].iov_len) {
+		n -= iov[0].iov_len;
+		iov[0].iov_base = (char *)iov[1].iov_base + n;
+		iov[0].iov_len = iov[1].iov_len - n;
+		iov[1].iov_len = 0;
+	} else {
+		iov[0].iov_base = (char *)iov[0].iov_base + n;
+		iov[0].iov_len -= n;
+	}
+}
+
+#ifdef HAVE_SENDMMSG
+/* describes 'len' bytes at 'off' in a two iovecs region, returns the iovecs used */
+static int my_io_udp_region_slice(struct iovec *region, int off, int len, struct iovec *iov)
+{
+	int n;
+
+	if (off >= region[0].iov_len) {
+		iov[0].iov_base = (char *)region[1].iov_base + (off - region[0].iov_len);
+		iov[0].iov_len = len;
+		return 1;
+	}
+
+	n = region[0].iov_len - off;
+	iov[0].iov_base = (char *)region[0].iov_base + off;
+	if (len <= n) {
+		iov[0].iov_len = len;
+		return 1;
+	}
+
+	iov[0].iov_len = n;
+	iov[1].iov_base = region[1].iov_base;
+	iov[1].iov_len = len - n;
+	return 2;
+}
+
+static int my_io_udp_region_byte(struct iovec *region, int off)
+{
+	if (off >= region[0].iov_len) {
+		return ((unsigned char *)region[1].iov_base)[off - region[0].iov_len];
+	}
+
+	return ((unsigned char *)region[0].iov_base)[off];
+}
+
+/*
+ * Sends queued datagrams 'batch' messages per sendmmsg() call. With GSO,
+ * a message carries a run of equal size datagrams (the last one may be
+ * shorter), split back by the kernel, or by the NIC, at 'gso_size' bytes.
+ */
+static int my_io_udp_queue_flush_batch(my_port_t *port)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_rbuf_t *queue = MY_DPORT(port)->queue;
+	struct iovec region[2];
+	struct iovec *iov = udp->out_iovs;
+	struct msghdr *msg;
+	struct cmsghdr *cmsg;
+	int avail, off, len, seg_size, seg_count, total;
+	int count = 0;
+	int m, n;
+
+	while ((avail = my_rbuf_peek_read(queue, region, my_rbuf_get_avail(queue))) > 0) {
+		off = 0;
+		iov = udp->out_iovs;
+
+		for (m = 0; (m < udp->batch) && (off < avail); m++) {
+			msg = &udp->out_msgs[m].msg_hdr;
+			msg->msg_name = udp->sa_group;
+			msg->msg_namelen = udp->sa_len;
+			msg->msg_iov = iov;
+			msg->msg_iovlen = 0;
+			msg->msg_control = NULL;
+			msg->msg_controllen = 0;
+			msg->msg_flags = 0;
+
+			seg_size = seg_count = total = 0;
+			while (off < avail) {
+				len = (my_io_udp_region_byte(region, off) << 8) | my_io_udp_region_byte(region, off + 1);
+				if (seg_count > 0) {
+					if (!udp->gso || (seg_count == MY_UDP_GSO_SEGMENTS) || (len > seg_size) || (total + len > MY_UDP_GSO_MAX)) {
+						break;
+					}
+				} else {
+					seg_size = len;
+				}
+
+				msg->msg_iovlen += my_io_udp_region_slice(region, off + MY_UDP_DGRAM_HDR_SIZE, len, iov + msg->msg_iovlen);
+				off += MY_UDP_DGRAM_HDR_SIZE + len;
+				total += len;
+				seg_count++;
+
+				/* a shorter one ends the run */
+				if (len < seg_size) {
+					break;
+				}
+			}
+			iov += msg->msg_iovlen;
+			udp->out_ends[m] = off;
+
+#ifdef UDP_SEGMENT
+			if (seg_count > 1) {
+				msg->msg_control = udp->out_cmsgs + m * MY_UDP_CMSG_SIZE;
+				msg->msg_controllen = MY_UDP_CMSG_SIZE;
+				cmsg = CMSG_FIRSTHDR(msg);
+				cmsg->cmsg_level = IPPROTO_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				*(uint16_t *)CMSG_DATA(cmsg) = seg_size;
+			}
+#endif
+		}
+
+		n = sendmmsg(udp->fd, udp->out_msgs, m, 0);
+		if (n < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
+				break;
+			}
+
+			if (udp->gso && udp->out_msgs[0].msg_hdr.msg_controllen && ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT) || (errno == EOPNOTSUPP))) {
+				my_log(MY_LOG_WARNING, "core/%s: segmentation offload not available, disabling it (%s)", port->conf->name, strerror(errno));
+				udp->gso = 0;
+				continue;
+			}
+
+			/* drop it, later datagrams may still get through */
+			my_log(MY_LOG_ERROR, "core/%s: error sending to socket (%d: %s)", port->conf->name, errno, strerror(errno));
+			n = 1;
+		}
+
+		my_rbuf_consume(queue, udp->out_ends[n - 1]);
+		count += n;
+
+		/* the socket is full */
+		if (n < m) {
+			break;
+		}
+	}
+
+	return count;
+}
+#endif
+
+static int my_io_udp_queue_flush(my_port_t *port)
 {
-	my_udp_priv_t *source = MY_UDP(p);
+	my_rbuf_t *queue = MY_DPORT(port)->queue;
+	unsigned char hdr[MY_UDP_DGRAM_HDR_SIZE];
+	struct iovec iov[2];
+	struct msghdr msg;
+	int len, n;
+	int count = 0;
+
+#ifdef HAVE_SENDMMSG
+	if (MY_UDP(port)->batch > 1) {
+		count = my_io_udp_queue_flush_batch(port);
+		goto out;
+	}
+#endif
+
+	my_mem_zero(&msg, sizeof(msg));
+	msg.msg_name = MY_UDP(port)->sa_group;
+	msg.msg_namelen = MY_UDP(port)->sa_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (my_rbuf_peek(queue, (char *)hdr, MY_UDP_DGRAM_HDR_SIZE) == MY_UDP_DGRAM_HDR_SIZE) {
+		len = (hdr[0] << 8) | hdr[1];
+
+		/* send the payload straight from the queue memory, skipping the header */
+		my_rbuf_peek_read(queue, iov, MY_UDP_DGRAM_HDR_SIZE + len);
+		my_io_udp_iov_skip(iov, MY_UDP_DGRAM_HDR_SIZE);
+
+		n = sendmsg(MY_UDP(port)->fd, &msg, 0);
+		if (n < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
+				break;
+			}
+
+			/* drop it, later datagrams may still get through */
+			my_log(MY_LOG_ERROR, "core/%s: error sending to socket (%d: %s)", port->conf->name, errno, strerror(errno));
+		}
+
+		my_rbuf_consume(queue, MY_UDP_DGRAM_HDR_SIZE + len);
+		count++;
+	}
+
+#ifdef HAVE_SENDMMSG
+out:
+#endif
+	/* wait for the socket to drain what is left */
+	my_loop_event_handler_mod(port->loop, MY_UDP(port)->fd, my_rbuf_get_avail(queue) ? MY_EVENT_WRITE : 0);
+
+	my_port_queue_update(port);
+
+	return count;
+}
+
+static int my_target_udp_flush_handler(void *p)
+{
+	my_port_t *port = MY_PORT(p);
+
+	if (my_rbuf_get_avail(MY_DPORT(port)->queue) > 0) {
+		my_io_udp_queue_flush(port);
+	}
 
-	/* do something */
 	return 0;
 }
 
-static int my_target_udp_event_handler(int fd, void *p)
+static int my_source_udp_pause(my_port_t *port, int paused)
+{
+	if (MY_DPORT(port)->aio_op) {
+		return my_port_aio_pause(port, paused);
+	}
+
+	/* not watched when scheduled, the scheduler skips it instead */
+	if (my_graph_is_scheduled(port)) {
+		return 0;
+	}
+
+	return my_loop_event_handler_mod(port->loop, MY_UDP(port)->fd, paused ? 0 : MY_EVENT_READ);
+}
+
+static int my_target_udp_event_handler(int fd, int events, void *p)
 {
-	my_udp_priv_t *source = MY_UDP(p);
+	my_port_t *port = MY_PORT(p);
+
+	if (events & MY_EVENT_WRITE) {
+		my_io_udp_queue_flush(port);
+	}
 
-	/* do something */
 	return 0;
 }
 
@@ -92,14 +405,23 @@ static my_port_t *my_io_udp_create(my_core_t *core, my_port_conf_t *conf)
 	}
 	MY_UDP(port)->ip_addr = prop;
 
-	prop = my_prop_lookup(conf->properties, "port");
-	if (!prop) {
-		my_log(MY_LOG_ERROR, "core/%s: missing 'port' property", port->conf->name);
+	MY_UDP(port)->ip_port = my_prop_lookup_int(conf->properties, "port", -1);
+	if (MY_UDP(port)->ip_port < 0) {
+		my_log(MY_LOG_ERROR, "core/%s: missing or malformed 'port' property", conf->name);
 		goto _MY_ERR_conf;
 	}
-	MY_UDP(port)->ip_port = atoi(prop);
 	MY_UDP(port)->sa_len = sizeof(struct sockaddr_in);
 
+	prop = my_prop_lookup(conf->properties, "framing");
+	if (!prop || !strcmp(prop, "raw")) {
+		MY_UDP(port)->framing = MY_UDP_FRAMING_RAW;
+	} else if (!strcmp(prop, "rtp")) {
+		MY_UDP(port)->framing = MY_UDP_FRAMING_RTP;
+	} else {
+		my_log(MY_LOG_ERROR, "core/%s: unknown 'framing' property '%s'", conf->name, prop);
+		goto _MY_ERR_conf;
+	}
+
 	MY_UDP(port)->sa_local = my_mem_alloc(MY_UDP(port)->sa_len);
 	if (!MY_UDP(port)->sa_local) {
 		goto _MY_ERR_alloc_sa_local;
@@ -139,8 +461,299 @@ static void my_io_udp_destroy(my_port_t *port)
 	my_port_destroy_priv(port);
 }
 
+/* packets per parity packet, 0 without error correction */
+static int my_io_udp_fec_conf(my_port_t *port, my_port_conf_t *conf)
+{
+	int k;
+
+	k = my_prop_lookup_int(conf->properties, "fec", 0);
+	if ((k < 0) || (k > MY_FEC_K_MAX)) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'fec' property (0 - %d)", conf->name, MY_FEC_K_MAX);
+		return -1;
+	}
+	if (k && (MY_UDP(port)->framing != MY_UDP_FRAMING_RTP)) {
+		my_log(MY_LOG_ERROR, "core/%s: error correction requires rtp framing", conf->name);
+		return -1;
+	}
+
+	MY_UDP(port)->fec_payload_type = my_prop_lookup_int(conf->properties, "fec-payload-type", MY_UDP_FEC_PAYLOAD_TYPE);
+	if ((MY_UDP(port)->fec_payload_type < 0) || (MY_UDP(port)->fec_payload_type > 127)) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'fec-payload-type' property", conf->name);
+		return -1;
+	}
+
+	return k;
+}
+
+static my_port_t *my_source_udp_create(my_core_t *core, my_port_conf_t *conf)
+{
+	my_port_t *port;
+	int size;
+	int k;
+#ifdef HAVE_RECVMMSG
+	int i;
+#endif
+
+	port = my_io_udp_create(core, conf);
+	if (!port) {
+		goto _MY_ERR_create;
+	}
+
+	MY_UDP(port)->batch = my_prop_lookup_int(conf->properties, "batch", MY_UDP_BATCH);
+	if (MY_UDP(port)->batch < 1) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'batch' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+	if (MY_UDP(port)->batch > MY_UDP_BATCH_MAX) {
+		my_log(MY_LOG_WARNING, "core/%s: 'batch' property limited to %d", conf->name, MY_UDP_BATCH_MAX);
+		MY_UDP(port)->batch = MY_UDP_BATCH_MAX;
+	}
+#ifndef HAVE_RECVMMSG
+	if (MY_UDP(port)->batch > 1) {
+		my_log(MY_LOG_WARNING, "core/%s: batched receive not supported, receiving one datagram at a time", conf->name);
+		MY_UDP(port)->batch = 1;
+	}
+#endif
+	if (MY_UDP(port)->framing == MY_UDP_FRAMING_RTP) {
+		size = MY_UDP_RTP_DGRAM_SIZE;
+	} else {
+		size = MY_LOOP_BUF_SIZE / MY_UDP(port)->batch;
+	}
+	MY_UDP(port)->dgram_size = my_prop_lookup_int(conf->properties, "datagram-size", size);
+	if (MY_UDP(port)->dgram_size < 1) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'datagram-size' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+
+	MY_UDP(port)->slots = my_mem_alloc(MY_UDP(port)->batch * sizeof(char *));
+	if (!MY_UDP(port)->slots) {
+		goto _MY_ERR_alloc_slots;
+	}
+
+	MY_UDP(port)->lens = my_mem_alloc(MY_UDP(port)->batch * sizeof(int));
+	if (!MY_UDP(port)->lens) {
+		goto _MY_ERR_alloc_lens;
+	}
+
+	/* rtp headers are read apart, the payload landing where it is wanted */
+	MY_UDP(port)->iovs = my_mem_alloc(MY_UDP(port)->batch * 2 * sizeof(struct iovec));
+	if (!MY_UDP(port)->iovs) {
+		goto _MY_ERR_alloc_iovs;
+	}
+
+	if (MY_UDP(port)->framing == MY_UDP_FRAMING_RTP) {
+		MY_UDP(port)->rtp_hdrs = my_mem_alloc(MY_UDP(port)->batch * MY_UDP_RTP_HDR_SIZE);
+		if (!MY_UDP(port)->rtp_hdrs) {
+			goto _MY_ERR_alloc_rtp_hdrs;
+		}
+
+		MY_UDP(port)->rtp_bufs = my_mem_alloc(MY_UDP(port)->batch * sizeof(my_buf_t *));
+		if (!MY_UDP(port)->rtp_bufs) {
+			goto _MY_ERR_alloc_rtp_bufs;
+		}
+
+		/* rather than buffers of the loop, sized for decoded audio */
+		MY_UDP(port)->rtp_pool = my_buf_pool_create(MY_UDP(port)->dgram_size, MY_UDP(port)->batch);
+		if (!MY_UDP(port)->rtp_pool) {
+			my_log(MY_LOG_ERROR, "core/%s: error creating buffer pool (%s)", conf->name, strerror(errno));
+			goto _MY_ERR_create_rtp_pool;
+		}
+	}
+
+#ifdef HAVE_RECVMMSG
+	if (MY_UDP(port)->batch > 1) {
+		MY_UDP(port)->msgs = my_mem_alloc(MY_UDP(port)->batch * sizeof(struct mmsghdr));
+		if (!MY_UDP(port)->msgs) {
+			goto _MY_ERR_alloc_msgs;
+		}
+
+		for (i = 0; i < MY_UDP(port)->batch; i++) {
+			MY_UDP(port)->msgs[i].msg_hdr.msg_iov = &MY_UDP(port)->iovs[2 * i];
+		}
+	}
+#endif
+
+	k = my_io_udp_fec_conf(port, conf);
+	if (k < 0) {
+		goto _MY_ERR_fec_conf;
+	}
+	if (k > 0) {
+		/* a group, & the parity packet of the previous one coming late */
+		MY_UDP(port)->fec_window = 2 * k;
+		MY_UDP(port)->fec_dec = my_fec_dec_create(MY_UDP(port)->fec_window);
+		if (!MY_UDP(port)->fec_dec) {
+			goto _MY_ERR_fec_dec_create;
+		}
+	}
+
+	if (my_port_decoder_create(port, conf) != 0) {
+		goto _MY_ERR_decoder_create;
+	}
+
+	return port;
+
+_MY_ERR_decoder_create:
+	if (MY_UDP(port)->fec_dec) {
+		my_fec_dec_destroy(MY_UDP(port)->fec_dec);
+	}
+_MY_ERR_fec_dec_create:
+_MY_ERR_fec_conf:
+#ifdef HAVE_RECVMMSG
+	my_mem_free(MY_UDP(port)->msgs);
+_MY_ERR_alloc_msgs:
+#endif
+	if (MY_UDP(port)->rtp_pool) {
+		my_buf_pool_destroy(MY_UDP(port)->rtp_pool);
+	}
+_MY_ERR_create_rtp_pool:
+	my_mem_free(MY_UDP(port)->rtp_bufs);
+_MY_ERR_alloc_rtp_bufs:
+	my_mem_free(MY_UDP(port)->rtp_hdrs);
+_MY_ERR_alloc_rtp_hdrs:
+	my_mem_free(MY_UDP(port)->iovs);
+_MY_ERR_alloc_iovs:
+	my_mem_free(MY_UDP(port)->lens);
+_MY_ERR_alloc_lens:
+	my_mem_free(MY_UDP(port)->slots);
+_MY_ERR_alloc_slots:
+_MY_ERR_conf:
+	my_io_udp_destroy(port);
+_MY_ERR_create:
+	return NULL;
+}
+
+static void my_source_udp_destroy(my_port_t *port)
+{
+	my_port_decoder_destroy(port);
+	if (MY_UDP(port)->fec_dec) {
+		my_fec_dec_destroy(MY_UDP(port)->fec_dec);
+	}
+#ifdef HAVE_RECVMMSG
+	my_mem_free(MY_UDP(port)->msgs);
+#endif
+	/* once the last of its buffers held downstream is given back */
+	if (MY_UDP(port)->rtp_pool) {
+		my_buf_pool_destroy(MY_UDP(port)->rtp_pool);
+	}
+	my_mem_free(MY_UDP(port)->rtp_bufs);
+	my_mem_free(MY_UDP(port)->rtp_hdrs);
+	my_mem_free(MY_UDP(port)->iovs);
+	my_mem_free(MY_UDP(port)->lens);
+	my_mem_free(MY_UDP(port)->slots);
+	my_io_udp_destroy(port);
+}
+
+static my_port_t *my_target_udp_create(my_core_t *core, my_port_conf_t *conf)
+{
+	my_port_t *port;
+	int k;
+
+	port = my_io_udp_create(core, conf);
+	if (!port) {
+		goto _MY_ERR_create;
+	}
+
+	MY_UDP(port)->batch = my_prop_lookup_int(conf->properties, "batch", MY_UDP_BATCH);
+	if (MY_UDP(port)->batch < 1) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'batch' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+	if (MY_UDP(port)->batch > MY_UDP_BATCH_MAX) {
+		my_log(MY_LOG_WARNING, "core/%s: 'batch' property limited to %d", conf->name, MY_UDP_BATCH_MAX);
+		MY_UDP(port)->batch = MY_UDP_BATCH_MAX;
+	}
+	MY_UDP(port)->flush_interval = my_prop_lookup_duration(conf->properties, "flush-interval", 0);
+	MY_UDP(port)->gso = my_prop_lookup_bool(conf->properties, "gso", 1) && (MY_UDP_GSO_SEGMENTS > 1);
+	MY_UDP(port)->payload_type = my_prop_lookup_int(conf->properties, "payload-type", MY_UDP_RTP_PAYLOAD_TYPE);
+	if ((MY_UDP(port)->payload_type < 0) || (MY_UDP(port)->payload_type > 127)) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'payload-type' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+	MY_UDP(port)->clock_rate = my_prop_lookup_int(conf->properties, "clock-rate", 0);
+	if (MY_UDP(port)->clock_rate < 0) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid 'clock-rate' property", conf->name);
+		goto _MY_ERR_conf;
+	}
+	k = my_io_udp_fec_conf(port, conf);
+	if (k < 0) {
+		goto _MY_ERR_conf;
+	}
+	if (k > 0) {
+		MY_UDP(port)->fec_enc = my_fec_enc_create(k, MY_UDP_DGRAM_MAX - MY_UDP_RTP_HDR_SIZE - MY_FEC_HDR_SIZE);
+		if (!MY_UDP(port)->fec_enc) {
+			goto _MY_ERR_fec_enc_create;
+		}
+	}
+#ifdef HAVE_SENDMMSG
+	if (MY_UDP(port)->batch > 1) {
+		MY_UDP(port)->out_msgs = my_mem_alloc(MY_UDP(port)->batch * sizeof(struct mmsghdr));
+		if (!MY_UDP(port)->out_msgs) {
+			goto _MY_ERR_alloc_out_msgs;
+		}
+
+		/* a queued datagram may wrap around, taking two iovecs */
+		MY_UDP(port)->out_iovs = my_mem_alloc(MY_UDP(port)->batch * MY_UDP_GSO_SEGMENTS * 2 * sizeof(struct iovec));
+		if (!MY_UDP(port)->out_iovs) {
+			goto _MY_ERR_alloc_out_iovs;
+		}
+
+		MY_UDP(port)->out_cmsgs = my_mem_alloc(MY_UDP(port)->batch * MY_UDP_CMSG_SIZE);
+		if (!MY_UDP(port)->out_cmsgs) {
+			goto _MY_ERR_alloc_out_cmsgs;
+		}
+
+		MY_UDP(port)->out_ends = my_mem_alloc(MY_UDP(port)->batch * sizeof(int));
+		if (!MY_UDP(port)->out_ends) {
+			goto _MY_ERR_alloc_out_ends;
+		}
+	}
+#else
+	if (MY_UDP(port)->batch > 1) {
+		my_log(MY_LOG_WARNING, "core/%s: batched send not supported, sending one datagram at a time", conf->name);
+		MY_UDP(port)->batch = 1;
+	}
+#endif
+
+	return port;
+
+#ifdef HAVE_SENDMMSG
+	my_mem_free(MY_UDP(port)->out_ends);
+_MY_ERR_alloc_out_ends:
+	my_mem_free(MY_UDP(port)->out_cmsgs);
+_MY_ERR_alloc_out_cmsgs:
+	my_mem_free(MY_UDP(port)->out_iovs);
+_MY_ERR_alloc_out_iovs:
+	my_mem_free(MY_UDP(port)->out_msgs);
+_MY_ERR_alloc_out_msgs:
+#endif
+	if (MY_UDP(port)->fec_enc) {
+		my_fec_enc_destroy(MY_UDP(port)->fec_enc);
+	}
+_MY_ERR_fec_enc_create:
+_MY_ERR_conf:
+	my_io_udp_destroy(port);
+_MY_ERR_create:
+	return NULL;
+}
+
+static void my_target_udp_destroy(my_port_t *port)
+{
+#ifdef HAVE_SENDMMSG
+	my_mem_free(MY_UDP(port)->out_ends);
+	my_mem_free(MY_UDP(port)->out_cmsgs);
+	my_mem_free(MY_UDP(port)->out_iovs);
+	my_mem_free(MY_UDP(port)->out_msgs);
+#endif
+	if (MY_UDP(port)->fec_enc) {
+		my_fec_enc_destroy(MY_UDP(port)->fec_enc);
+	}
+	my_io_udp_destroy(port);
+}
+
 static int my_io_udp_open(my_port_t *port)
 {
+	int events;
+	int aio;
 	int rc;
 
 	MY_DEBUG("core/%s: opening socket", port->conf->name);
@@ -192,9 +805,29 @@ static int my_io_udp_open(my_port_t *port)
 		goto _MY_ERR_mcast_join;
 	}
 
-	my_core_event_handler_add(port->core, MY_UDP(port)->fd, MY_PORT_GET_IMPL(port)->handler, port);
+	/* targets only watch for write readiness while their output queue isn't empty */
+	if (MY_PORT_GET_IMPL(port)->put) {
+		if (my_port_queue_create(port) != 0) {
+			goto _MY_ERR_queue_create;
+		}
+		events = 0;
+	} else if (my_graph_is_scheduled(port)) {
+		/* read when pulled */
+		events = 0;
+	} else {
+		/* raw datagrams are received by the loop itself, where it can */
+		aio = (MY_UDP(port)->framing == MY_UDP_FRAMING_RAW) ? my_port_aio_open(port, MY_UDP(port)->fd, MY_POLLER_IO_RECV) : 0;
+		if (aio < 0) {
+			goto _MY_ERR_aio_open;
+		}
+		events = aio ? 0 : MY_EVENT_READ;
+	}
+
+	my_loop_event_handler_add(port->loop, MY_UDP(port)->fd, events, MY_PORT_GET_IMPL(port)->handler, port);
 	return 0;
 
+_MY_ERR_aio_open:
+_MY_ERR_queue_create:
 _MY_ERR_mcast_join:
 _MY_ERR_set_reuseaddr:
 _MY_ERR_set_nonblock:
@@ -209,7 +842,9 @@ static int my_io_udp_close(my_port_t *port)
 {
 	int rc;
 
-	my_core_event_handler_del(port->core, MY_UDP(port)->fd);
+	my_port_aio_close(port);
+	my_loop_event_handler_del(port->loop, MY_UDP(port)->fd);
+	my_port_queue_destroy(port);
 
 	MY_DEBUG("core/%s: leaving mcast group", port->conf->name);
 	rc = my_net_mcast_leave(MY_UDP(port)->fd, MY_UDP(port)->sa_local, MY_UDP(port)->sa_group);
@@ -232,64 +867,703 @@ _MY_ERR_mcast_leave:
 	return rc;
 }
 
-static int my_io_udp_get(my_port_t *port, void *buf, int len)
+static int my_target_udp_open(my_port_t *port)
 {
-	int n;
+	my_udp_priv_t *udp = MY_UDP(port);
+	unsigned int seed;
+
+	if (my_io_udp_open(port) != 0) {
+		goto _MY_ERR_open;
+	}
+
+	/* a new stream, numbered from random values as RFC 3550 suggests */
+	if (udp->framing == MY_UDP_FRAMING_RTP) {
+		seed = my_core_get_time(port->core) ^ getpid() ^ udp->fd;
+		udp->ssrc = rand_r(&seed);
+		udp->seq = rand_r(&seed);
+		udp->media_time = rand_r(&seed);
+		udp->fec_seq = rand_r(&seed);
+		udp->media_rate = 0;
+		udp->marker = 1;
+	}
+
+	if (udp->batch > 1) {
+		/* paced, or flushed once at the end of every loop round */
+		if (udp->flush_interval) {
+			udp->flush_alarm = my_loop_alarm_add(port->loop, udp->flush_interval, 1,
+								      my_target_udp_flush_handler, port);
+			if (!udp->flush_alarm) {
+				goto _MY_ERR_alarm_add;
+			}
+		} else {
+			my_loop_deferred_init(&udp->flush, my_target_udp_flush_handler, port);
+		}
+	}
+
+	return 0;
+
+_MY_ERR_alarm_add:
+	my_io_udp_close(port);
+_MY_ERR_open:
+	return -1;
+}
+
+static int my_target_udp_close(my_port_t *port)
+{
+	if (MY_UDP(port)->batch > 1) {
+		if (MY_UDP(port)->flush_alarm) {
+			my_loop_alarm_del(port->loop, MY_UDP(port)->flush_alarm);
+			MY_UDP(port)->flush_alarm = NULL;
+		} else {
+			my_loop_defer_cancel(&MY_UDP(port)->flush);
+		}
+	}
+
+	return my_io_udp_close(port);
+}
+
+/*
+ * Checks an rtp header, and moves the payload that follows it to the start
+ * of 'data', past any contributing sources & extension, and without padding.
+ * Returns the length of the payload, or -1 if it isn't a valid packet.
+ */
+static int my_io_udp_rtp_parse(my_port_t *port, unsigned char *hdr, char *data, int len)
+{
+	unsigned char *p = (unsigned char *)data;
+	int skip, pad;
+
+	if ((len < 0) || ((hdr[0] >> 6) != MY_UDP_RTP_VERSION)) {
+		goto _MY_ERR_malformed;
+	}
+
+	skip = (hdr[0] & 0x0f) * 4;
+	if (hdr[0] & 0x10) {
+		if (len < skip + 4) {
+			goto _MY_ERR_malformed;
+		}
+		skip += 4 + ((p[skip + 2] << 8) | p[skip + 3]) * 4;
+	}
+
+	if (hdr[0] & 0x20) {
+		pad = (len > 0) ? p[len - 1] : 0;
+		if ((pad == 0) || (pad > len)) {
+			goto _MY_ERR_malformed;
+		}
+		len -= pad;
+	}
+
+	if (skip > len) {
+		goto _MY_ERR_malformed;
+	}
+
+	if (skip > 0) {
+		memmove(data, data + skip, len - skip);
+	}
+
+	return len - skip;
+
+_MY_ERR_malformed:
+	my_log(MY_LOG_WARNING, "core/%s: malformed rtp packet, dropped", port->conf->name);
+	return -1;
+}
+
+/*
+ * Receives up to 'count' datagrams, the i-th one landing in 'slots[i]', of
+ * 'size' bytes, with its rtp header, if any, read apart & checked. Returns
+ * the number of datagrams received, the length of what each of them carries
+ * being left in 'lens', or -1 for those which were dropped.
+ */
+static int my_io_udp_recv(my_port_t *port, int size, int count)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	struct iovec *iov = udp->iovs;
+	struct msghdr msg;
+	int hdr_size = (udp->framing == MY_UDP_FRAMING_RTP) ? MY_UDP_RTP_HDR_SIZE : 0;
+	int iovlen = hdr_size ? 2 : 1;
+	int flags, len;
+	int i, n;
+
+	for (i = 0; i < count; i++) {
+		if (hdr_size) {
+			iov->iov_base = udp->rtp_hdrs + i * hdr_size;
+			iov->iov_len = hdr_size;
+			iov++;
+		}
+		iov->iov_base = udp->slots[i];
+		iov->iov_len = size;
+		iov++;
+	}
+
+#ifdef HAVE_RECVMMSG
+	if (count > 1) {
+		for (i = 0; i < count; i++) {
+			udp->msgs[i].msg_hdr.msg_iov = &udp->iovs[i * iovlen];
+			udp->msgs[i].msg_hdr.msg_iovlen = iovlen;
+		}
+
+		n = recvmmsg(udp->fd, udp->msgs, count, MSG_DONTWAIT, NULL);
+	} else
+#endif
+	{
+		my_mem_zero(&msg, sizeof(msg));
+		msg.msg_iov = udp->iovs;
+		msg.msg_iovlen = iovlen;
+
+		n = recvmsg(udp->fd, &msg, MSG_DONTWAIT);
+		if (n >= 0) {
+			udp->lens[0] = n;
+			n = 1;
+		}
+	}
 
-	n = read(MY_UDP(port)->fd, buf, len);
 	if (n < 0) {
 		if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
-			n = 0;
-			goto out;
+			return 0;
 		}
 
 		my_log(MY_LOG_ERROR, "core/%s: error reading from socket (%d: %s)", port->conf->name, errno, strerror(errno));
 		return n;
 	}
 
+	for (i = 0; i < n; i++) {
+#ifdef HAVE_RECVMMSG
+		if (count > 1) {
+			flags = udp->msgs[i].msg_hdr.msg_flags;
+			len = udp->msgs[i].msg_len;
+		} else
+#endif
+		{
+			flags = msg.msg_flags;
+			len = udp->lens[0];
+		}
+
+		if (flags & MSG_TRUNC) {
+			my_log(MY_LOG_WARNING, "core/%s: datagram larger than %d bytes, truncated", port->conf->name, hdr_size + size);
+		}
+
+		if (hdr_size) {
+			len = my_io_udp_rtp_parse(port, udp->rtp_hdrs + i * hdr_size, udp->slots[i], len - hdr_size);
+			/* parity packets are of no use without error correction */
+			if (!udp->fec_dec && ((udp->rtp_hdrs[i * hdr_size + 1] & 0x7f) == udp->fec_payload_type)) {
+				len = -1;
+			}
+		}
+		udp->lens[i] = len;
+	}
+
+	return n;
+}
+
+static void my_source_udp_pending_add(my_port_t *port, my_buf_t *buf)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+
+	if (udp->pending_tail) {
+		udp->pending_tail->next = buf;
+	} else {
+		udp->pending = buf;
+	}
+	udp->pending_tail = buf;
+	udp->pending_count++;
+}
+
+/* in sequence, usually last, dropping duplicates */
+static void my_source_udp_pending_insert(my_port_t *port, my_buf_t *buf)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_buf_t **prev;
+	int16_t delta;
+
+	if (!udp->pending_tail || ((int16_t)(buf->seq - udp->pending_tail->seq) > 0)) {
+		my_source_udp_pending_add(port, buf);
+		return;
+	}
+
+	for (prev = &udp->pending; *prev; prev = &(*prev)->next) {
+		delta = buf->seq - (*prev)->seq;
+		if (delta == 0) {
+			my_buf_unref(buf);
+			return;
+		}
+		if (delta < 0) {
+			break;
+		}
+	}
+
+	buf->next = *prev;
+	*prev = buf;
+	udp->pending_count++;
+}
+
+static my_buf_t *my_source_udp_pending_get(my_port_t *port)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_buf_t *buf = udp->pending;
+
+	if (buf) {
+		udp->pending = buf->next;
+		if (!udp->pending) {
+			udp->pending_tail = NULL;
+		}
+		buf->next = NULL;
+		udp->pending_count--;
+	}
+
+	return buf;
+}
+
+/* whether the first pending packet may go to the codec */
+static int my_source_udp_pending_ready(my_port_t *port)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_buf_t *buf = udp->pending;
+
+	if (!buf || !udp->fec_dec || !MY_DPORT(port)->codec || !udp->fec_started) {
+		return buf != NULL;
+	}
+
+	/* next in sequence, or late & to be dropped */
+	if ((int16_t)(buf->seq - udp->fec_next) <= 0) {
+		return 1;
+	}
+
+	/* the missing one is past recovery */
+	return ((int16_t)(udp->fec_done - udp->fec_next) > 0) || (udp->pending_count > udp->fec_window);
+}
+
+static int my_source_udp_event_handler(int fd, int events, void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	my_buf_t *buf;
+
+	/* rtp packets received together are pushed one by one */
+	do {
+		buf = my_port_pull_buf(port, MY_PORT_PULL_ANY);
+		if (!buf) {
+			break;
+		}
+
+		my_port_push_buf_peers(port, buf);
+		my_buf_unref(buf);
+	} while (my_source_udp_pending_ready(port));
+
+	return 0;
+}
+
+/* receives up to 'batch' rtp packets, each one into a buffer of its own */
+static void my_source_udp_rtp_fill(my_port_t *port)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_buf_pool_t *pool = udp->rtp_pool;
+	my_buf_t **bufs = udp->rtp_bufs;
+	my_buf_t *buf;
+	unsigned char *hdr, *parity;
+	uint16_t end;
+	uint64_t now;
+	int i, n;
+
+	for (i = 0; i < udp->batch; i++) {
+		bufs[i] = my_buf_alloc(pool);
+		if (!bufs[i]) {
+			my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+			break;
+		}
+		udp->slots[i] = bufs[i]->data;
+	}
+
+	n = (i > 0) ? my_io_udp_recv(port, udp->dgram_size, i) : 0;
+	now = my_core_get_time(port->core);
+
+	while (i-- > n) {
+		my_buf_unref(bufs[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (udp->lens[i] < 0) {
+			my_buf_unref(bufs[i]);
+			continue;
+		}
+
+		hdr = udp->rtp_hdrs + i * MY_UDP_RTP_HDR_SIZE;
+		bufs[i]->len = udp->lens[i];
+
+		if (udp->fec_dec && ((hdr[1] & 0x7f) == udp->fec_payload_type)) {
+			buf = my_fec_dec_recover(udp->fec_dec, bufs[i]->data, bufs[i]->len, pool);
+			if (buf) {
+				MY_DEBUG("core/%s: recovered packet %u", port->conf->name, buf->seq);
+				buf->timestamp = now;
+				my_source_udp_pending_insert(port, buf);
+			}
+			/* whatever is still missing up to the end of its group is lost */
+			if (udp->fec_started && (bufs[i]->len >= MY_FEC_HDR_SIZE)) {
+				parity = (unsigned char *)bufs[i]->data;
+				end = ((parity[0] << 8) | parity[1]) + parity[2];
+				if ((int16_t)(end - udp->fec_done) > 0) {
+					udp->fec_done = end;
+				}
+			}
+			my_buf_unref(bufs[i]);
+			continue;
+		}
+
+		bufs[i]->timestamp = now;
+		bufs[i]->flags |= MY_BUF_SEQUENCED;
+		bufs[i]->seq = (hdr[2] << 8) | hdr[3];
+		bufs[i]->media_time = ((uint32_t)hdr[4] << 24) | (hdr[5] << 16) | (hdr[6] << 8) | hdr[7];
+
+		if (udp->fec_dec) {
+			my_fec_dec_add(udp->fec_dec, bufs[i]);
+			my_source_udp_pending_insert(port, bufs[i]);
+		} else {
+			my_source_udp_pending_add(port, bufs[i]);
+		}
+	}
+}
+
+/*
+ * Packs the payloads of as many received rtp packets as fit in 'buf', in
+ * sequence, so that the codec never sees a recovered one out of place.
+ */
+static int my_source_udp_rtp_get(my_port_t *port, void *buf, int len)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	my_buf_t *pkt;
+	int total = 0;
+
+	if (!my_source_udp_pending_ready(port)) {
+		my_source_udp_rtp_fill(port);
+	}
+
+	while (my_source_udp_pending_ready(port)) {
+		pkt = udp->pending;
+		if (!udp->fec_started) {
+			udp->fec_next = pkt->seq;
+			udp->fec_done = pkt->seq;
+			udp->fec_started = 1;
+		}
+
+		if ((int16_t)(pkt->seq - udp->fec_next) < 0) {
+			MY_DEBUG("core/%s: dropping late packet %u", port->conf->name, pkt->seq);
+			my_buf_unref(my_source_udp_pending_get(port));
+			continue;
+		}
+
+		if (total + pkt->len > len) {
+			if (total > 0) {
+				break;
+			}
+			my_log(MY_LOG_WARNING, "core/%s: %d bytes packet larger than %d bytes, dropped", port->conf->name, pkt->len, len);
+		} else {
+			my_mem_copy((char *)buf + total, pkt->data, pkt->len);
+			total += pkt->len;
+		}
+		udp->fec_next = pkt->seq + 1;
+		my_buf_unref(my_source_udp_pending_get(port));
+	}
+
+	MY_DEBUG("core/%s: read %d bytes of rtp packets", port->conf->name, total);
+	return total;
+}
+
+/*
+ * Drains up to 'batch' datagrams at once, each one landing in its own
+ * 'datagram-size' slot of 'buf', then packs what they carry together so
+ * that it is handed downstream, or to the codec, in one go.
+ */
+static int my_io_udp_get(my_port_t *port, void *buf, int len)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	char *p = buf;
+	int size = udp->dgram_size;
+	int count, total;
+	int i, n;
+
+	/* one datagram at a time, already received by the loop */
+	if (MY_DPORT(port)->aio_op) {
+		return my_port_aio_get(port, buf, len);
+	}
+
+	if ((udp->batch == 1) && (udp->framing == MY_UDP_FRAMING_RAW)) {
+		n = read(udp->fd, buf, len);
+		if (n < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
+				n = 0;
+				goto out;
+			}
+
+			my_log(MY_LOG_ERROR, "core/%s: error reading from socket (%d: %s)", port->conf->name, errno, strerror(errno));
+			return n;
+		}
+		goto out;
+	}
+
+	/* packets must be kept around, to rebuild any missing one */
+	if (udp->fec_dec) {
+		return my_source_udp_rtp_get(port, buf, len);
+	}
+
+	count = len / size;
+	if (count > udp->batch) {
+		count = udp->batch;
+	} else if (count < 1) {
+		count = 1;
+		size = len;
+	}
+
+	for (i = 0; i < count; i++) {
+		udp->slots[i] = p + i * size;
+	}
+
+	n = my_io_udp_recv(port, size, count);
+	if (n < 0) {
+		return n;
+	}
+
+	total = 0;
+	for (i = 0; i < n; i++) {
+		if (udp->lens[i] <= 0) {
+			continue;
+		}
+		if (p + total != udp->slots[i]) {
+			memmove(p + total, udp->slots[i], udp->lens[i]);
+		}
+		total += udp->lens[i];
+	}
+
+	MY_DEBUG("core/%s: read %d bytes in %d datagrams from socket", port->conf->name, total, n);
+	return total;
+
 out:
 	MY_DEBUG("core/%s: read %d bytes from socket", port->conf->name, n);
 	return n;
 }
 
-static int my_io_udp_put(my_port_t *port, void *buf, int len)
+/*
+ * Without a codec, rtp packets are pulled one per buffer, whatever 'len',
+ * so that their sequence number & media time go along with them.
+ */
+static my_buf_t *my_source_udp_pull_buf(my_port_t *port, int len)
 {
+	my_udp_priv_t *udp = MY_UDP(port);
+
+	if ((udp->framing != MY_UDP_FRAMING_RTP) || MY_DPORT(port)->codec) {
+		return my_port_get_buf(port, len);
+	}
+
+	if (!udp->pending) {
+		my_source_udp_rtp_fill(port);
+	}
+
+	return my_source_udp_pending_get(port);
+}
+
+static int my_source_udp_close(my_port_t *port)
+{
+	my_fec_dec_t *dec = MY_UDP(port)->fec_dec;
+	my_buf_t *buf;
+
+	while ((buf = my_source_udp_pending_get(port))) {
+		my_buf_unref(buf);
+	}
+
+	if (dec) {
+		my_log(MY_LOG_INFO, "core/%s: %llu packets recovered, %llu unrecoverable", port->conf->name,
+			(unsigned long long)my_fec_dec_get_recovered(dec), (unsigned long long)my_fec_dec_get_unrecoverable(dec));
+	}
+
+	return my_io_udp_close(port);
+}
+
+/* sends 'hdr', if any, & 'buf' as a single datagram, or queues it while the socket is full */
+static int my_io_udp_send(my_port_t *port, void *hdr, int hdr_len, void *buf, int len)
+{
+	my_rbuf_t *queue = MY_DPORT(port)->queue;
+	unsigned char qhdr[MY_UDP_DGRAM_HDR_SIZE];
+	struct iovec iov[2];
+	struct msghdr msg;
 	int n;
 
-	n = sendto(MY_UDP(port)->fd, buf, len, 0, MY_UDP(port)->sa_group, MY_UDP(port)->sa_len);
-	if (n < 0) {
-		if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
-			n = 0;
+	if (hdr_len + len > MY_UDP_DGRAM_MAX) {
+		my_log(MY_LOG_ERROR, "core/%s: datagram too large (%d bytes)", port->conf->name, hdr_len + len);
+		return -1;
+	}
+
+	/* nothing pending, try to send right away, unless sending in batches */
+	if ((MY_UDP(port)->batch == 1) && (my_rbuf_get_avail(queue) == 0)) {
+		if (hdr_len) {
+			iov[0].iov_base = hdr;
+			iov[0].iov_len = hdr_len;
+			iov[1].iov_base = buf;
+			iov[1].iov_len = len;
+			my_mem_zero(&msg, sizeof(msg));
+			msg.msg_name = MY_UDP(port)->sa_group;
+			msg.msg_namelen = MY_UDP(port)->sa_len;
+			msg.msg_iov = iov;
+			msg.msg_iovlen = 2;
+			n = sendmsg(MY_UDP(port)->fd, &msg, 0);
+		} else {
+			n = sendto(MY_UDP(port)->fd, buf, len, 0, MY_UDP(port)->sa_group, MY_UDP(port)->sa_len);
+		}
+		if (n >= 0) {
+			n = len;
 			goto out;
 		}
+		if ((errno != EWOULDBLOCK) && (errno != EINTR)) {
+			my_log(MY_LOG_ERROR, "core/%s: error sending to socket (%d: %s)", port->conf->name, errno, strerror(errno));
+			return n;
+		}
+	}
 
-		my_log(MY_LOG_ERROR, "core/%s: error sending to socket (%d: %s)", port->conf->name, errno, strerror(errno));
-		return n;
+	if (my_rbuf_put_avail(queue) < MY_UDP_DGRAM_HDR_SIZE + hdr_len + len) {
+		my_log(MY_LOG_WARNING, "core/%s: output queue full, dropping %d bytes datagram", port->conf->name, hdr_len + len);
+		n = 0;
+		goto out;
 	}
 
+	qhdr[0] = ((hdr_len + len) >> 8) & 0xff;
+	qhdr[1] = (hdr_len + len) & 0xff;
+	my_rbuf_put(queue, (char *)qhdr, MY_UDP_DGRAM_HDR_SIZE);
+	if (hdr_len) {
+		my_rbuf_put(queue, hdr, hdr_len);
+	}
+	my_rbuf_put(queue, buf, len);
+	if (MY_UDP(port)->batch == 1) {
+		my_loop_event_handler_mod(port->loop, MY_UDP(port)->fd, MY_EVENT_WRITE);
+	} else if (!MY_UDP(port)->flush_interval) {
+		my_loop_defer(port->loop, &MY_UDP(port)->flush);
+	}
+	my_port_queue_update(port);
+	n = len;
+
 out:
 	MY_DEBUG("core/%s: wrote %d bytes to socket", port->conf->name, n);
 	return n;
 }
 
+static int my_io_udp_frame_size(my_audio_format_t *format)
+{
+	switch (format->encoding) {
+	case MY_AUDIO_ENCODING_S16:
+		return 2 * format->channels;
+	case MY_AUDIO_ENCODING_S32:
+	case MY_AUDIO_ENCODING_F32:
+		return 4 * format->channels;
+	}
+
+	return 0;
+}
+
+static void my_io_udp_rtp_hdr(my_port_t *port, unsigned char *hdr, int payload_type, uint16_t seq, uint32_t media_time)
+{
+	uint32_t ssrc = MY_UDP(port)->ssrc;
+
+	hdr[0] = MY_UDP_RTP_VERSION << 6;
+	hdr[1] = (MY_UDP(port)->marker ? 0x80 : 0) | (payload_type & 0x7f);
+	hdr[2] = seq >> 8;
+	hdr[3] = seq;
+	hdr[4] = media_time >> 24;
+	hdr[5] = media_time >> 16;
+	hdr[6] = media_time >> 8;
+	hdr[7] = media_time;
+	hdr[8] = ssrc >> 24;
+	hdr[9] = ssrc >> 16;
+	hdr[10] = ssrc >> 8;
+	hdr[11] = ssrc;
+}
+
+/*
+ * Sends 'buf' as one rtp packet. Its media time counts the audio frames
+ * sent so far when their format is known, and follows 'timestamp' (ns)
+ * otherwise, at 'clock-rate' Hz (default: the sample rate, or 90 kHz).
+ * With error correction, a parity packet follows every 'fec' packets.
+ */
+static int my_target_udp_rtp_send(my_port_t *port, void *buf, int len, my_audio_format_t *format, uint64_t timestamp)
+{
+	my_udp_priv_t *udp = MY_UDP(port);
+	unsigned char hdr[MY_UDP_RTP_HDR_SIZE];
+	int frame_size = format ? my_io_udp_frame_size(format) : 0;
+	int rate = (frame_size > 0) ? format->rate : 0;
+	char *parity;
+	int n, plen;
+
+	if (!udp->clock_rate) {
+		udp->clock_rate = (rate > 0) ? rate : MY_UDP_RTP_CLOCK_RATE;
+	}
+
+	/* first packet, or a new clock, starting from where the previous one was */
+	if (udp->marker || (rate != udp->media_rate)) {
+		udp->media_base = udp->media_time;
+		udp->media_rate = rate;
+		udp->media_pos = rate ? 0 : timestamp;
+	}
+
+	if (rate > 0) {
+		udp->media_time = udp->media_base + (uint32_t)(udp->media_pos * udp->clock_rate / rate);
+		udp->media_pos += len / frame_size;
+	} else {
+		udp->media_time = udp->media_base + (uint32_t)((timestamp - udp->media_pos) * udp->clock_rate / 1000000000ULL);
+	}
+
+	my_io_udp_rtp_hdr(port, hdr, udp->payload_type, udp->seq, udp->media_time);
+	udp->marker = 0;
+
+	n = my_io_udp_send(port, hdr, MY_UDP_RTP_HDR_SIZE, buf, len);
+	if ((n < 0) || !udp->fec_enc) {
+		goto out;
+	}
+
+	/* a group is complete, its parity packet is numbered apart */
+	plen = my_fec_enc_add(udp->fec_enc, udp->seq, udp->media_time, buf, len, &parity);
+	if (plen > 0) {
+		my_io_udp_rtp_hdr(port, hdr, udp->fec_payload_type, udp->fec_seq, udp->media_time);
+		udp->fec_seq++;
+		my_io_udp_send(port, hdr, MY_UDP_RTP_HDR_SIZE, parity, plen);
+	}
+
+out:
+	udp->seq++;
+	return n;
+}
+
+static int my_io_udp_put(my_port_t *port, void *buf, int len)
+{
+	if (MY_UDP(port)->framing == MY_UDP_FRAMING_RTP) {
+		return my_target_udp_rtp_send(port, buf, len, NULL, my_core_get_time(port->core));
+	}
+
+	return my_io_udp_send(port, NULL, 0, buf, len);
+}
+
+static int my_target_udp_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	if (MY_UDP(port)->framing == MY_UDP_FRAMING_RTP) {
+		return my_target_udp_rtp_send(port, buf->data, buf->len, &buf->format, buf->timestamp);
+	}
+
+	return my_io_udp_send(port, NULL, 0, buf->data, buf->len);
+}
+
 my_port_impl_t my_source_udp = {
 	.name = "udp",
 	.desc = "UDP multicast source",
-	.create = my_io_udp_create,
-	.destroy = my_io_udp_destroy,
+	.create = my_source_udp_create,
+	.destroy = my_source_udp_destroy,
 	.open = my_io_udp_open,
-	.close = my_io_udp_close,
+	.close = my_source_udp_close,
 	.get = my_io_udp_get,
+	.pull_buf = my_source_udp_pull_buf,
+	.pause = my_source_udp_pause,
 	.handler = my_source_udp_event_handler,
 };
 
 my_port_impl_t my_target_udp = {
 	.name = "udp",
 	.desc = "UDP multicast target",
-	.create = my_io_udp_create,
-	.destroy = my_io_udp_destroy,
-	.open = my_io_udp_open,
-	.close = my_io_udp_close,
+	.create = my_target_udp_create,
+	.destroy = my_target_udp_destroy,
+	.open = my_target_udp_open,
+	.close = my_target_udp_close,
 	.put = my_io_udp_put,
+	.push_buf = my_target_udp_push_buf,
 	.handler = my_target_udp_event_handler,
 };
@@ -0,0 +1,744 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "core/loop.h"
+#include "core/poller.h"
+
+#include "util/log.h"
+#include "util/mem.h"
+#include "util/list.h"
+#include "util/net.h"
+
+/* upper bound on a loop sleep, so that a missed wakeup can never hang the loop */
+#define EVENT_LIST_MAX_SLEEP MY_MSEC(1000)
+#define EVENT_LIST_READY_MAX 64
+#define ALARM_HEAP_INITIAL_SIZE 64
+#define WATCH_TABLE_INITIAL_SIZE 64
+/* rounds waited for canceled i/o to complete when destroying a loop */
+#define IO_DRAIN_ROUNDS 10
+
+struct my_loop_s {
+	my_core_t *core;
+	int index;
+	int running;
+	pthread_t thread;
+	int wakeup_fds[2];
+	my_poller_t *poller;
+	my_buf_pool_t *buf_pool;
+	uint64_t curr_time;
+	my_link_t watched_fds;
+	my_link_t unwatched_fds;
+	my_link_t deferred;
+	my_link_t pending_ios;
+	struct watch_entry **watch_table;
+	int watch_table_size;
+	my_alarm_t **alarm_heap;
+	int alarm_count;
+	int alarm_size;
+	my_alarm_t *alarm_firing;
+};
+
+struct watch_entry {
+	my_link_t link;
+	int fd;
+	int events;
+	my_event_handler_t callback_fn;
+	void *data;
+};
+
+struct my_loop_io_s {
+	my_poller_io_t _inherited;
+	my_link_t link;
+	my_buf_t *buf;
+	my_loop_io_handler_t handler;
+	void *data;
+};
+
+struct my_alarm_s {
+	uint64_t alarm_time;
+	uint64_t reoccurring;
+	my_alarm_handler_t callback_fn;
+	void *data;
+	int heap_index;
+	int cancelled;
+};
+
+static void my_loop_watch_list_purge(my_link_t *head)
+{
+	my_link_t *link, *next;
+
+	my_ilist_for_each_safe(head, link, next) {
+		my_ilist_remove(link);
+		my_mem_free(my_link_entry(link, struct watch_entry, link));
+	}
+}
+
+void my_loop_deferred_init(my_deferred_t *deferred, my_alarm_handler_t handler, void *p)
+{
+	my_ilist_init(&deferred->link);
+	deferred->handler = handler;
+	deferred->data = p;
+}
+
+void my_loop_defer(my_loop_t *loop, my_deferred_t *deferred)
+{
+	if (my_ilist_is_empty(&deferred->link)) {
+		my_ilist_add_tail(&loop->deferred, &deferred->link);
+	}
+}
+
+void my_loop_defer_cancel(my_deferred_t *deferred)
+{
+	my_ilist_remove(&deferred->link);
+}
+
+/* calls deferred while running are left for the next round, which won't sleep */
+static void my_loop_deferred_run(my_loop_t *loop)
+{
+	my_link_t pending, *link;
+	my_deferred_t *deferred;
+
+	if (my_ilist_is_empty(&loop->deferred)) {
+		return;
+	}
+
+	/* take the whole list over */
+	pending.next = loop->deferred.next;
+	pending.prev = loop->deferred.prev;
+	pending.next->prev = &pending;
+	pending.prev->next = &pending;
+	my_ilist_init(&loop->deferred);
+
+	/* one at a time, as a handler may cancel any other */
+	while (!my_ilist_is_empty(&pending)) {
+		link = pending.next;
+		my_ilist_remove(link);
+		deferred = my_link_entry(link, my_deferred_t, link);
+		deferred->handler(deferred->data);
+	}
+}
+
+static int my_loop_wakeup_handler(int fd, int events, void *p)
+{
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	return 0;
+}
+
+my_loop_t *my_loop_create(my_core_t *core, int index, char *poller)
+{
+	my_loop_t *loop;
+
+	loop = my_mem_alloc(sizeof(my_loop_t));
+	if (!loop) {
+		MY_ERROR("core/loop#%d: error creating internal data (%s)", index, strerror(errno));
+		goto _MY_ERR_alloc;
+	}
+
+	loop->core = core;
+	loop->index = index;
+
+	/* live until stopped, even if stopped before it starts running */
+	loop->running = 1;
+
+	my_ilist_init(&loop->watched_fds);
+
+	/* entries unregistered while the loop may still hold pointers to them */
+	my_ilist_init(&loop->unwatched_fds);
+
+	my_ilist_init(&loop->deferred);
+
+	my_ilist_init(&loop->pending_ios);
+
+	loop->alarm_size = ALARM_HEAP_INITIAL_SIZE;
+	loop->alarm_heap = my_mem_alloc(loop->alarm_size * sizeof(my_alarm_t *));
+	if (!loop->alarm_heap) {
+		MY_ERROR("core/loop#%d: error creating alarm heap (%s)", index, strerror(errno));
+		goto _MY_ERR_create_alarm_heap;
+	}
+
+	loop->poller = my_poller_create(poller);
+	if (!loop->poller) {
+		MY_ERROR("core/loop#%d: error creating poller", index);
+		goto _MY_ERR_create_poller;
+	}
+
+	loop->buf_pool = my_buf_pool_create(MY_LOOP_BUF_SIZE, MY_LOOP_BUF_COUNT);
+	if (!loop->buf_pool) {
+		MY_ERROR("core/loop#%d: error creating buffer pool (%s)", index, strerror(errno));
+		goto _MY_ERR_create_buf_pool;
+	}
+
+	/* lets other threads & signal handlers interrupt a sleeping loop */
+	if (pipe(loop->wakeup_fds) != 0) {
+		MY_ERROR("core/loop#%d: error creating wakeup pipe (%s)", index, strerror(errno));
+		goto _MY_ERR_create_wakeup;
+	}
+	my_sock_set_nonblock(loop->wakeup_fds[0]);
+	my_sock_set_nonblock(loop->wakeup_fds[1]);
+
+	if (my_loop_event_handler_add(loop, loop->wakeup_fds[0], MY_EVENT_READ, my_loop_wakeup_handler, loop) != 0) {
+		goto _MY_ERR_watch_wakeup;
+	}
+
+	loop->curr_time = my_core_get_time(core);
+
+	return loop;
+
+_MY_ERR_watch_wakeup:
+	close(loop->wakeup_fds[1]);
+	close(loop->wakeup_fds[0]);
+_MY_ERR_create_wakeup:
+	my_buf_pool_destroy(loop->buf_pool);
+_MY_ERR_create_buf_pool:
+	my_poller_destroy(loop->poller);
+_MY_ERR_create_poller:
+	my_mem_free(loop->alarm_heap);
+_MY_ERR_create_alarm_heap:
+	my_mem_free(loop);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_loop_io_drain(my_loop_t *loop);
+
+void my_loop_destroy(my_loop_t *loop)
+{
+	my_loop_io_drain(loop);
+
+	my_loop_event_handler_del(loop, loop->wakeup_fds[0]);
+	close(loop->wakeup_fds[1]);
+	close(loop->wakeup_fds[0]);
+
+	my_loop_watch_list_purge(&loop->unwatched_fds);
+	my_loop_watch_list_purge(&loop->watched_fds);
+	my_mem_free(loop->watch_table);
+	my_buf_pool_destroy(loop->buf_pool);
+	my_poller_destroy(loop->poller);
+	while (loop->alarm_count > 0) {
+		my_mem_free(loop->alarm_heap[--loop->alarm_count]);
+	}
+	my_mem_free(loop->alarm_heap);
+	my_mem_free(loop);
+}
+
+int my_loop_get_index(my_loop_t *loop)
+{
+	return loop->index;
+}
+
+my_buf_pool_t *my_loop_get_buf_pool(my_loop_t *loop)
+{
+	return loop->buf_pool;
+}
+
+/*
+ * Pending alarms are kept in a binary min-heap ordered by expiry time, each
+ * entry remembering its own slot so that it can be cancelled in O(log n).
+ */
+
+#define ALARM_BEFORE(a, b) ((int64_t)((a)->alarm_time - (b)->alarm_time) < 0)
+
+static void my_loop_alarm_heap_set(my_loop_t *loop, int i, my_alarm_t *alarm_entry)
+{
+	loop->alarm_heap[i] = alarm_entry;
+	alarm_entry->heap_index = i;
+}
+
+static void my_loop_alarm_heap_up(my_loop_t *loop, int i)
+{
+	my_alarm_t *alarm_entry = loop->alarm_heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!ALARM_BEFORE(alarm_entry, loop->alarm_heap[parent]))
+			break;
+		my_loop_alarm_heap_set(loop, i, loop->alarm_heap[parent]);
+		i = parent;
+	}
+
+	my_loop_alarm_heap_set(loop, i, alarm_entry);
+}
+
+static void my_loop_alarm_heap_down(my_loop_t *loop, int i)
+{
+	my_alarm_t *alarm_entry = loop->alarm_heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < loop->alarm_count) {
+		if (child + 1 < loop->alarm_count
+		    && ALARM_BEFORE(loop->alarm_heap[child + 1], loop->alarm_heap[child]))
+			child++;
+		if (!ALARM_BEFORE(loop->alarm_heap[child], alarm_entry))
+			break;
+		my_loop_alarm_heap_set(loop, i, loop->alarm_heap[child]);
+		i = child;
+	}
+
+	my_loop_alarm_heap_set(loop, i, alarm_entry);
+}
+
+static int my_loop_alarm_heap_insert(my_loop_t *loop, my_alarm_t *alarm_entry)
+{
+	my_alarm_t **heap;
+
+	if (loop->alarm_count == loop->alarm_size) {
+		heap = my_mem_alloc_nozero(2 * loop->alarm_size * sizeof(my_alarm_t *));
+		if (!heap)
+			return -1;
+		my_mem_copy(heap, loop->alarm_heap, loop->alarm_size * sizeof(my_alarm_t *));
+		my_mem_free(loop->alarm_heap);
+		loop->alarm_heap = heap;
+		loop->alarm_size *= 2;
+	}
+
+	loop->alarm_heap[loop->alarm_count] = alarm_entry;
+	my_loop_alarm_heap_up(loop, loop->alarm_count++);
+	return 0;
+}
+
+static void my_loop_alarm_heap_remove(my_loop_t *loop, my_alarm_t *alarm_entry)
+{
+	int i = alarm_entry->heap_index;
+	my_alarm_t *last;
+
+	last = loop->alarm_heap[--loop->alarm_count];
+	alarm_entry->heap_index = -1;
+	if (last == alarm_entry)
+		return;
+
+	my_loop_alarm_heap_set(loop, i, last);
+	if (i > 0 && ALARM_BEFORE(last, loop->alarm_heap[(i - 1) / 2]))
+		my_loop_alarm_heap_up(loop, i);
+	else
+		my_loop_alarm_heap_down(loop, i);
+}
+
+my_alarm_t *my_loop_alarm_add(my_loop_t *loop, uint64_t timeout,
+			      int reoccurring, my_alarm_handler_t handler, void *p)
+{
+	my_alarm_t *alarm_entry;
+
+	if (reoccurring && !timeout) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error creating alarm entry (null period)", loop->index);
+		goto err;
+	}
+
+	alarm_entry = my_mem_alloc_nozero(sizeof(my_alarm_t));
+	if (!alarm_entry) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error creating alarm entry (%s)", loop->index, strerror(errno));
+		goto err;
+	}
+
+	alarm_entry->alarm_time = my_core_get_time(loop->core) + timeout;
+	alarm_entry->callback_fn = handler;
+	alarm_entry->data = p;
+	alarm_entry->cancelled = 0;
+
+	if (reoccurring)
+		alarm_entry->reoccurring = timeout;
+	else
+		alarm_entry->reoccurring = 0;
+
+	if (my_loop_alarm_heap_insert(loop, alarm_entry) != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error growing alarm heap (%s)", loop->index, strerror(errno));
+		goto err_free;
+	}
+
+	return alarm_entry;
+
+err_free:
+	my_mem_free(alarm_entry);
+err:
+	return NULL;
+}
+
+int my_loop_alarm_del(my_loop_t *loop, my_alarm_t *alarm_entry)
+{
+	/* cancelled from its own handler, freed once the handler returns */
+	if (alarm_entry == loop->alarm_firing) {
+		alarm_entry->cancelled = 1;
+		return 0;
+	}
+
+	if (alarm_entry->heap_index < 0 || alarm_entry->heap_index >= loop->alarm_count
+	    || loop->alarm_heap[alarm_entry->heap_index] != alarm_entry) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error cancelling alarm: unknown alarm (%p)", loop->index, alarm_entry);
+		return -1;
+	}
+
+	my_loop_alarm_heap_remove(loop, alarm_entry);
+	my_mem_free(alarm_entry);
+	return 0;
+}
+
+static void my_loop_alarm_list_maintain(my_loop_t *loop)
+{
+	my_alarm_t *alarm_entry;
+
+	while (loop->alarm_count > 0) {
+		alarm_entry = loop->alarm_heap[0];
+
+		if ((int64_t)(alarm_entry->alarm_time - loop->curr_time) > 0)
+			break;
+
+		my_loop_alarm_heap_remove(loop, alarm_entry);
+
+		loop->alarm_firing = alarm_entry;
+		(alarm_entry->callback_fn)(alarm_entry->data);
+		loop->alarm_firing = NULL;
+
+		if (alarm_entry->reoccurring && !alarm_entry->cancelled) {
+			/* keep the period drift-free, unless a whole period was missed */
+			alarm_entry->alarm_time += alarm_entry->reoccurring;
+			if ((int64_t)(alarm_entry->alarm_time - loop->curr_time) <= 0)
+				alarm_entry->alarm_time = loop->curr_time + alarm_entry->reoccurring;
+			if (my_loop_alarm_heap_insert(loop, alarm_entry) == 0)
+				continue;
+			my_log(MY_LOG_ERROR, "core/loop#%d: error re-arming alarm (%s)", loop->index, strerror(errno));
+		}
+
+		my_mem_free(alarm_entry);
+	}
+}
+
+int my_loop_can_submit(my_loop_t *loop)
+{
+	return my_poller_can_submit(loop->poller);
+}
+
+my_loop_io_t *my_loop_io_submit(my_loop_t *loop, int op, int fd, my_buf_t *buf, int off, int len,
+				my_loop_io_handler_t handler, void *p)
+{
+	my_loop_io_t *io;
+
+	io = my_mem_alloc_nozero(sizeof(my_loop_io_t));
+	if (!io) {
+		goto _MY_ERR_alloc;
+	}
+
+	io->_inherited.op = op;
+	io->_inherited.fd = fd;
+	io->_inherited.addr = buf->data + off;
+	io->_inherited.len = len;
+	io->_inherited.res = 0;
+	io->handler = handler;
+	io->data = p;
+
+	if (my_poller_submit(loop->poller, &io->_inherited) != 0) {
+		goto _MY_ERR_submit;
+	}
+
+	/* the kernel may write to it until completed */
+	io->buf = my_buf_ref(buf);
+	my_ilist_add_tail(&loop->pending_ios, &io->link);
+
+	return io;
+
+_MY_ERR_submit:
+	my_mem_free(io);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+void my_loop_io_cancel(my_loop_t *loop, my_loop_io_t *io)
+{
+	io->handler = NULL;
+	if (my_poller_cancel(loop->poller, &io->_inherited) != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error canceling i/o on fd '%i' (%s)", loop->index, io->_inherited.fd, strerror(errno));
+	}
+}
+
+static void my_loop_io_complete(my_loop_t *loop, my_loop_io_t *io)
+{
+	my_ilist_remove(&io->link);
+
+	if (io->handler) {
+		(io->handler)(io->buf, io->_inherited.res, io->data);
+	}
+
+	my_buf_unref(io->buf);
+	my_mem_free(io);
+}
+
+/* what is still in flight is canceled, its buffers are only given back once completed */
+static void my_loop_io_drain(my_loop_t *loop)
+{
+	my_poller_event_t ready[EVENT_LIST_READY_MAX];
+	my_link_t *link, *next;
+	int i, n, rounds;
+
+	my_ilist_for_each_safe(&loop->pending_ios, link, next) {
+		my_loop_io_cancel(loop, my_link_entry(link, my_loop_io_t, link));
+	}
+
+	for (rounds = 0; !my_ilist_is_empty(&loop->pending_ios) && (rounds < IO_DRAIN_ROUNDS); rounds++) {
+		n = my_poller_wait(loop->poller, ready, EVENT_LIST_READY_MAX, MY_MSEC(100));
+		for (i = 0; i < n; i++) {
+			if (ready[i].events & MY_EVENT_IO) {
+				my_loop_io_complete(loop, ready[i].data);
+			}
+		}
+	}
+
+	if (!my_ilist_is_empty(&loop->pending_ios)) {
+		my_log(MY_LOG_WARNING, "core/loop#%d: i/o still in flight, leaking its buffers", loop->index);
+	}
+}
+
+void my_loop_run(my_loop_t *loop)
+{
+	struct watch_entry *watch_entry;
+	my_poller_event_t ready[EVENT_LIST_READY_MAX];
+	int64_t timeout;
+	int i, n;
+
+	while (__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+
+		/* sleep until the next alarm is due */
+		timeout = EVENT_LIST_MAX_SLEEP;
+		if (loop->alarm_count > 0) {
+			timeout = loop->alarm_heap[0]->alarm_time - my_core_get_time(loop->core);
+			if (timeout < 0)
+				timeout = 0;
+			else if (timeout > EVENT_LIST_MAX_SLEEP)
+				timeout = EVENT_LIST_MAX_SLEEP;
+		}
+
+		/* or not at all, with calls deferred from the previous round */
+		if (!my_ilist_is_empty(&loop->deferred))
+			timeout = 0;
+
+		n = my_poller_wait(loop->poller, ready, EVENT_LIST_READY_MAX, timeout);
+
+		loop->curr_time = my_core_get_time(loop->core);
+		my_loop_alarm_list_maintain(loop);
+
+		if (n < 0) {
+			if (errno != EINTR)
+				my_log(MY_LOG_ERROR, "core/loop#%d: poller error '%s'", loop->index, strerror(errno));
+		}
+
+		for (i = 0; i < n; i++) {
+			if (ready[i].events & MY_EVENT_IO) {
+				my_loop_io_complete(loop, ready[i].data);
+				continue;
+			}
+
+			watch_entry = ready[i].data;
+
+			/* unregistered by a previous handler */
+			if (!watch_entry->callback_fn)
+				continue;
+
+			(watch_entry->callback_fn)(watch_entry->fd, ready[i].events, watch_entry->data);
+		}
+
+		my_loop_deferred_run(loop);
+		my_loop_watch_list_purge(&loop->unwatched_fds);
+	}
+}
+
+static void *my_loop_thread_fn(void *p)
+{
+	my_loop_t *loop = p;
+	sigset_t set;
+
+	/* signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	MY_DEBUG("core/loop#%d: running", loop->index);
+	my_loop_run(loop);
+	MY_DEBUG("core/loop#%d: stopped", loop->index);
+
+	return NULL;
+}
+
+int my_loop_start(my_loop_t *loop, int cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpus;
+#endif
+	int rc;
+
+	rc = pthread_create(&loop->thread, NULL, my_loop_thread_fn, loop);
+	if (rc != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error creating thread (%s)", loop->index, strerror(rc));
+		return -1;
+	}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		rc = pthread_setaffinity_np(loop->thread, sizeof(cpus), &cpus);
+		if (rc != 0) {
+			my_log(MY_LOG_WARNING, "core/loop#%d: error pinning thread to cpu %d (%s)", loop->index, cpu, strerror(rc));
+		}
+	}
+#endif
+
+	return 0;
+}
+
+void my_loop_join(my_loop_t *loop)
+{
+	pthread_join(loop->thread, NULL);
+}
+
+void my_loop_stop(my_loop_t *loop)
+{
+	__atomic_store_n(&loop->running, 0, __ATOMIC_RELEASE);
+	write(loop->wakeup_fds[1], "", 1);
+}
+
+static struct watch_entry *my_loop_watch_entry_find(my_loop_t *loop, int fd)
+{
+	if (fd < 0 || fd >= loop->watch_table_size)
+		return NULL;
+
+	return loop->watch_table[fd];
+}
+
+static int my_loop_watch_table_grow(my_loop_t *loop, int fd)
+{
+	struct watch_entry **table;
+	int size;
+
+	size = loop->watch_table_size ? loop->watch_table_size : WATCH_TABLE_INITIAL_SIZE;
+	while (size <= fd)
+		size *= 2;
+
+	table = my_mem_alloc(size * sizeof(struct watch_entry *));
+	if (!table)
+		return -1;
+
+	if (loop->watch_table) {
+		my_mem_copy(table, loop->watch_table, loop->watch_table_size * sizeof(struct watch_entry *));
+		my_mem_free(loop->watch_table);
+	}
+
+	loop->watch_table = table;
+	loop->watch_table_size = size;
+	return 0;
+}
+
+int my_loop_event_handler_add(my_loop_t *loop, int fd, int events, my_event_handler_t handler, void *p)
+{
+	struct watch_entry *watch_entry;
+
+	if (my_loop_watch_entry_find(loop, fd)) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: trying to register an already watched fd: '%i'", loop->index, fd);
+		goto err;
+	}
+
+	if (fd >= loop->watch_table_size && my_loop_watch_table_grow(loop, fd) != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error growing watch table (%s)", loop->index, strerror(errno));
+		goto err;
+	}
+
+	watch_entry = my_mem_alloc_nozero(sizeof(struct watch_entry));
+	if (!watch_entry) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error creating event handler (%s)", loop->index, strerror(errno));
+		goto err;
+	}
+
+	watch_entry->fd = fd;
+	watch_entry->events = events;
+	watch_entry->callback_fn = handler;
+	watch_entry->data = p;
+
+	if (my_poller_add(loop->poller, fd, events, watch_entry) != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error watching fd '%i' (%s)", loop->index, fd, strerror(errno));
+		goto err_free;
+	}
+
+	my_ilist_add_tail(&loop->watched_fds, &watch_entry->link);
+	loop->watch_table[fd] = watch_entry;
+	return 0;
+
+err_free:
+	my_mem_free(watch_entry);
+err:
+	return -1;
+}
+
+int my_loop_event_handler_mod(my_loop_t *loop, int fd, int events)
+{
+	struct watch_entry *watch_entry;
+
+	watch_entry = my_loop_watch_entry_find(loop, fd);
+	if (!watch_entry) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error modifying fd events: unknown fd (%i)", loop->index, fd);
+		return -1;
+	}
+
+	if (watch_entry->events == events)
+		return 0;
+
+	if (my_poller_mod(loop->poller, fd, events, watch_entry) != 0) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error modifying fd '%i' events (%s)", loop->index, fd, strerror(errno));
+		return -1;
+	}
+
+	watch_entry->events = events;
+	return 0;
+}
+
+int my_loop_event_handler_del(my_loop_t *loop, int fd)
+{
+	struct watch_entry *watch_entry;
+
+	watch_entry = my_loop_watch_entry_find(loop, fd);
+	if (!watch_entry) {
+		my_log(MY_LOG_ERROR, "core/loop#%d: error unregistering fd: unknown fd (%i)", loop->index, fd);
+		goto err;
+	}
+
+	my_ilist_remove(&watch_entry->link);
+	loop->watch_table[fd] = NULL;
+	my_poller_del(loop->poller, fd, watch_entry);
+
+	/* the loop may hold a pointer to it until the end of the current round */
+	watch_entry->callback_fn = NULL;
+	my_ilist_add_tail(&loop->unwatched_fds, &watch_entry->link);
+	return 0;
+
+err:
+	return -1;
+}
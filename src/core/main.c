@@ -27,47 +27,35 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <sys/times.h>
+#include <time.h>
 
 #include "core.h"
+#include "core/graph.h"
+#include "core/loop.h"
+#include "core/poller.h"
+#include "core/ports.h"
 
 #include "util/log.h"
 #include "util/mem.h"
 #include "util/list.h"
 
-#define EVENT_LIST_RESOLUTION 250000	/* microseconds */
-
 typedef struct my_core_priv my_core_priv_t;
 
 struct my_core_priv {
 	my_core_t base;
-	int running;
-	fd_set watching_fds;
-	int max_sock;
-	int64_t curr_time;
-	my_list_t *watched_fd_list;
-	my_list_t *alarm_list;
-	uint32_t system_tick;
-};
-
-struct watch_entry {
-	int fd;
-	my_event_handler_t callback_fn;
-	void *data;
-};
-
-struct alarm_entry {
-	uint64_t alarm_time;
-	uint64_t reoccurring;
-	my_alarm_handler_t callback_fn;
-	void *data;
+	clockid_t clock_id;
+	int cpu_count;
+	my_loop_t *control_loop;
+	my_loop_t **reactors;
+	int reactor_count;
+	my_graph_t *graph;
 };
 
 #define MY_CORE_PRIV(p) ((my_core_priv_t *)p)
 
 static void my_core_exit(my_core_t *core)
 {
-	MY_CORE_PRIV(core)->running = 0;
+	my_loop_stop(MY_CORE_PRIV(core)->control_loop);
 }
 
 static void my_core_handle_shutdown(int sig, short event, void *p)
@@ -76,73 +64,132 @@ static void my_core_handle_shutdown(int sig, short event, void *p)
 	my_core_exit(MY_CORE(p));
 }
 
-static void my_core_watched_fds_update(my_core_t *core)
+uint64_t my_core_get_time(my_core_t *core)
 {
 	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct watch_entry *watch_entry;
-	my_node_t *node;
-	int tmp_max_sock = 0;
-	fd_set tmp_watched_fds;
+	struct timespec ts;
 
-	FD_ZERO(&tmp_watched_fds);
+	clock_gettime(core_priv->clock_id, &ts);
 
-	my_list_for_each(core_priv->watched_fd_list, node, watch_entry) {
-		if (watch_entry->fd > tmp_max_sock)
-			tmp_max_sock = watch_entry->fd;
+	return (uint64_t)ts.tv_sec * MY_SEC(1) + ts.tv_nsec;
+}
+
+static int my_core_clock_set(my_core_t *core, char *name)
+{
+	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
+	struct timespec ts;
+
+	if (!name || strcmp(name, "monotonic") == 0) {
+		core_priv->clock_id = CLOCK_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_RAW
+	} else if (strcmp(name, "monotonic-raw") == 0) {
+		core_priv->clock_id = CLOCK_MONOTONIC_RAW;
+#endif
+	} else {
+		my_log(MY_LOG_ERROR, "core: unknown clock '%s'", name);
+		return -1;
+	}
 
-		FD_SET(watch_entry->fd, &tmp_watched_fds);
+	if (clock_getres(core_priv->clock_id, &ts) != 0) {
+		my_log(MY_LOG_ERROR, "core: clock '%s' not supported (%s)", name, strerror(errno));
+		core_priv->clock_id = CLOCK_MONOTONIC;
+		return -1;
 	}
 
-	core_priv->max_sock = tmp_max_sock;
-	memcpy(&core_priv->watching_fds, &tmp_watched_fds, sizeof(fd_set));
+	MY_DEBUG("core: using clock '%s', resolution %ldns", name ? name : "monotonic", ts.tv_nsec);
+
+	return 0;
 }
 
-/* Make times(2) behave rationally on Linux */
-static clock_t my_core_times_wrapper(void)
+static int my_core_loops_create(my_core_t *core, my_conf_t *conf)
 {
-	struct tms dummy_tms_struct;
-	int save_errno = errno;
-	clock_t ret;
-
-	/**
-	 * times(2) really returns an unsigned value ...
-	 *
-	 * We don't check to see if we got back the error value (-1), because
-	 * the only possibility for an error would be if the address of
-	 * dummy_tms_struct was invalid.  Since it's a
-	 * compiler-generated address, we assume that errors are impossible.
-	 * And, unfortunately, it is quite possible for the correct return
-	 * from times(2) to be exactly (clock_t)-1.  Sigh...
-	 *
-	 */
-	errno = 0;
-	ret = times(&dummy_tms_struct);
-
-	/**
-	 * This is to work around a bug in the system call interface
-	 * for times(2) found in glibc on Linux (and maybe elsewhere)
-	 * It changes the return values from -1 to -4096 all into
-	 * -1 and then dumps the -(return value) into errno.
-	 *
-	 * This totally bizarre behavior seems to be widespread in
-	 * versions of Linux and glibc.
-	 *
-	 * Many thanks to Wolfgang Dumhs <wolfgang.dumhs (at) gmx.at>
-	 * for finding and documenting this bizarre behavior.
-	 */
-	if (errno != 0) {
-		ret = (clock_t) (-errno);
-	}
-
-	errno = save_errno;
-	return ret;
+	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
+	int i;
+
+	core_priv->cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (core_priv->cpu_count < 1) {
+		core_priv->cpu_count = 1;
+	}
+
+	/* one reactor per cpu by default */
+	core_priv->reactor_count = conf->reactors;
+	if (core_priv->reactor_count < 1) {
+		core_priv->reactor_count = core_priv->cpu_count;
+	}
+
+	core_priv->control_loop = my_loop_create(core, -1, conf->poller);
+	if (!core_priv->control_loop) {
+		goto _MY_ERR_create_control_loop;
+	}
+
+	core_priv->reactors = my_mem_alloc(core_priv->reactor_count * sizeof(my_loop_t *));
+	if (!core_priv->reactors) {
+		MY_ERROR("core: error creating reactor pool (%s)" , strerror(errno));
+		goto _MY_ERR_alloc_reactors;
+	}
+
+	for (i = 0; i < core_priv->reactor_count; i++) {
+		core_priv->reactors[i] = my_loop_create(core, i, conf->poller);
+		if (!core_priv->reactors[i]) {
+			goto _MY_ERR_create_reactors;
+		}
+	}
+
+	MY_DEBUG("core: using %d reactor(s) on %d cpu(s)", core_priv->reactor_count, core_priv->cpu_count);
+
+	return 0;
+
+_MY_ERR_create_reactors:
+	while (i-- > 0) {
+		my_loop_destroy(core_priv->reactors[i]);
+	}
+	my_mem_free(core_priv->reactors);
+	core_priv->reactors = NULL;
+_MY_ERR_alloc_reactors:
+	my_loop_destroy(core_priv->control_loop);
+	core_priv->control_loop = NULL;
+_MY_ERR_create_control_loop:
+	return -1;
 }
 
-static uint64_t my_core_get_time_msec(my_core_t *core)
+static void my_core_loops_destroy(my_core_t *core)
 {
 	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
+	int i;
 
-	return (my_core_times_wrapper() * 1000) / core_priv->system_tick;
+	if (core_priv->reactors) {
+		for (i = 0; i < core_priv->reactor_count; i++) {
+			my_loop_destroy(core_priv->reactors[i]);
+		}
+		my_mem_free(core_priv->reactors);
+		core_priv->reactors = NULL;
+	}
+
+	if (core_priv->control_loop) {
+		my_loop_destroy(core_priv->control_loop);
+		core_priv->control_loop = NULL;
+	}
+}
+
+my_loop_t *my_core_get_control_loop(my_core_t *core)
+{
+	return MY_CORE_PRIV(core)->control_loop;
+}
+
+int my_core_get_reactor_count(my_core_t *core)
+{
+	return MY_CORE_PRIV(core)->reactor_count;
+}
+
+my_loop_t *my_core_get_reactor(my_core_t *core, int index)
+{
+	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
+
+	if (index < 0) {
+		index = 0;
+	}
+
+	return core_priv->reactors[index % core_priv->reactor_count];
 }
 
 my_core_t *my_core_create(void)
@@ -187,26 +234,11 @@ my_core_t *my_core_create(void)
 	}
 
 	core_priv = MY_CORE_PRIV(core);
-
-	core_priv->watched_fd_list = my_list_create();
-	if (!core_priv->watched_fd_list) {
-		MY_ERROR("core: error creating watched fd list (%s)" , strerror(errno));
-		goto _MY_ERR_create_watched_fds;
-	}
-
-	core_priv->alarm_list = my_list_create();
-	if (!core_priv->alarm_list) {
-		MY_ERROR("core: error creating alarm list (%s)" , strerror(errno));
-		goto _MY_ERR_create_alarm_list;
-	}
-
-	FD_ZERO(&core_priv->watching_fds);
-	core_priv->max_sock = 0;
-	core_priv->system_tick = sysconf(_SC_CLK_TCK);
-	core_priv->curr_time = my_core_get_time_msec(core);
+	core_priv->clock_id = CLOCK_MONOTONIC;
 
 	my_audio_codec_init();
 
+	my_poller_register_all();
 	my_control_register_all();
 	my_filter_register_all();
 	my_source_register_all();
@@ -215,10 +247,6 @@ my_core_t *my_core_create(void)
 
 	return core;
 
-	my_list_destroy(core_priv->alarm_list);
-_MY_ERR_create_alarm_list:
-	my_list_destroy(core_priv->watched_fd_list);
-_MY_ERR_create_watched_fds:
 	my_list_destroy(core->wirings);
 _MY_ERR_create_wirings:
 	my_list_destroy(core->targets);
@@ -240,6 +268,10 @@ void my_core_destroy(my_core_t *core)
 
 	my_audio_codec_fini();
 
+	if (core_priv->graph) {
+		my_graph_destroy(core_priv->graph);
+	}
+
 	my_target_close_all(core);
 	my_source_close_all(core);
 	my_control_close_all(core);
@@ -256,14 +288,23 @@ void my_core_destroy(my_core_t *core)
 	my_list_destroy(core->targets);
 	my_list_destroy(core->wirings);
 
-	my_list_destroy(core_priv->watched_fd_list);
-	my_list_purge(core_priv->alarm_list, MY_LIST_PURGE_FLAG_FREE_DATA);
-	my_list_destroy(core_priv->alarm_list);
+	my_core_loops_destroy(core);
+
 	my_mem_free(core);
 }
 
 int my_core_init(my_core_t *core, my_conf_t *conf)
 {
+	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
+
+	if (my_core_clock_set(core, conf->clock) != 0) {
+		goto _MY_ERR_set_clock;
+	}
+
+	if (my_core_loops_create(core, conf) != 0) {
+		goto _MY_ERR_create_loops;
+	}
+
 	if (my_control_create_all(core, conf) != 0) {
 		goto _MY_ERR_create_controls;
 	}
@@ -284,6 +325,16 @@ int my_core_init(my_core_t *core, my_conf_t *conf)
 		goto _MY_ERR_create_wirings;
 	}
 
+	if (conf->scheduler && (strcmp(conf->scheduler, "pull") == 0)) {
+		core_priv->graph = my_graph_create(core);
+		if (!core_priv->graph) {
+			goto _MY_ERR_create_graph;
+		}
+	} else if (conf->scheduler && (strcmp(conf->scheduler, "push") != 0)) {
+		my_log(MY_LOG_ERROR, "core: unknown scheduler '%s'", conf->scheduler);
+		goto _MY_ERR_create_graph;
+	}
+
 	if (my_control_open_all(core) != 0) {
 		goto _MY_ERR_open_controls;
 	}
@@ -296,14 +347,24 @@ int my_core_init(my_core_t *core, my_conf_t *conf)
 		goto _MY_ERR_open_targets;
 	}
 
+	if (core_priv->graph && (my_graph_start(core_priv->graph) != 0)) {
+		goto _MY_ERR_start_graph;
+	}
+
 	return 0;
 
+_MY_ERR_start_graph:
 	my_target_close_all(core);
 _MY_ERR_open_targets:
 	my_source_close_all(core);
 _MY_ERR_open_sources:
 	my_control_close_all(core);
 _MY_ERR_open_controls:
+	if (core_priv->graph) {
+		my_graph_destroy(core_priv->graph);
+		core_priv->graph = NULL;
+	}
+_MY_ERR_create_graph:
 	my_wiring_destroy_all(core);
 _MY_ERR_create_wirings:
 	my_target_destroy_all(core);
@@ -314,200 +375,101 @@ _MY_ERR_create_sources:
 _MY_ERR_create_filters:
 	my_control_destroy_all(core);
 _MY_ERR_create_controls:
+	my_core_loops_destroy(core);
+_MY_ERR_create_loops:
+_MY_ERR_set_clock:
 	return -1;
 }
 
-static void my_core_alarm_add_at_pos(my_core_t *core, struct alarm_entry *alarm_entry)
+void my_core_loop(my_core_t *core)
 {
 	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct alarm_entry *alarm_entry_tmp;
-	my_node_t *node;
+	int i, n;
 
-	my_list_for_each(core_priv->alarm_list, node, alarm_entry_tmp) {
+	for (n = 0; n < core_priv->reactor_count; n++) {
+		if (my_loop_start(core_priv->reactors[n], n % core_priv->cpu_count) != 0) {
+			my_core_exit(core);
+			break;
+		}
+	}
 
-		if ((int64_t)(alarm_entry_tmp->alarm_time - alarm_entry->alarm_time) > 0)
-			continue;
+	/* controls are handled from the main thread */
+	my_loop_run(core_priv->control_loop);
 
-		my_list_insert_before(core_priv->alarm_list, node, alarm_entry);
-		return;
+	for (i = 0; i < n; i++) {
+		my_loop_stop(core_priv->reactors[i]);
+	}
+	for (i = 0; i < n; i++) {
+		my_loop_join(core_priv->reactors[i]);
 	}
-
-	my_list_enqueue(core_priv->alarm_list, alarm_entry);
 }
 
-static void my_core_alarm_list_add_reoccurring(my_core_t *core, struct alarm_entry *alarm_entry)
+void my_core_stop(my_core_t *core)
 {
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-
-	alarm_entry->alarm_time = core_priv->curr_time + alarm_entry->reoccurring;
-	my_core_alarm_add_at_pos(core, alarm_entry);
+	my_core_exit(core);
 }
 
-int my_core_alarm_add(my_core_t *core, unsigned int timeout,
-		      int reoccurring, my_alarm_handler_t handler, void *p)
+my_alarm_t *my_core_alarm_add(my_core_t *core, uint64_t timeout,
+			      int reoccurring, my_alarm_handler_t handler, void *p)
 {
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct alarm_entry *alarm_entry;
-
-	alarm_entry = my_mem_alloc(sizeof(struct alarm_entry));
-	if (!alarm_entry) {
-		my_log(MY_LOG_ERROR, "core: error creating alarm entry (%s)" , strerror(errno));
-		goto err;
-	}
-
-	alarm_entry->alarm_time = my_core_get_time_msec(core) + timeout;
-	alarm_entry->callback_fn = handler;
-	alarm_entry->data = p;
-
-	if (reoccurring)
-		alarm_entry->reoccurring = timeout;
-	else
-		alarm_entry->reoccurring = 0;
-
-	my_core_alarm_add_at_pos(core, alarm_entry);
-
-out:
-	return 0;
-
-err:
-	return -1;
+	return my_loop_alarm_add(MY_CORE_PRIV(core)->control_loop, timeout, reoccurring, handler, p);
 }
 
-static void my_core_alarm_list_maintain(my_core_t *core)
+int my_core_alarm_del(my_core_t *core, my_alarm_t *alarm_entry)
 {
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct alarm_entry *alarm_entry;
-	my_node_t *node;
-
-	my_list_for_each(core_priv->alarm_list, node, alarm_entry) {
-
-		if ((int)(alarm_entry->alarm_time - core_priv->curr_time) > 0)
-			break;
-
-		(alarm_entry->callback_fn)(alarm_entry->data);
-
-		my_list_remove(core_priv->alarm_list, node);
-
-		if (alarm_entry->reoccurring)
-			my_core_alarm_list_add_reoccurring(core, alarm_entry);
-		else
-			my_mem_free(alarm_entry);
-	}
+	return my_loop_alarm_del(MY_CORE_PRIV(core)->control_loop, alarm_entry);
 }
 
-void my_core_loop(my_core_t *core)
+int my_core_event_handler_add(my_core_t *core, int fd, int events, my_event_handler_t handler, void *p)
 {
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	my_node_t *node;
-	struct watch_entry *watch_entry;
-	fd_set tmp_watched_fds;
-	struct timeval tv;
-	int ret;
-
-	core_priv->running = 1;
-	tv.tv_sec = 0;
-	tv.tv_usec = EVENT_LIST_RESOLUTION;
-
-	while (core_priv->running) {
-
-		memcpy(&tmp_watched_fds, &core_priv->watching_fds, sizeof(fd_set));
-
-		ret = select(core_priv->max_sock + 1, &tmp_watched_fds, NULL, NULL, &tv);
-
-		core_priv->curr_time = my_core_get_time_msec(core);
-		my_core_alarm_list_maintain(core);
-
-		if (ret < 0) {
-			if (errno != EINTR)
-				my_log(MY_LOG_ERROR, "core: select error '%s'", strerror(errno));
-		}
-
-		if (ret <= 0)
-			goto reset_sleep;
-
-		my_list_for_each(core_priv->watched_fd_list, node, watch_entry) {
-
-			if (!FD_ISSET(watch_entry->fd, &tmp_watched_fds))
-				continue;
-
-			(watch_entry->callback_fn)(watch_entry->fd, watch_entry->data);
-		}
-
-		continue;
-
-reset_sleep:
-		tv.tv_sec = 0;
-		tv.tv_usec = EVENT_LIST_RESOLUTION;
-	}
+	return my_loop_event_handler_add(MY_CORE_PRIV(core)->control_loop, fd, events, handler, p);
 }
 
-void my_core_stop(my_core_t *core)
+int my_core_event_handler_mod(my_core_t *core, int fd, int events)
 {
-	MY_CORE_PRIV(core)->running = 0;
+	return my_loop_event_handler_mod(MY_CORE_PRIV(core)->control_loop, fd, events);
 }
 
-int my_core_event_handler_add(my_core_t *core, int fd, my_event_handler_t handler, void *p)
+int my_core_event_handler_del(my_core_t *core, int fd)
 {
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct watch_entry *watch_entry;
-	my_node_t *node;
-
-	my_list_for_each(core_priv->watched_fd_list, node, watch_entry) {
+	return my_loop_event_handler_del(MY_CORE_PRIV(core)->control_loop, fd);
+}
 
-		if (watch_entry->fd != fd)
-			continue;
+static char my_proto[] = "UMMD/" VERSION;
 
-		my_log(MY_LOG_ERROR, "core: trying to register an already watched fd: '%i'", fd);
-		goto err;
+static int my_core_handle_set(my_core_t *core, char *args)
+{
+	char *port_name, *name, *value, *save;
+	my_port_t *port;
+
+	port_name = strtok_r(args, " ", &save);
+	name = strtok_r(NULL, " ", &save);
+	value = strtok_r(NULL, "", &save);
+	if (!port_name || !name || !value) {
+		my_log(MY_LOG_ERROR, "core: malformed 'SET' command");
+		return -1;
 	}
 
-	watch_entry = my_mem_alloc(sizeof(struct watch_entry));
-	if (!watch_entry) {
-		my_log(MY_LOG_ERROR, "core: error creating event handler (%s)" , strerror(errno));
-		goto err;
+	port = my_port_lookup_by_name(core->filters, port_name);
+	if (!port) {
+		port = my_port_lookup_by_name(core->sources, port_name);
 	}
-
-	watch_entry->fd = fd;
-	watch_entry->callback_fn = handler;
-	watch_entry->data = p;
-
-	my_list_enqueue(core_priv->watched_fd_list, watch_entry);
-	my_core_watched_fds_update(core);
-	return 0;
-
-err:
-	return -1;
-}
-
-int my_core_event_handler_del(my_core_t *core, int fd)
-{
-	my_core_priv_t *core_priv = MY_CORE_PRIV(core);
-	struct watch_entry *watch_entry;
-	my_node_t *node;
-
-	my_list_for_each(core_priv->watched_fd_list, node, watch_entry) {
-		if (watch_entry->fd == fd)
-			break;
-
-		watch_entry = NULL;
+	if (!port) {
+		port = my_port_lookup_by_name(core->targets, port_name);
+	}
+	if (!port) {
+		my_log(MY_LOG_ERROR, "core: unknown port '%s'", port_name);
+		return -1;
 	}
 
-	if (!watch_entry) {
-		my_log(MY_LOG_ERROR, "core: error unregistering fd: unknown fd (%i)" , fd);
-		goto err;
+	if (my_port_set(port, name, value) != 0) {
+		my_log(MY_LOG_ERROR, "core/%s: error setting '%s' to '%s' (%s)", port_name, name, value, strerror(errno));
+		return -1;
 	}
 
-	my_list_remove(core_priv->watched_fd_list, node);
-	my_mem_free(watch_entry);
-	my_core_watched_fds_update(core);
 	return 0;
-
-err:
-	return -1;
 }
 
-static char my_proto[] = "UMMD/" VERSION;
-
 int my_core_handle_command(my_core_t *core, void *buf, int len)
 {
 	char *p = buf;
@@ -523,6 +485,9 @@ int my_core_handle_command(my_core_t *core, void *buf, int len)
 	if (strcmp(p, "QUIT") == 0) {
 		MY_DEBUG("core: received '%s' command", p);
 		my_core_exit(core);
+	} else if (strncmp(p, "SET ", 4) == 0) {
+		MY_DEBUG("core: received '%s' command", p);
+		my_core_handle_set(core, p + 4);
 	} else {
 		my_log(MY_LOG_ERROR, "core: unknown command '%s'", p);
 	}
@@ -532,6 +497,7 @@ int my_core_handle_command(my_core_t *core, void *buf, int len)
 
 void my_core_dump(my_core_t *core)
 {
+	my_poller_dump_all();
 	my_control_dump_all();
 	my_filter_dump_all();
 	my_source_dump_all();
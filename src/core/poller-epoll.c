@@ -0,0 +1,265 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "core/poller.h"
+
+#include "util/log.h"
+#include "util/mem.h"
+
+#define MY_POLLER_EPOLL_EVENTS 64
+
+/*
+ * epoll refuses fds it can't poll (EPERM), like regular files, which are
+ * always ready for whatever they are watched for. Those are kept apart and
+ * reported ready at each wait, as select() would.
+ */
+typedef struct my_poller_epoll_always_s my_poller_epoll_always_t;
+
+struct my_poller_epoll_always_s {
+	int fd;
+	int events;
+	void *data;
+};
+
+typedef struct my_poller_epoll_priv_s my_poller_epoll_priv_t;
+
+struct my_poller_epoll_priv_s {
+	my_poller_t _inherited;
+	int fd;
+	struct epoll_event events[MY_POLLER_EPOLL_EVENTS];
+	my_poller_epoll_always_t *always;
+	int always_count;
+	int always_size;
+};
+
+#define MY_POLLER_EPOLL(p) ((my_poller_epoll_priv_t *)(p))
+
+static my_poller_t *my_poller_epoll_create(void)
+{
+	my_poller_t *poller;
+
+	poller = my_mem_alloc(sizeof(my_poller_epoll_priv_t));
+	if (!poller) {
+		goto _MY_ERR_alloc;
+	}
+
+	MY_POLLER_EPOLL(poller)->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (MY_POLLER_EPOLL(poller)->fd == -1) {
+		goto _MY_ERR_epoll_create;
+	}
+
+	return poller;
+
+	close(MY_POLLER_EPOLL(poller)->fd);
+_MY_ERR_epoll_create:
+	my_mem_free(poller);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_poller_epoll_destroy(my_poller_t *poller)
+{
+	close(MY_POLLER_EPOLL(poller)->fd);
+	my_mem_free(MY_POLLER_EPOLL(poller)->always);
+	my_mem_free(poller);
+}
+
+static my_poller_epoll_always_t *my_poller_epoll_always_find(my_poller_epoll_priv_t *priv, int fd)
+{
+	int i;
+
+	for (i = 0; i < priv->always_count; i++) {
+		if (priv->always[i].fd == fd) {
+			return &priv->always[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int my_poller_epoll_always_add(my_poller_epoll_priv_t *priv, int fd, int events, void *data)
+{
+	my_poller_epoll_always_t *always;
+	int size;
+
+	if (priv->always_count == priv->always_size) {
+		size = priv->always_size ? 2 * priv->always_size : 4;
+		always = my_mem_alloc(size * sizeof(my_poller_epoll_always_t));
+		if (!always) {
+			return -1;
+		}
+		if (priv->always_count) {
+			my_mem_copy(always, priv->always, priv->always_count * sizeof(my_poller_epoll_always_t));
+		}
+		my_mem_free(priv->always);
+		priv->always = always;
+		priv->always_size = size;
+	}
+
+	always = &priv->always[priv->always_count++];
+	always->fd = fd;
+	always->events = events;
+	always->data = data;
+
+	return 0;
+}
+
+static int my_poller_epoll_ctl(my_poller_t *poller, int op, int fd, int events, void *data)
+{
+	struct epoll_event ev;
+
+	ev.events = 0;
+	if (events & MY_EVENT_READ) {
+		ev.events |= EPOLLIN;
+	}
+	if (events & MY_EVENT_WRITE) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.ptr = data;
+
+	return epoll_ctl(MY_POLLER_EPOLL(poller)->fd, op, fd, &ev);
+}
+
+static int my_poller_epoll_add(my_poller_t *poller, int fd, int events, void *data)
+{
+	int ret;
+
+	ret = my_poller_epoll_ctl(poller, EPOLL_CTL_ADD, fd, events, data);
+	if ((ret != 0) && (errno == EPERM)) {
+		MY_DEBUG("core/poller: fd '%i' can't be polled, always ready", fd);
+		ret = my_poller_epoll_always_add(MY_POLLER_EPOLL(poller), fd, events, data);
+	}
+
+	return ret;
+}
+
+static int my_poller_epoll_mod(my_poller_t *poller, int fd, int events, void *data)
+{
+	my_poller_epoll_always_t *always;
+
+	always = my_poller_epoll_always_find(MY_POLLER_EPOLL(poller), fd);
+	if (always) {
+		always->events = events;
+		always->data = data;
+		return 0;
+	}
+
+	return my_poller_epoll_ctl(poller, EPOLL_CTL_MOD, fd, events, data);
+}
+
+static int my_poller_epoll_del(my_poller_t *poller, int fd, void *data)
+{
+	my_poller_epoll_priv_t *priv = MY_POLLER_EPOLL(poller);
+	my_poller_epoll_always_t *always;
+	struct epoll_event ev;
+
+	always = my_poller_epoll_always_find(priv, fd);
+	if (always) {
+		*always = priv->always[--priv->always_count];
+		return 0;
+	}
+
+	return epoll_ctl(priv->fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+static int my_poller_epoll_wait(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout)
+{
+	my_poller_epoll_priv_t *priv = MY_POLLER_EPOLL(poller);
+#ifdef HAVE_EPOLL_PWAIT2
+	struct timespec ts;
+#else
+	int64_t msec;
+#endif
+	int i, n, always;
+
+	if (max > MY_POLLER_EPOLL_EVENTS) {
+		max = MY_POLLER_EPOLL_EVENTS;
+	}
+
+	/* fds always ready for what they are watched for, don't block */
+	for (i = 0, always = 0; (i < priv->always_count) && (always < max); i++) {
+		if (priv->always[i].events) {
+			ready[always].data = priv->always[i].data;
+			ready[always].events = priv->always[i].events;
+			always++;
+		}
+	}
+	if (always) {
+		timeout = 0;
+		ready += always;
+		max -= always;
+	}
+
+	if (max == 0) {
+		return always;
+	}
+
+#ifdef HAVE_EPOLL_PWAIT2
+	ts.tv_sec = timeout / 1000000000LL;
+	ts.tv_nsec = timeout % 1000000000LL;
+	n = epoll_pwait2(priv->fd, priv->events, max, timeout < 0 ? NULL : &ts, NULL);
+	if (n < 0 && errno == ENOSYS) {
+		/* built against a newer kernel than the one running */
+		n = epoll_wait(priv->fd, priv->events, max, timeout < 0 ? -1 : (timeout + 999999) / 1000000);
+	}
+#else
+	/* rounded up, waking up early would only mean spinning */
+	msec = timeout < 0 ? -1 : (timeout + 999999) / 1000000;
+	n = epoll_wait(priv->fd, priv->events, max, msec > INT_MAX ? INT_MAX : (int)msec);
+#endif
+	if (n < 0) {
+		/* the always ready ones still are */
+		return always ? always : n;
+	}
+
+	for (i = 0; i < n; i++) {
+		ready[i].data = priv->events[i].data.ptr;
+		ready[i].events = 0;
+		if (priv->events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			ready[i].events |= MY_EVENT_READ;
+		}
+		if (priv->events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+			ready[i].events |= MY_EVENT_WRITE;
+		}
+	}
+
+	return always + n;
+}
+
+my_poller_impl_t my_poller_epoll = {
+	.name = "epoll",
+	.desc = "Linux epoll(7) based poller",
+	.create = my_poller_epoll_create,
+	.destroy = my_poller_epoll_destroy,
+	.add = my_poller_epoll_add,
+	.mod = my_poller_epoll_mod,
+	.del = my_poller_epoll_del,
+	.wait = my_poller_epoll_wait,
+};
@@ -0,0 +1,179 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+#include "core/poller.h"
+
+#include "util/log.h"
+#include "util/mem.h"
+
+typedef struct my_poller_select_priv_s my_poller_select_priv_t;
+
+struct my_poller_select_priv_s {
+	my_poller_t _inherited;
+	fd_set rfds;
+	fd_set wfds;
+	int max_fd;
+	void *data[FD_SETSIZE];
+};
+
+#define MY_POLLER_SELECT(p) ((my_poller_select_priv_t *)(p))
+
+static my_poller_t *my_poller_select_create(void)
+{
+	my_poller_t *poller;
+
+	poller = my_mem_alloc(sizeof(my_poller_select_priv_t));
+	if (!poller) {
+		goto _MY_ERR_alloc;
+	}
+
+	FD_ZERO(&MY_POLLER_SELECT(poller)->rfds);
+	FD_ZERO(&MY_POLLER_SELECT(poller)->wfds);
+	MY_POLLER_SELECT(poller)->max_fd = -1;
+
+	return poller;
+
+	my_mem_free(poller);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_poller_select_destroy(my_poller_t *poller)
+{
+	my_mem_free(poller);
+}
+
+static int my_poller_select_mod(my_poller_t *poller, int fd, int events, void *data)
+{
+	my_poller_select_priv_t *priv = MY_POLLER_SELECT(poller);
+
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (events & MY_EVENT_READ) {
+		FD_SET(fd, &priv->rfds);
+	} else {
+		FD_CLR(fd, &priv->rfds);
+	}
+
+	if (events & MY_EVENT_WRITE) {
+		FD_SET(fd, &priv->wfds);
+	} else {
+		FD_CLR(fd, &priv->wfds);
+	}
+
+	return 0;
+}
+
+static int my_poller_select_add(my_poller_t *poller, int fd, int events, void *data)
+{
+	my_poller_select_priv_t *priv = MY_POLLER_SELECT(poller);
+
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		my_log(MY_LOG_ERROR, "core/poller: fd %d out of select() range (0-%d)", fd, FD_SETSIZE - 1);
+		errno = EINVAL;
+		return -1;
+	}
+
+	my_poller_select_mod(poller, fd, events, data);
+	priv->data[fd] = data;
+	if (fd > priv->max_fd) {
+		priv->max_fd = fd;
+	}
+
+	return 0;
+}
+
+static int my_poller_select_del(my_poller_t *poller, int fd, void *data)
+{
+	my_poller_select_priv_t *priv = MY_POLLER_SELECT(poller);
+
+	if (my_poller_select_mod(poller, fd, 0, data) != 0) {
+		return -1;
+	}
+
+	priv->data[fd] = NULL;
+	while (priv->max_fd >= 0 && !priv->data[priv->max_fd]) {
+		priv->max_fd--;
+	}
+
+	return 0;
+}
+
+static int my_poller_select_wait(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout)
+{
+	my_poller_select_priv_t *priv = MY_POLLER_SELECT(poller);
+	fd_set rfds, wfds;
+	struct timeval tv;
+	int64_t usec;
+	int fd, n, rc;
+	int events;
+
+	memcpy(&rfds, &priv->rfds, sizeof(fd_set));
+	memcpy(&wfds, &priv->wfds, sizeof(fd_set));
+	/* rounded up, waking up early would only mean spinning */
+	usec = (timeout + 999) / 1000;
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+
+	rc = select(priv->max_fd + 1, &rfds, &wfds, NULL, timeout < 0 ? NULL : &tv);
+	if (rc <= 0) {
+		return rc;
+	}
+
+	n = 0;
+	for (fd = 0; fd <= priv->max_fd && n < max; fd++) {
+		events = 0;
+		if (FD_ISSET(fd, &rfds)) {
+			events |= MY_EVENT_READ;
+		}
+		if (FD_ISSET(fd, &wfds)) {
+			events |= MY_EVENT_WRITE;
+		}
+		if (!events) {
+			continue;
+		}
+		ready[n].data = priv->data[fd];
+		ready[n].events = events;
+		n++;
+	}
+
+	return n;
+}
+
+my_poller_impl_t my_poller_select = {
+	.name = "select",
+	.desc = "select(2) based poller",
+	.create = my_poller_select_create,
+	.destroy = my_poller_select_destroy,
+	.add = my_poller_select_add,
+	.mod = my_poller_select_mod,
+	.del = my_poller_select_del,
+	.wait = my_poller_select_wait,
+};
@@ -0,0 +1,620 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "core/poller.h"
+
+#include "util/list.h"
+#include "util/log.h"
+#include "util/mem.h"
+
+/*
+ * io_uring based poller, driven through the raw system calls so that no
+ * extra library is needed. Polls are one-shot and re-armed at the start of
+ * the next wait, which keeps level-triggered semantics: every registration,
+ * re-arm and removal queued during a loop round is submitted together with
+ * the wait itself, in a single io_uring_enter(2) call.
+ *
+ * Reads & writes submitted by ports go along the same way, their
+ * completions being reaped by that call too, so that a loop round moving
+ * data between any number of fds costs a single system call. Those have
+ * the lowest bit of their user data set, polls never do.
+ */
+
+#define MY_POLLER_URING_ENTRIES 256
+#define MY_POLLER_URING_EVENTS 64
+#define MY_POLLER_URING_TABLE_SIZE 64
+
+typedef struct my_poller_uring_priv_s my_poller_uring_priv_t;
+typedef struct my_poller_uring_entry_s my_poller_uring_entry_t;
+
+/*
+ * An entry is either armed (its poll is in flight), queued for re-arming,
+ * or idle (no interest). Entries are only freed once no poll refers to them,
+ * live ones being indexed by fd, dead ones only linked until then.
+ */
+struct my_poller_uring_entry_s {
+	my_link_t link;
+	int fd;
+	int events;
+	void *data;
+	int armed;
+	int queued;
+	int dead;
+};
+
+struct my_poller_uring_priv_s {
+	my_poller_t _inherited;
+	int fd;
+	unsigned int to_submit;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	my_link_t entries;
+	my_poller_uring_entry_t **table;
+	int table_size;
+	my_poller_uring_entry_t *rearm[MY_POLLER_URING_EVENTS];
+	int rearm_count;
+};
+
+#define MY_POLLER_URING(p) ((my_poller_uring_priv_t *)(p))
+
+#define MY_POLLER_URING_IO_TAG 1
+
+static int my_poller_uring_enter(my_poller_uring_priv_t *priv, unsigned int min_complete, int64_t timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	int rc;
+
+	if (min_complete) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	if (min_complete && timeout >= 0) {
+		ts.tv_sec = timeout / 1000000000LL;
+		ts.tv_nsec = timeout % 1000000000LL;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+
+	rc = syscall(__NR_io_uring_enter, priv->fd, priv->to_submit, min_complete,
+		     flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (rc >= 0) {
+		priv->to_submit -= rc < (int)priv->to_submit ? rc : priv->to_submit;
+	}
+
+	return rc;
+}
+
+static struct io_uring_sqe *my_poller_uring_get_sqe(my_poller_uring_priv_t *priv)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	head = __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE);
+	tail = *priv->sq_tail;
+	if (tail - head > *priv->sq_mask) {
+		/* submission queue full, flush it without waiting */
+		if (my_poller_uring_enter(priv, 0, 0) < 0) {
+			return NULL;
+		}
+		head = __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head > *priv->sq_mask) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	idx = tail & *priv->sq_mask;
+	sqe = &priv->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	priv->sq_array[idx] = idx;
+
+	return sqe;
+}
+
+static void my_poller_uring_commit_sqe(my_poller_uring_priv_t *priv)
+{
+	__atomic_store_n(priv->sq_tail, *priv->sq_tail + 1, __ATOMIC_RELEASE);
+	priv->to_submit++;
+}
+
+static int my_poller_uring_arm(my_poller_uring_priv_t *priv, my_poller_uring_entry_t *entry)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = my_poller_uring_get_sqe(priv);
+	if (!sqe) {
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = entry->fd;
+	if (entry->events & MY_EVENT_READ) {
+		sqe->poll32_events |= POLLIN;
+	}
+	if (entry->events & MY_EVENT_WRITE) {
+		sqe->poll32_events |= POLLOUT;
+	}
+	sqe->user_data = (uint64_t)(uintptr_t)entry;
+	my_poller_uring_commit_sqe(priv);
+
+	entry->armed = 1;
+
+	return 0;
+}
+
+static int my_poller_uring_disarm(my_poller_uring_priv_t *priv, my_poller_uring_entry_t *entry)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = my_poller_uring_get_sqe(priv);
+	if (!sqe) {
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)entry;
+	sqe->user_data = 0;
+	my_poller_uring_commit_sqe(priv);
+
+	return 0;
+}
+
+static void my_poller_uring_entry_free(my_poller_uring_priv_t *priv, my_poller_uring_entry_t *entry)
+{
+	my_ilist_remove(&entry->link);
+	my_mem_free(entry);
+}
+
+static int my_poller_uring_table_grow(my_poller_uring_priv_t *priv, int fd)
+{
+	my_poller_uring_entry_t **table;
+	int size;
+
+	size = priv->table_size ? priv->table_size : MY_POLLER_URING_TABLE_SIZE;
+	while (size <= fd) {
+		size *= 2;
+	}
+
+	table = my_mem_alloc(size * sizeof(my_poller_uring_entry_t *));
+	if (!table) {
+		return -1;
+	}
+
+	if (priv->table) {
+		my_mem_copy(table, priv->table, priv->table_size * sizeof(my_poller_uring_entry_t *));
+		my_mem_free(priv->table);
+	}
+
+	priv->table = table;
+	priv->table_size = size;
+
+	return 0;
+}
+
+static my_poller_t *my_poller_uring_create(void)
+{
+	my_poller_t *poller;
+	my_poller_uring_priv_t *priv;
+	struct io_uring_params params;
+	uint8_t *p;
+
+	poller = my_mem_alloc(sizeof(my_poller_uring_priv_t));
+	if (!poller) {
+		goto _MY_ERR_alloc;
+	}
+	priv = MY_POLLER_URING(poller);
+
+	memset(&params, 0, sizeof(params));
+	priv->fd = syscall(__NR_io_uring_setup, MY_POLLER_URING_ENTRIES, &params);
+	if (priv->fd < 0) {
+		goto _MY_ERR_setup;
+	}
+
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		/* no way to wait with a timeout, let the caller fall back */
+		errno = ENOSYS;
+		goto _MY_ERR_features;
+	}
+
+	priv->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	priv->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (priv->cq_ring_size > priv->sq_ring_size) {
+			priv->sq_ring_size = priv->cq_ring_size;
+		}
+		priv->cq_ring_size = priv->sq_ring_size;
+	}
+
+	priv->sq_ring = mmap(NULL, priv->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_SQ_RING);
+	if (priv->sq_ring == MAP_FAILED) {
+		goto _MY_ERR_mmap_sq_ring;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		priv->cq_ring = priv->sq_ring;
+	} else {
+		priv->cq_ring = mmap(NULL, priv->cq_ring_size, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_CQ_RING);
+		if (priv->cq_ring == MAP_FAILED) {
+			goto _MY_ERR_mmap_cq_ring;
+		}
+	}
+
+	priv->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	priv->sqes = mmap(NULL, priv->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_SQES);
+	if (priv->sqes == MAP_FAILED) {
+		goto _MY_ERR_mmap_sqes;
+	}
+
+	p = priv->sq_ring;
+	priv->sq_head = (unsigned int *)(p + params.sq_off.head);
+	priv->sq_tail = (unsigned int *)(p + params.sq_off.tail);
+	priv->sq_mask = (unsigned int *)(p + params.sq_off.ring_mask);
+	priv->sq_array = (unsigned int *)(p + params.sq_off.array);
+
+	p = priv->cq_ring;
+	priv->cq_head = (unsigned int *)(p + params.cq_off.head);
+	priv->cq_tail = (unsigned int *)(p + params.cq_off.tail);
+	priv->cq_mask = (unsigned int *)(p + params.cq_off.ring_mask);
+	priv->cqes = (struct io_uring_cqe *)(p + params.cq_off.cqes);
+
+	my_ilist_init(&priv->entries);
+
+	return poller;
+
+	munmap(priv->sqes, priv->sqes_size);
+_MY_ERR_mmap_sqes:
+	if (priv->cq_ring != priv->sq_ring) {
+		munmap(priv->cq_ring, priv->cq_ring_size);
+	}
+_MY_ERR_mmap_cq_ring:
+	munmap(priv->sq_ring, priv->sq_ring_size);
+_MY_ERR_mmap_sq_ring:
+_MY_ERR_features:
+	close(priv->fd);
+_MY_ERR_setup:
+	my_mem_free(poller);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+static void my_poller_uring_destroy(my_poller_t *poller)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	my_link_t *link, *next;
+
+	/* closing the ring cancels whatever is still in flight */
+	munmap(priv->sqes, priv->sqes_size);
+	if (priv->cq_ring != priv->sq_ring) {
+		munmap(priv->cq_ring, priv->cq_ring_size);
+	}
+	munmap(priv->sq_ring, priv->sq_ring_size);
+	close(priv->fd);
+
+	my_ilist_for_each_safe(&priv->entries, link, next) {
+		my_poller_uring_entry_free(priv, my_link_entry(link, my_poller_uring_entry_t, link));
+	}
+	my_mem_free(priv->table);
+	my_mem_free(poller);
+}
+
+static int my_poller_uring_add(my_poller_t *poller, int fd, int events, void *data)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	my_poller_uring_entry_t *entry;
+
+	if ((fd >= priv->table_size) && (my_poller_uring_table_grow(priv, fd) != 0)) {
+		goto _MY_ERR_table_grow;
+	}
+
+	entry = my_mem_alloc(sizeof(*entry));
+	if (!entry) {
+		goto _MY_ERR_alloc;
+	}
+
+	entry->fd = fd;
+	entry->events = events;
+	entry->data = data;
+
+	if (events && my_poller_uring_arm(priv, entry) != 0) {
+		goto _MY_ERR_arm;
+	}
+
+	my_ilist_add_tail(&priv->entries, &entry->link);
+	priv->table[fd] = entry;
+
+	return 0;
+
+_MY_ERR_arm:
+	my_mem_free(entry);
+_MY_ERR_alloc:
+_MY_ERR_table_grow:
+	return -1;
+}
+
+static my_poller_uring_entry_t *my_poller_uring_entry_find(my_poller_uring_priv_t *priv, int fd, void *data)
+{
+	my_poller_uring_entry_t *entry;
+
+	entry = ((fd >= 0) && (fd < priv->table_size)) ? priv->table[fd] : NULL;
+	if (!entry || (entry->data != data)) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return entry;
+}
+
+static int my_poller_uring_mod(my_poller_t *poller, int fd, int events, void *data)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	my_poller_uring_entry_t *entry;
+
+	entry = my_poller_uring_entry_find(priv, fd, data);
+	if (!entry) {
+		return -1;
+	}
+
+	if (entry->events == events) {
+		return 0;
+	}
+	entry->events = events;
+
+	/* a queued entry picks the new mask up when re-armed */
+	if (entry->queued) {
+		return 0;
+	}
+
+	/* an armed one is canceled first, then re-armed with the new mask */
+	if (entry->armed) {
+		return my_poller_uring_disarm(priv, entry);
+	}
+
+	return my_poller_uring_arm(priv, entry);
+}
+
+static int my_poller_uring_del(my_poller_t *poller, int fd, void *data)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	my_poller_uring_entry_t *entry;
+
+	entry = my_poller_uring_entry_find(priv, fd, data);
+	if (!entry) {
+		return -1;
+	}
+
+	entry->dead = 1;
+	priv->table[fd] = NULL;
+
+	/*
+	 * an armed entry is freed once its poll completes (canceled or not),
+	 * a queued one when it would have been re-armed, an idle one now.
+	 */
+	if (entry->armed) {
+		return my_poller_uring_disarm(priv, entry);
+	}
+	if (!entry->queued) {
+		my_poller_uring_entry_free(priv, entry);
+	}
+
+	return 0;
+}
+
+/* from the current file position (-1), for files & pipes alike */
+static int my_poller_uring_submit(my_poller_t *poller, my_poller_io_t *io)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	struct io_uring_sqe *sqe;
+
+	sqe = my_poller_uring_get_sqe(priv);
+	if (!sqe) {
+		return -1;
+	}
+
+	switch (io->op) {
+	case MY_POLLER_IO_READ:
+		sqe->opcode = IORING_OP_READ;
+		sqe->off = (uint64_t)-1;
+		break;
+	case MY_POLLER_IO_WRITE:
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->off = (uint64_t)-1;
+		break;
+	case MY_POLLER_IO_RECV:
+		sqe->opcode = IORING_OP_RECV;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	sqe->fd = io->fd;
+	sqe->addr = (uint64_t)(uintptr_t)io->addr;
+	sqe->len = io->len;
+	sqe->user_data = (uint64_t)(uintptr_t)io | MY_POLLER_URING_IO_TAG;
+	my_poller_uring_commit_sqe(priv);
+
+	return 0;
+}
+
+static int my_poller_uring_cancel(my_poller_t *poller, my_poller_io_t *io)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	struct io_uring_sqe *sqe;
+
+	sqe = my_poller_uring_get_sqe(priv);
+	if (!sqe) {
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)io | MY_POLLER_URING_IO_TAG;
+	sqe->user_data = 0;
+	my_poller_uring_commit_sqe(priv);
+
+	return 0;
+}
+
+static int my_poller_uring_wait(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout)
+{
+	my_poller_uring_priv_t *priv = MY_POLLER_URING(poller);
+	my_poller_uring_entry_t *entry;
+	my_poller_io_t *io;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int interrupted = 0;
+	int i, n, rc;
+	int events;
+
+	for (i = 0; i < priv->rearm_count; i++) {
+		entry = priv->rearm[i];
+		entry->queued = 0;
+		if (entry->dead) {
+			my_poller_uring_entry_free(priv, entry);
+		} else if (entry->events && my_poller_uring_arm(priv, entry) != 0) {
+			my_log(MY_LOG_ERROR, "core/poller: error re-arming fd %d (%d: %s)", entry->fd, errno, strerror(errno));
+		}
+	}
+	priv->rearm_count = 0;
+
+	if (max > MY_POLLER_URING_EVENTS) {
+		max = MY_POLLER_URING_EVENTS;
+	}
+
+	head = *priv->cq_head;
+	tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail || priv->to_submit) {
+		rc = my_poller_uring_enter(priv, head == tail ? 1 : 0, timeout);
+		if (rc < 0) {
+			/* ETIME only means nothing completed in time */
+			if (errno == EINTR) {
+				interrupted = 1;
+			} else if (errno != ETIME) {
+				return -1;
+			}
+		}
+		tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	n = 0;
+	while (head != tail && n < max && priv->rearm_count < MY_POLLER_URING_EVENTS) {
+		cqe = &priv->cqes[head & *priv->cq_mask];
+		head++;
+
+		if (cqe->user_data & MY_POLLER_URING_IO_TAG) {
+			io = (my_poller_io_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)MY_POLLER_URING_IO_TAG);
+			io->res = cqe->res;
+			ready[n].data = io;
+			ready[n].events = MY_EVENT_IO;
+			n++;
+			continue;
+		}
+
+		entry = (my_poller_uring_entry_t *)(uintptr_t)cqe->user_data;
+		if (!entry) {
+			/* completion of a poll or i/o removal */
+			continue;
+		}
+
+		entry->armed = 0;
+		if (entry->dead) {
+			my_poller_uring_entry_free(priv, entry);
+			continue;
+		}
+
+		entry->queued = 1;
+		priv->rearm[priv->rearm_count++] = entry;
+
+		/* canceled by a mask change */
+		if (cqe->res == -ECANCELED) {
+			continue;
+		}
+
+		events = 0;
+		if (cqe->res < 0 || (cqe->res & (POLLERR | POLLHUP))) {
+			events = MY_EVENT_READ | MY_EVENT_WRITE;
+		}
+		if (cqe->res > 0 && (cqe->res & POLLIN)) {
+			events |= MY_EVENT_READ;
+		}
+		if (cqe->res > 0 && (cqe->res & POLLOUT)) {
+			events |= MY_EVENT_WRITE;
+		}
+
+		ready[n].data = entry->data;
+		ready[n].events = events;
+		n++;
+	}
+
+	__atomic_store_n(priv->cq_head, head, __ATOMIC_RELEASE);
+
+	if (n == 0 && interrupted) {
+		errno = EINTR;
+		return -1;
+	}
+
+	return n;
+}
+
+my_poller_impl_t my_poller_uring = {
+	.name = "uring",
+	.desc = "Linux io_uring based poller",
+	.create = my_poller_uring_create,
+	.destroy = my_poller_uring_destroy,
+	.add = my_poller_uring_add,
+	.mod = my_poller_uring_mod,
+	.del = my_poller_uring_del,
+	.wait = my_poller_uring_wait,
+	.submit = my_poller_uring_submit,
+	.cancel = my_poller_uring_cancel,
+};
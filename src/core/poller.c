@@ -0,0 +1,212 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/poller.h"
+
+#include "util/list.h"
+#include "util/log.h"
+#include "util/mem.h"
+
+static my_list_t my_pollers;
+
+#define MY_POLLER_REGISTER(x) { \
+	extern my_poller_impl_t my_poller_##x; \
+	my_list_enqueue(&my_pollers, &my_poller_##x); \
+}
+
+static my_poller_impl_t *my_poller_impl_find(char *name)
+{
+	my_poller_impl_t *impl;
+	my_node_t *node;
+
+	for (node = my_pollers.head; node; node = node->next) {
+		impl = MY_POLLER_IMPL(node->data);
+		if (strcmp(impl->name, name) == 0) {
+			return impl;
+		}
+	}
+
+	return NULL;
+}
+
+static my_poller_t *my_poller_priv_create(char *name)
+{
+	my_poller_impl_t *impl;
+	my_poller_t *poller;
+
+	impl = my_poller_impl_find(name);
+	if (!impl) {
+		my_log(MY_LOG_ERROR, "core/poller: unknown type '%s'", name);
+		goto _MY_ERR_find;
+	}
+
+	poller = impl->create();
+	if (!poller) {
+		my_log(MY_LOG_ERROR, "core/poller: error creating '%s' poller (%d: %s)", name, errno, strerror(errno));
+		goto _MY_ERR_create;
+	}
+
+	poller->impl = impl;
+
+	MY_DEBUG("core/poller: using '%s'", name);
+
+	return poller;
+
+_MY_ERR_create:
+_MY_ERR_find:
+	return NULL;
+}
+
+void my_poller_register_all(void)
+{
+	if (!my_list_is_empty(&my_pollers)) {
+		return;
+	}
+
+	MY_POLLER_REGISTER(select);
+#ifdef HAVE_EPOLL
+	MY_POLLER_REGISTER(epoll);
+#endif
+#ifdef HAVE_IO_URING
+	MY_POLLER_REGISTER(uring);
+#endif
+}
+
+/* tried in order when the requested poller is unknown or unsupported by the kernel */
+static char *my_poller_fallbacks[] = {
+	MY_POLLER_DEFAULT,
+#ifdef HAVE_EPOLL
+	"epoll",
+#endif
+	"select",
+	NULL
+};
+
+my_poller_t *my_poller_create(char *name)
+{
+	my_poller_t *poller = NULL;
+	char *requested = name;
+	int i, j;
+
+	if (requested) {
+		poller = my_poller_priv_create(requested);
+	}
+
+	for (i = 0; !poller && my_poller_fallbacks[i]; i++) {
+		name = my_poller_fallbacks[i];
+		if (requested && strcmp(name, requested) == 0) {
+			continue;
+		}
+		for (j = 0; j < i; j++) {
+			if (strcmp(name, my_poller_fallbacks[j]) == 0) {
+				break;
+			}
+		}
+		if (j < i) {
+			continue;
+		}
+		if (requested || i > 0) {
+			my_log(MY_LOG_NOTICE, "core/poller: falling back to '%s'", name);
+		}
+		poller = my_poller_priv_create(name);
+	}
+
+	return poller;
+}
+
+void my_poller_destroy(my_poller_t *poller)
+{
+	poller->impl->destroy(poller);
+}
+
+int my_poller_add(my_poller_t *poller, int fd, int events, void *data)
+{
+	return poller->impl->add(poller, fd, events, data);
+}
+
+int my_poller_mod(my_poller_t *poller, int fd, int events, void *data)
+{
+	return poller->impl->mod(poller, fd, events, data);
+}
+
+int my_poller_del(my_poller_t *poller, int fd, void *data)
+{
+	return poller->impl->del(poller, fd, data);
+}
+
+int my_poller_wait(my_poller_t *poller, my_poller_event_t *ready, int max, int64_t timeout)
+{
+	return poller->impl->wait(poller, ready, max, timeout);
+}
+
+int my_poller_can_submit(my_poller_t *poller)
+{
+	return poller->impl->submit != NULL;
+}
+
+int my_poller_submit(my_poller_t *poller, my_poller_io_t *io)
+{
+	if (!poller->impl->submit) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return poller->impl->submit(poller, io);
+}
+
+int my_poller_cancel(my_poller_t *poller, my_poller_io_t *io)
+{
+	if (!poller->impl->cancel) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return poller->impl->cancel(poller, io);
+}
+
+#ifdef MY_DEBUGGING
+
+static int my_poller_dump_fn(void *data, void *user, int flags)
+{
+	my_poller_impl_t *impl = MY_POLLER_IMPL(data);
+
+	MY_DEBUG("\t{");
+	MY_DEBUG("\t\tname=\"%s\";", impl->name);
+	MY_DEBUG("\t\tdescription=\"%s\";", impl->desc);
+	MY_DEBUG("\t}%s", flags & MY_LIST_ITER_FLAG_LAST ? "" : ",");
+
+	return 0;
+}
+
+void my_poller_dump_all(void)
+{
+	MY_DEBUG("# registered pollers");
+	MY_DEBUG("pollers = (");
+	my_list_iter(&my_pollers, my_poller_dump_fn, NULL);
+	MY_DEBUG(");");
+}
+
+#endif /* MY_DEBUGGING */
@@ -20,13 +20,23 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include "core/graph.h"
 #include "core/ports.h"
 
+#include "util/buf.h"
 #include "util/list.h"
+#include "util/log.h"
 #include "util/mem.h"
+#include "util/prop.h"
+#include "util/rbuf.h"
 
 my_port_conf_t *my_port_conf_create(int port_index, char *port_name)
 {
@@ -37,7 +47,7 @@ my_port_conf_t *my_port_conf_create(int port_index, char *port_name)
 		goto _MY_ERR_alloc;
 	}
 
-	port_conf->properties = my_list_create();
+	port_conf->properties = my_props_create();
 	if (port_conf->properties == NULL) {
 		goto _MY_ERR_create_properties;
 	}
@@ -55,29 +65,172 @@ _MY_ERR_alloc:
 
 void my_port_conf_destroy(my_port_conf_t *port_conf)
 {
-	my_list_destroy(port_conf->properties);
+	my_props_destroy(port_conf->properties);
 	my_mem_free(port_conf);
 }
 
 
-my_port_impl_t *my_port_impl_lookup(my_list_t *list, char *name)
+/*
+ * Index of implementations & ports by name, within the list holding them,
+ * so that configurations with thousands of ports & wirings don't take
+ * quadratic time to set up, nor control commands a walk to find a port.
+ * Linear probing, with backward shifts on removal rather than tombstones.
+ * Only used from the main thread.
+ */
+
+#define MY_PORT_INDEX_INITIAL_SIZE 64
+
+typedef struct my_port_index_entry_s my_port_index_entry_t;
+
+struct my_port_index_entry_s {
+	my_list_t *list;
+	char *name;
+	void *data;
+	unsigned int hash;
+};
+
+static my_port_index_entry_t *my_port_index;
+static int my_port_index_mask;
+static int my_port_index_count;
+
+static unsigned int my_port_index_hash(my_list_t *list, char *name)
 {
-	my_port_impl_t *impl;
-	my_node_t *node;
+	unsigned int h = 2166136261u ^ (unsigned int)((uintptr_t)list >> 4);
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* the slot holding 'name' in 'list', or the empty one where it would go */
+static int my_port_index_slot(my_list_t *list, char *name, unsigned int hash)
+{
+	my_port_index_entry_t *entry;
+	int i;
 
-	for (node = list->head; node; node = node->next) {
-		impl = MY_PORT_IMPL(node->data);
-		if (strcmp(impl->name, name) == 0) {
-			return impl;
+	for (i = hash & my_port_index_mask; (entry = &my_port_index[i])->data; i = (i + 1) & my_port_index_mask) {
+		if ((entry->hash == hash) && (entry->list == list) && (strcmp(entry->name, name) == 0)) {
+			break;
 		}
 	}
 
-	return NULL;
+	return i;
 }
 
-void my_port_impl_register(my_list_t *list, my_port_impl_t *impl)
+static int my_port_index_grow(void)
 {
-	my_list_enqueue(list, impl);
+	my_port_index_entry_t *old = my_port_index;
+	int old_mask = my_port_index_mask;
+	int i;
+
+	my_port_index_mask = old ? (old_mask << 1) | 1 : MY_PORT_INDEX_INITIAL_SIZE - 1;
+	my_port_index = my_mem_alloc((my_port_index_mask + 1) * sizeof(my_port_index_entry_t));
+	if (!my_port_index) {
+		my_port_index = old;
+		my_port_index_mask = old_mask;
+		return -1;
+	}
+
+	if (old) {
+		for (i = 0; i <= old_mask; i++) {
+			if (old[i].data) {
+				my_port_index[my_port_index_slot(old[i].list, old[i].name, old[i].hash)] = old[i];
+			}
+		}
+		my_mem_free(old);
+	}
+
+	return 0;
+}
+
+static int my_port_index_add(my_list_t *list, char *name, void *data)
+{
+	unsigned int hash;
+	int i;
+
+	if (!my_port_index || (2 * (my_port_index_count + 1) > my_port_index_mask + 1)) {
+		if (my_port_index_grow() != 0) {
+			return -1;
+		}
+	}
+
+	hash = my_port_index_hash(list, name);
+	i = my_port_index_slot(list, name, hash);
+	if (my_port_index[i].data) {
+		/* the first one wins, as it did when walking the list */
+		errno = EEXIST;
+		return -1;
+	}
+
+	my_port_index[i].list = list;
+	my_port_index[i].name = name;
+	my_port_index[i].data = data;
+	my_port_index[i].hash = hash;
+	my_port_index_count++;
+
+	return 0;
+}
+
+static void my_port_index_del(my_list_t *list, char *name, void *data)
+{
+	my_port_index_entry_t *entry;
+	int i, j, k;
+
+	if (!my_port_index) {
+		return;
+	}
+
+	i = my_port_index_slot(list, name, my_port_index_hash(list, name));
+	if (my_port_index[i].data != data) {
+		return;
+	}
+
+	/* move back the entries which probed past the freed slot */
+	for (j = (i + 1) & my_port_index_mask; (entry = &my_port_index[j])->data; j = (j + 1) & my_port_index_mask) {
+		k = entry->hash & my_port_index_mask;
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+			continue;
+		}
+		my_port_index[i] = *entry;
+		i = j;
+	}
+	my_mem_zero(&my_port_index[i], sizeof(my_port_index_entry_t));
+	my_port_index_count--;
+
+	if (my_port_index_count == 0) {
+		my_mem_free(my_port_index);
+		my_port_index = NULL;
+	}
+}
+
+static void *my_port_index_lookup(my_list_t *list, char *name)
+{
+	if (!my_port_index) {
+		return NULL;
+	}
+
+	return my_port_index[my_port_index_slot(list, name, my_port_index_hash(list, name))].data;
+}
+
+
+my_port_impl_t *my_port_impl_lookup(my_list_t *list, char *name)
+{
+	return MY_PORT_IMPL(my_port_index_lookup(list, name));
+}
+
+int my_port_impl_register(my_list_t *list, my_port_impl_t *impl)
+{
+	if (my_port_index_add(list, impl->name, impl) != 0) {
+		if (errno != EEXIST) {
+			return -1;
+		}
+		my_log(MY_LOG_WARNING, "core: duplicate type '%s', only the first one can be referred to", impl->name);
+	}
+
+	return my_list_enqueue(list, impl);
 }
 
 
@@ -125,19 +278,32 @@ void my_port_destroy(my_port_t *port)
 }
 
 
+int my_port_register(my_list_t *list, my_port_t *port)
+{
+	if (my_port_index_add(list, port->conf->name, port) != 0) {
+		if (errno != EEXIST) {
+			return -1;
+		}
+		my_log(MY_LOG_WARNING, "core/%s: duplicate name, only the first one can be referred to", port->conf->name);
+	}
+
+	return my_list_enqueue(list, port);
+}
+
 my_port_t *my_port_lookup_by_name(my_list_t *list, char *name)
 {
-	my_node_t *node;
-	my_port_t *port;
+	return MY_PORT(my_port_index_lookup(list, name));
+}
 
-	for (node = list->head; node; node = node->next) {
-		port = MY_PORT(node->data);
-		if (strcmp(port->conf->name, name) == 0) {
-			return port;
-		}
+
+int my_port_set(my_port_t *port, char *name, char *value)
+{
+	if (!MY_PORT_GET_IMPL(port)->set) {
+		errno = ENOTSUP;
+		return -1;
 	}
 
-	return NULL;
+	return MY_PORT_GET_IMPL(port)->set(port, name, value);
 }
 
 
@@ -146,6 +312,7 @@ int my_port_destroy_all(my_list_t *list)
 	my_port_t *port;
 
 	while (port = my_list_dequeue(list)) {
+		my_port_index_del(list, port->conf->name, port);
 		my_port_destroy(port);
 	}
 }
@@ -179,16 +346,81 @@ int my_port_close_all(my_list_t *list)
 	return my_list_iter(list, my_port_close_fn, NULL);
 }
 
-void my_port_link(my_port_t *port, my_port_t *peer)
+static int my_port_list_add(my_list_t **list, my_port_t *port)
 {
-	if (port) {
-		MY_DPORT(port)->peer = MY_PORT(MY_DPORT(peer));
+	if (!*list) {
+		*list = my_list_create();
+		if (!*list) {
+			return -1;
+		}
 	}
-	if (peer) {
-		MY_DPORT(peer)->peer = MY_PORT(MY_DPORT(port));
+
+	return my_list_enqueue(*list, port);
+}
+
+static void my_port_list_del(my_list_t **list, my_port_t *port)
+{
+	my_node_t *node;
+	my_port_t *p;
+
+	if (!*list) {
+		return;
+	}
+
+	my_list_for_each(*list, node, p) {
+		if (p == port) {
+			my_list_remove(*list, node);
+			break;
+		}
+	}
+
+	if (my_list_is_empty(*list)) {
+		my_list_destroy(*list);
+		*list = NULL;
 	}
 }
 
+int my_port_link(my_port_t *port, my_port_t *peer)
+{
+	my_node_t *node;
+	my_port_t *p;
+
+	if (MY_DPORT(port)->peers) {
+		my_list_for_each(MY_DPORT(port)->peers, node, p) {
+			if (p == peer) {
+				errno = EEXIST;
+				return -1;
+			}
+		}
+	}
+
+	if (my_port_list_add(&MY_DPORT(port)->peers, peer) != 0) {
+		goto _MY_ERR_add_peer;
+	}
+
+	if (my_port_list_add(&MY_DPORT(peer)->inputs, port) != 0) {
+		goto _MY_ERR_add_input;
+	}
+
+	return 0;
+
+_MY_ERR_add_input:
+	my_port_list_del(&MY_DPORT(port)->peers, peer);
+_MY_ERR_add_peer:
+	return -1;
+}
+
+void my_port_unlink(my_port_t *port, my_port_t *peer)
+{
+	my_port_list_del(&MY_DPORT(port)->peers, peer);
+	my_port_list_del(&MY_DPORT(peer)->inputs, port);
+}
+
+int my_port_is_linked(my_port_t *port)
+{
+	return MY_DPORT(port)->peers || MY_DPORT(port)->inputs;
+}
+
 int my_port_get(my_port_t *port, void *buf, int len)
 {
 	return MY_PORT_GET_IMPL(port)->get(port, buf, len);
@@ -199,3 +431,739 @@ int my_port_put(my_port_t *port, void *buf, int len)
 	return MY_PORT_GET_IMPL(port)->put(port, buf, len);
 }
 
+int my_port_decoder_create(my_port_t *port, my_port_conf_t *conf)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	char *prop;
+	int size;
+
+	prop = my_prop_lookup(conf->properties, "audio-format");
+	if (!prop) {
+		return 0;
+	}
+
+	dport->codec = my_audio_codec_create(prop);
+	if (!dport->codec) {
+		my_log(MY_LOG_ERROR, "core/%s: unknown 'audio-format' property '%s'", conf->name, prop);
+		goto _MY_ERR_codec_create;
+	}
+
+	dport->ibuf_size = my_prop_lookup_int(conf->properties, "input-buffer-size", MY_PORT_DECODER_IBUF_SIZE);
+	size = my_prop_lookup_int(conf->properties, "output-buffer-size", MY_PORT_DECODER_OBUF_SIZE);
+
+	if ((dport->ibuf_size <= 0) || (size <= 0)) {
+		my_log(MY_LOG_ERROR, "core/%s: invalid decoder buffer sizes", conf->name);
+		goto _MY_ERR_conf;
+	}
+
+	dport->ibuf = my_mem_alloc_aligned(MY_CACHE_LINE_SIZE, dport->ibuf_size);
+	if (!dport->ibuf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating input buffer (%s)", conf->name, strerror(errno));
+		goto _MY_ERR_alloc_ibuf;
+	}
+	dport->ibuf_len = 0;
+	dport->codec_full = 0;
+
+	dport->obuf_pool = my_buf_pool_create(size, MY_PORT_DECODER_OBUF_COUNT);
+	if (!dport->obuf_pool) {
+		my_log(MY_LOG_ERROR, "core/%s: error creating output buffer pool (%s)", conf->name, strerror(errno));
+		goto _MY_ERR_pool_create;
+	}
+
+	MY_DEBUG("core/%s: decoding '%s' (input buffer: %d bytes, output buffers: %d bytes)", conf->name, dport->codec->impl->name, dport->ibuf_size, size);
+
+	return 0;
+
+_MY_ERR_pool_create:
+	my_mem_free(dport->ibuf);
+	dport->ibuf = NULL;
+_MY_ERR_alloc_ibuf:
+_MY_ERR_conf:
+	my_audio_codec_destroy(dport->codec);
+	dport->codec = NULL;
+_MY_ERR_codec_create:
+	return -1;
+}
+
+void my_port_decoder_destroy(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+
+	if (!dport->codec) {
+		return;
+	}
+
+	my_buf_pool_destroy(dport->obuf_pool);
+	my_mem_free(dport->ibuf);
+	my_audio_codec_destroy(dport->codec);
+	dport->codec = NULL;
+}
+
+
+/* asynchronous i/o */
+
+static void my_port_aio_purge(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *buf;
+
+	while ((buf = dport->aio_head)) {
+		dport->aio_head = buf->next;
+		my_buf_unref(buf);
+	}
+	dport->aio_tail = NULL;
+	dport->aio_off = 0;
+	dport->aio_len = 0;
+}
+
+static void my_port_aio_read_done(my_buf_t *buf, int res, void *p);
+
+static void my_port_aio_read_next(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *buf;
+
+	if (dport->aio_io || dport->aio_head || dport->aio_paused || dport->aio_eof || dport->aio_error) {
+		return;
+	}
+
+	buf = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return;
+	}
+
+	dport->aio_io = my_loop_io_submit(port->loop, dport->aio_op, dport->aio_fd, buf, 0, buf->size, my_port_aio_read_done, port);
+	if (!dport->aio_io) {
+		my_log(MY_LOG_ERROR, "core/%s: error submitting read (%d: %s)", port->conf->name, errno, strerror(errno));
+		dport->aio_error = 1;
+	}
+
+	my_buf_unref(buf);
+}
+
+static int my_port_aio_handler_run(void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *head = dport->aio_head;
+	int off = dport->aio_off;
+	int ibuf_len = dport->ibuf_len;
+	int progress;
+
+	MY_PORT_GET_IMPL(port)->handler(dport->aio_fd, MY_EVENT_READ, port);
+
+	/* a decoder with a full input buffer only drains it, or its own output */
+	progress = (dport->aio_head != head) || (dport->aio_off != off) || (dport->ibuf_len != ibuf_len) ||
+		   (dport->codec_full && (my_port_get_room(port) > 0));
+
+	/* some was consumed but not all, the rest goes next round */
+	if (dport->aio_head && !dport->aio_paused && progress) {
+		my_loop_defer(port->loop, &dport->aio_deferred);
+	}
+
+	my_port_aio_read_next(port);
+
+	return 0;
+}
+
+static void my_port_aio_read_done(my_buf_t *buf, int res, void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	my_dport_t *dport = MY_DPORT(port);
+
+	dport->aio_io = NULL;
+
+	if ((res == -EAGAIN) || (res == -EINTR)) {
+		my_port_aio_read_next(port);
+		return;
+	}
+
+	if (res < 0) {
+		my_log(MY_LOG_ERROR, "core/%s: error reading (%d: %s)", port->conf->name, -res, strerror(-res));
+		dport->aio_error = 1;
+		return;
+	}
+
+	/* an empty datagram carries nothing, but isn't the end */
+	if (res == 0) {
+		if (dport->aio_op == MY_POLLER_IO_READ) {
+			dport->aio_eof = 1;
+		}
+	} else {
+		buf->len = res;
+		buf->timestamp = my_core_get_time(port->core);
+		dport->aio_head = my_buf_ref(buf);
+		dport->aio_off = 0;
+	}
+
+	my_port_aio_handler_run(port);
+}
+
+/* the buffer read as is, if it fits & nothing was taken from it yet */
+static my_buf_t *my_port_aio_pull_buf(my_port_t *port, int len)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *buf = dport->aio_head;
+
+	if (!buf) {
+		return NULL;
+	}
+
+	if ((dport->aio_off == 0) && (buf->len <= len)) {
+		dport->aio_head = NULL;
+		my_port_aio_read_next(port);
+		return buf;
+	}
+
+	buf = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return NULL;
+	}
+
+	buf->len = my_port_aio_get(port, buf->data, (len < buf->size) ? len : buf->size);
+	buf->timestamp = my_core_get_time(port->core);
+
+	return buf;
+}
+
+static void my_port_aio_write_done(my_buf_t *buf, int res, void *p);
+
+static void my_port_aio_write_next(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *head = dport->aio_head;
+
+	if (dport->aio_io || !head) {
+		return;
+	}
+
+	dport->aio_io = my_loop_io_submit(port->loop, dport->aio_op, dport->aio_fd, head, dport->aio_off, head->len - dport->aio_off,
+					  my_port_aio_write_done, port);
+	if (!dport->aio_io) {
+		my_log(MY_LOG_ERROR, "core/%s: error writing, dropping %d queued bytes (%d: %s)", port->conf->name, dport->aio_len, errno, strerror(errno));
+		my_port_aio_purge(port);
+	}
+}
+
+static void my_port_aio_write_done(my_buf_t *buf, int res, void *p)
+{
+	my_port_t *port = MY_PORT(p);
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *head = dport->aio_head;
+
+	dport->aio_io = NULL;
+
+	if (res < 0) {
+		if ((res != -EAGAIN) && (res != -EINTR)) {
+			my_log(MY_LOG_ERROR, "core/%s: error writing, dropping %d queued bytes (%d: %s)", port->conf->name, dport->aio_len, -res, strerror(-res));
+			my_port_aio_purge(port);
+			my_port_queue_update(port);
+			return;
+		}
+		res = 0;
+	}
+
+	dport->aio_off += res;
+	dport->aio_len -= res;
+
+	/* what was appended to it meanwhile is written next */
+	if (dport->aio_off >= head->len) {
+		dport->aio_head = head->next;
+		if (!dport->aio_head) {
+			dport->aio_tail = NULL;
+		}
+		dport->aio_off = 0;
+		my_buf_unref(head);
+	}
+
+	my_port_aio_write_next(port);
+	my_port_queue_update(port);
+}
+
+/* copied to the last buffer queued, while it has room, then to new ones */
+static int my_port_aio_write(my_port_t *port, void *buf, int len)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *tail;
+	char *p = buf;
+	int left, n;
+
+	if (len > dport->aio_size - dport->aio_len) {
+		my_log(MY_LOG_WARNING, "core/%s: output queue full, dropping %d bytes", port->conf->name, len - (dport->aio_size - dport->aio_len));
+		len = dport->aio_size - dport->aio_len;
+	}
+
+	left = len;
+	while (left > 0) {
+		tail = dport->aio_tail;
+		if (!tail || (tail->len == tail->size)) {
+			tail = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+			if (!tail) {
+				my_log(MY_LOG_ERROR, "core/%s: error allocating buffer, dropping %d bytes (%s)", port->conf->name, left, strerror(errno));
+				break;
+			}
+			if (dport->aio_tail) {
+				dport->aio_tail->next = tail;
+			} else {
+				dport->aio_head = tail;
+			}
+			dport->aio_tail = tail;
+		}
+
+		n = tail->size - tail->len;
+		if (n > left) {
+			n = left;
+		}
+		my_mem_copy(tail->data + tail->len, p, n);
+		tail->len += n;
+		p += n;
+		left -= n;
+	}
+
+	dport->aio_len += len - left;
+
+	my_port_aio_write_next(port);
+	my_port_queue_update(port);
+
+	return len - left;
+}
+
+int my_port_aio_open(my_port_t *port, int fd, int op)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	int flags;
+
+	if (!my_loop_can_submit(port->loop) || my_graph_is_scheduled(port)) {
+		return 0;
+	}
+
+	/* the loop waits for it, any EAGAIN would only have it submitted again */
+	flags = fcntl(fd, F_GETFL);
+	if ((flags < 0) || (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0)) {
+		my_log(MY_LOG_ERROR, "core/%s: error putting fd in blocking mode (%d: %s)", port->conf->name, errno, strerror(errno));
+		return -1;
+	}
+
+	dport->aio_op = op;
+	dport->aio_fd = fd;
+	dport->aio_io = NULL;
+	dport->aio_paused = 0;
+	dport->aio_eof = 0;
+	dport->aio_error = 0;
+	my_loop_deferred_init(&dport->aio_deferred, my_port_aio_handler_run, port);
+
+	if (op != MY_POLLER_IO_WRITE) {
+		my_port_aio_read_next(port);
+		if (dport->aio_error) {
+			dport->aio_op = 0;
+			return -1;
+		}
+	}
+
+	MY_DEBUG("core/%s: %s by the loop", port->conf->name, (op == MY_POLLER_IO_WRITE) ? "written" : "read");
+
+	return 1;
+}
+
+void my_port_aio_close(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+
+	if (!dport->aio_op) {
+		return;
+	}
+
+	if (dport->aio_io) {
+		my_loop_io_cancel(port->loop, dport->aio_io);
+		dport->aio_io = NULL;
+	}
+	my_loop_defer_cancel(&dport->aio_deferred);
+	my_port_aio_purge(port);
+	dport->aio_op = 0;
+}
+
+int my_port_aio_get(my_port_t *port, void *buf, int len)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *head = dport->aio_head;
+	int n;
+
+	if (!head) {
+		return 0;
+	}
+
+	n = head->len - dport->aio_off;
+	if (n > len) {
+		n = len;
+	}
+	my_mem_copy(buf, head->data + dport->aio_off, n);
+	dport->aio_off += n;
+
+	if (dport->aio_off == head->len) {
+		dport->aio_head = NULL;
+		dport->aio_off = 0;
+		my_buf_unref(head);
+		my_port_aio_read_next(port);
+	}
+
+	return n;
+}
+
+int my_port_aio_pause(my_port_t *port, int paused)
+{
+	my_dport_t *dport = MY_DPORT(port);
+
+	dport->aio_paused = paused;
+
+	/* what was read meanwhile goes first */
+	if (!paused && dport->aio_head) {
+		my_port_aio_kick(port);
+	} else {
+		my_port_aio_read_next(port);
+	}
+
+	return 0;
+}
+
+void my_port_aio_kick(my_port_t *port)
+{
+	my_loop_defer(port->loop, &MY_DPORT(port)->aio_deferred);
+}
+
+static my_buf_t *my_port_pull_decoded_buf(my_port_t *port, int len)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	my_buf_t *buf;
+	int ilen, olen;
+	int n;
+
+	/*
+	 * top the input buffer up, after what the codec left over last time,
+	 * unless it may still hold output which didn't fit last time
+	 */
+	if ((dport->ibuf_len < dport->ibuf_size) && !dport->codec_full) {
+		n = MY_PORT_GET_IMPL(port)->get(port, dport->ibuf + dport->ibuf_len, dport->ibuf_size - dport->ibuf_len);
+		if (n > 0) {
+			dport->ibuf_len += n;
+		}
+	}
+
+	buf = my_buf_alloc(dport->obuf_pool);
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return NULL;
+	}
+
+	ilen = dport->ibuf_len;
+	olen = (len < buf->size) ? len : buf->size;
+
+	n = my_audio_decode(dport->codec, dport->ibuf, &ilen, buf->data, &olen);
+	if (n < 0) {
+		/* don't choke on the same data again */
+		ilen = dport->ibuf_len;
+		olen = 0;
+	}
+
+	if (ilen < dport->ibuf_len) {
+		memmove(dport->ibuf, dport->ibuf + ilen, dport->ibuf_len - ilen);
+	}
+	dport->ibuf_len -= ilen;
+	dport->codec_full = (olen > 0) && (olen == ((len < buf->size) ? len : buf->size));
+
+	if (olen <= 0) {
+		my_buf_unref(buf);
+		return NULL;
+	}
+
+	buf->len = olen;
+	buf->timestamp = my_core_get_time(port->core);
+
+	return buf;
+}
+
+my_buf_t *my_port_get_buf(my_port_t *port, int len)
+{
+	my_port_impl_t *impl = MY_PORT_GET_IMPL(port);
+	my_buf_t *buf;
+	int n;
+
+	if (!impl->get) {
+		return NULL;
+	}
+
+	if (MY_DPORT(port)->codec) {
+		return my_port_pull_decoded_buf(port, len);
+	}
+
+	if (MY_DPORT(port)->aio_op) {
+		return my_port_aio_pull_buf(port, len);
+	}
+
+	buf = my_buf_alloc(my_loop_get_buf_pool(port->loop));
+	if (!buf) {
+		my_log(MY_LOG_ERROR, "core/%s: error allocating buffer (%s)", port->conf->name, strerror(errno));
+		return NULL;
+	}
+
+	if (len > buf->size) {
+		len = buf->size;
+	}
+
+	n = impl->get(port, buf->data, len);
+	if (n <= 0) {
+		my_buf_unref(buf);
+		return NULL;
+	}
+
+	buf->len = n;
+	buf->timestamp = my_core_get_time(port->core);
+
+	return buf;
+}
+
+my_buf_t *my_port_pull_buf(my_port_t *port, int len)
+{
+	my_port_impl_t *impl = MY_PORT_GET_IMPL(port);
+
+	if (impl->pull_buf) {
+		return impl->pull_buf(port, len);
+	}
+
+	return my_port_get_buf(port, len);
+}
+
+int my_port_push_buf(my_port_t *port, my_port_t *from, my_buf_t *buf)
+{
+	my_port_impl_t *impl = MY_PORT_GET_IMPL(port);
+
+	if (impl->push_buf) {
+		return impl->push_buf(port, from, buf);
+	}
+
+	if (!impl->put) {
+		return buf->len;
+	}
+
+	return impl->put(port, buf->data, buf->len);
+}
+
+int my_port_get_room(my_port_t *port)
+{
+	my_node_t *node;
+	my_port_t *peer;
+	int room, n;
+
+	if (MY_DPORT(port)->queue) {
+		return my_rbuf_put_avail(MY_DPORT(port)->queue);
+	}
+	if (MY_DPORT(port)->aio_size) {
+		return MY_DPORT(port)->aio_size - MY_DPORT(port)->aio_len;
+	}
+
+	room = MY_PORT_PULL_ANY;
+	if (MY_DPORT(port)->peers) {
+		my_list_for_each(MY_DPORT(port)->peers, node, peer) {
+			n = my_port_get_room(peer);
+			if (n < room) {
+				room = n;
+			}
+		}
+	}
+
+	return room;
+}
+
+int my_port_push_buf_peers(my_port_t *port, my_buf_t *buf)
+{
+	my_node_t *node;
+	my_port_t *peer;
+	int rc = 0;
+
+	if (!MY_DPORT(port)->peers) {
+		return 0;
+	}
+
+	/* peers keeping it take their own reference */
+	my_list_for_each(MY_DPORT(port)->peers, node, peer) {
+		if (my_port_push_buf(peer, port, buf) < 0) {
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+
+int my_port_queue_create(my_port_t *port)
+{
+	my_props_t *props = port->conf->properties;
+	int size;
+
+	size = my_prop_lookup_int(props, "queue-size", MY_PORT_QUEUE_SIZE);
+
+	if (MY_DPORT(port)->aio_op) {
+		if (size <= 0) {
+			my_log(MY_LOG_ERROR, "core/%s: invalid 'queue-size' property", port->conf->name);
+			return -1;
+		}
+		MY_DPORT(port)->aio_size = size;
+	} else {
+		MY_DPORT(port)->queue = my_rbuf_create(size, 0);
+		if (!MY_DPORT(port)->queue) {
+			my_log(MY_LOG_ERROR, "core/%s: error creating output queue (%s)", port->conf->name, strerror(errno));
+			return -1;
+		}
+		size = MY_DPORT(port)->queue->size;
+	}
+
+	/* in bytes, leaving room above the high one for what is already on its way */
+	MY_DPORT(port)->queue_high = my_prop_lookup_int(props, "queue-high", size / 4 * 3);
+	MY_DPORT(port)->queue_low = my_prop_lookup_int(props, "queue-low", size / 4);
+
+	if ((MY_DPORT(port)->queue_high > size) || (MY_DPORT(port)->queue_low > MY_DPORT(port)->queue_high)) {
+		my_log(MY_LOG_WARNING, "core/%s: inconsistent queue watermarks, using defaults", port->conf->name);
+		MY_DPORT(port)->queue_high = size / 4 * 3;
+		MY_DPORT(port)->queue_low = size / 4;
+	}
+
+	return 0;
+}
+
+/* pause or resume the sources feeding 'port', through any filter in between */
+static void my_port_throttle(my_port_t *port, int on)
+{
+	my_node_t *node;
+	my_port_t *input;
+	my_port_impl_t *impl;
+
+	if (!MY_DPORT(port)->inputs) {
+		return;
+	}
+
+	my_list_for_each(MY_DPORT(port)->inputs, node, input) {
+		if (on && (MY_DPORT(input)->throttled++ > 0)) {
+			continue;
+		}
+		if (!on && (--MY_DPORT(input)->throttled > 0)) {
+			continue;
+		}
+
+		impl = MY_PORT_GET_IMPL(input);
+		if (impl->pause) {
+			MY_DEBUG("core/%s: %s", input->conf->name, on ? "pausing" : "resuming");
+			impl->pause(input, on);
+		}
+
+		my_port_throttle(input, on);
+	}
+}
+
+void my_port_queue_update(my_port_t *port)
+{
+	my_dport_t *dport = MY_DPORT(port);
+	int avail = dport->queue ? my_rbuf_get_avail(dport->queue) : dport->aio_len;
+
+	if (!dport->congested && (avail >= dport->queue_high)) {
+		dport->congested = 1;
+		my_port_throttle(port, 1);
+	} else if (dport->congested && (avail <= dport->queue_low)) {
+		dport->congested = 0;
+		my_port_throttle(port, 0);
+	}
+}
+
+int my_port_is_throttled(my_port_t *port)
+{
+	return MY_DPORT(port)->throttled > 0;
+}
+
+void my_port_queue_destroy(my_port_t *port)
+{
+	if (MY_DPORT(port)->congested) {
+		MY_DPORT(port)->congested = 0;
+		my_port_throttle(port, 0);
+	}
+
+	if (MY_DPORT(port)->queue) {
+		my_rbuf_destroy(MY_DPORT(port)->queue);
+		MY_DPORT(port)->queue = NULL;
+	}
+
+	my_port_aio_purge(port);
+	MY_DPORT(port)->aio_size = 0;
+}
+
+int my_port_queue_write(my_port_t *port, int fd, void *buf, int len)
+{
+	my_rbuf_t *queue = MY_DPORT(port)->queue;
+	int n = 0;
+	int queued;
+
+	if (MY_DPORT(port)->aio_op) {
+		return my_port_aio_write(port, buf, len);
+	}
+
+	/* nothing pending, try to write through */
+	if (my_rbuf_get_avail(queue) == 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if ((errno != EWOULDBLOCK) && (errno != EINTR)) {
+				my_log(MY_LOG_ERROR, "core/%s: error writing (%d: %s)", port->conf->name, errno, strerror(errno));
+				return -1;
+			}
+			n = 0;
+		}
+		if (n == len) {
+			return n;
+		}
+	}
+
+	queued = my_rbuf_put(queue, (char *)buf + n, len - n);
+	if (queued < len - n) {
+		my_log(MY_LOG_WARNING, "core/%s: output queue full, dropping %d bytes", port->conf->name, len - n - queued);
+	}
+
+	my_loop_event_handler_mod(port->loop, fd, MY_EVENT_WRITE);
+	my_port_queue_update(port);
+
+	return n + queued;
+}
+
+int my_port_queue_flush(my_port_t *port, int fd)
+{
+	my_rbuf_t *queue = MY_DPORT(port)->queue;
+	struct iovec iov[2];
+	int len, n;
+	int total = 0;
+
+	/* straight from the queue memory */
+	while ((len = my_rbuf_peek_read(queue, iov, my_rbuf_get_avail(queue))) > 0) {
+		n = writev(fd, iov, 2);
+		if (n < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EINTR)) {
+				break;
+			}
+
+			my_log(MY_LOG_ERROR, "core/%s: error writing, dropping %d queued bytes (%d: %s)", port->conf->name, my_rbuf_get_avail(queue), errno, strerror(errno));
+			my_rbuf_consume(queue, my_rbuf_get_avail(queue));
+			total = -1;
+			break;
+		}
+
+		my_rbuf_consume(queue, n);
+		total += n;
+		if (n < len) {
+			break;
+		}
+	}
+
+	if (my_rbuf_get_avail(queue) == 0) {
+		my_loop_event_handler_mod(port->loop, fd, 0);
+	}
+
+	my_port_queue_update(port);
+
+	return total;
+}
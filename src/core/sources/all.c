@@ -20,6 +20,7 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -34,7 +35,9 @@ static my_list_t my_sources;
 
 #define MY_SOURCE_REGISTER(x) { \
 	extern my_port_impl_t my_source_##x; \
-	my_port_impl_register(&my_sources, &my_source_##x); \
+	if (my_port_impl_register(&my_sources, &my_source_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/sources: error registering '%s' (%s)", my_source_##x.name, strerror(errno)); \
+	} \
 }
 
 static my_port_impl_t *my_source_impl_find(my_port_conf_t *conf)
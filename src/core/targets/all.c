@@ -20,6 +20,7 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -34,7 +35,9 @@ static my_list_t my_targets;
 
 #define MY_TARGET_REGISTER(x) { \
 	extern my_port_impl_t my_target_##x; \
-	my_port_impl_register(&my_targets, &my_target_##x); \
+	if (my_port_impl_register(&my_targets, &my_target_##x) != 0) { \
+		my_log(MY_LOG_ERROR, "core/targets: error registering '%s' (%s)", my_target_##x.name, strerror(errno)); \
+	} \
 }
 
 static my_port_impl_t *my_target_impl_find(my_port_conf_t *conf)
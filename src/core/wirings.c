@@ -20,6 +20,7 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -76,10 +77,39 @@ static my_wiring_t *my_wiring_priv_create(my_core_t *core, my_wiring_conf_t *con
 	wiring->source = source;
 	wiring->target = target;
 
-	my_port_link(source, target);
+	/*
+	 * both ends are served by the same reactor, so that data never crosses
+	 * threads; a port already wired elsewhere drags the new wiring along
+	 */
+	if (my_port_is_linked(source) && my_port_is_linked(target) && source->loop != target->loop) {
+		my_log(MY_LOG_ERROR, "core/%s: '%s' and '%s' are served by different reactors", conf->name, conf->source, conf->target);
+		goto _MY_ERR_reactor;
+	} else if (my_port_is_linked(source)) {
+		wiring->loop = source->loop;
+	} else if (my_port_is_linked(target)) {
+		wiring->loop = target->loop;
+	} else {
+		wiring->loop = my_core_get_reactor(core, conf->reactor >= 0 ? conf->reactor : conf->index);
+	}
+	if (conf->reactor >= 0 && conf->reactor != my_loop_get_index(wiring->loop)) {
+		my_log(MY_LOG_WARNING, "core/%s: pinned to reactor #%d instead of #%d", conf->name, my_loop_get_index(wiring->loop), conf->reactor);
+	}
+	source->loop = wiring->loop;
+	target->loop = wiring->loop;
+
+	/* a source may feed several targets, each wiring adding one */
+	if (my_port_link(source, target) != 0) {
+		my_log(MY_LOG_ERROR, "core/%s: error linking '%s' to '%s' (%s)", conf->name, conf->source, conf->target, strerror(errno));
+		goto _MY_ERR_link;
+	}
+
+	MY_DEBUG("core/%s: served by reactor #%d", conf->name, my_loop_get_index(wiring->loop));
 
 	return wiring;
 
+_MY_ERR_link:
+_MY_ERR_reactor:
+	my_mem_free(wiring);
 _MY_ERR_wiring_alloc:
 _MY_ERR_target_lookup:
 _MY_ERR_source_lookup:
@@ -88,6 +118,7 @@ _MY_ERR_source_lookup:
 
 static void my_wiring_priv_destroy(my_wiring_t *wiring)
 {
+	my_port_unlink(wiring->source, wiring->target);
 	my_mem_free(wiring);
 }
 
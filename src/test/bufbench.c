@@ -0,0 +1,249 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Compares two ways for a source to decode what it reads: through scratch
+ * buffers on the stack of its event handler, copied to a pooled buffer to be
+ * handed downstream, or through a persistent input buffer and straight into
+ * the pooled buffer, as my_port_pull_buf() does for decoding sources.
+ *
+ * usage: bufbench [sources] [events]
+ */
+
+#include "util/buf.h"
+#include "util/log.h"
+#include "util/mem.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define MY_BENCH_IBUF_SIZE 16384
+#define MY_BENCH_OBUF_SIZE 196608
+#define MY_BENCH_INPUT_SIZE (4 * 1024 * 1024)
+
+typedef struct my_bench_source_s my_bench_source_t;
+
+struct my_bench_source_s {
+	char *input;
+	int pos;
+	char *ibuf;
+};
+
+static my_buf_pool_t *my_bench_pool;
+static uint32_t my_bench_sum;
+
+/* stands for read(), from a large input so that every event brings fresh data */
+static int my_bench_read(my_bench_source_t *s, void *buf, int len)
+{
+	memcpy(buf, s->input + s->pos, len);
+	s->pos = (s->pos + len) % MY_BENCH_INPUT_SIZE;
+
+	return len;
+}
+
+/* stands for a decoder, widening s16 samples to f32 */
+static int my_bench_decode(void *ibuf, int ilen, void *obuf)
+{
+	int16_t *in = ibuf;
+	float *out = obuf;
+	int i, n = ilen / 2;
+
+	for (i = 0; i < n; i++) {
+		out[i] = in[i] * (1.0f / 32768.0f);
+	}
+
+	return n * sizeof(float);
+}
+
+/* stands for whatever consumes the buffer downstream */
+static void my_bench_consume(my_buf_t *buf)
+{
+	uint32_t *p = (uint32_t *)buf->data;
+	int i;
+
+	for (i = 0; i < buf->len / 4; i += MY_CACHE_LINE_SIZE / 4) {
+		my_bench_sum += p[i];
+	}
+	my_buf_unref(buf);
+}
+
+static __attribute__((noinline)) void my_bench_stack_handler(my_bench_source_t *s)
+{
+	char ibuf[MY_BENCH_IBUF_SIZE], obuf[MY_BENCH_OBUF_SIZE];
+	my_buf_t *buf;
+	int n;
+
+	n = my_bench_read(s, ibuf, sizeof(ibuf));
+	n = my_bench_decode(ibuf, n, obuf);
+
+	buf = my_buf_alloc(my_bench_pool);
+	memcpy(buf->data, obuf, n);
+	buf->len = n;
+	my_bench_consume(buf);
+}
+
+static __attribute__((noinline)) void my_bench_persistent_handler(my_bench_source_t *s)
+{
+	my_buf_t *buf;
+	int n;
+
+	n = my_bench_read(s, s->ibuf, MY_BENCH_IBUF_SIZE);
+
+	buf = my_buf_alloc(my_bench_pool);
+	buf->len = my_bench_decode(s->ibuf, n, buf->data);
+	my_bench_consume(buf);
+}
+
+static int my_bench_counter_open(uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void my_bench_run(char *name, void (*handler)(my_bench_source_t *), my_bench_source_t *sources, int n_sources, int n_events)
+{
+	/* first level data cache read misses, & last level cache read misses */
+	uint64_t configs[2] = {
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	};
+	uint64_t counts[2] = { 0, 0 };
+	int fds[2];
+	struct timespec t0, t1;
+	double elapsed;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		fds[i] = my_bench_counter_open(configs[i]);
+		if (fds[i] >= 0) {
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < n_events; i++) {
+		handler(&sources[i % n_sources]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < 2; i++) {
+		if (fds[i] >= 0) {
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i])) {
+				counts[i] = 0;
+			}
+			close(fds[i]);
+		}
+	}
+
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	my_log(MY_LOG_NOTICE, "%-10s: %8.1f events/s, %7.2f us/event", name, n_events / elapsed, elapsed * 1e6 / n_events);
+	if ((fds[0] < 0) && (fds[1] < 0)) {
+		my_log(MY_LOG_NOTICE, "%-10s: cache miss counters not available (%s)", name, strerror(errno));
+	} else {
+		my_log(MY_LOG_NOTICE, "%-10s: %8.1f L1D read misses/event, %8.1f LLC read misses/event", name, (double)counts[0] / n_events, (double)counts[1] / n_events);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	my_bench_source_t *sources;
+	char *me;
+	int n_sources = 8, n_events = 20000;
+	int16_t *p;
+	int i, j;
+
+	me = strrchr(argv[0], '/');
+	if (me == NULL ) {
+		me = argv[0];
+	} else {
+		me++;
+	}
+
+	my_log_init(me);
+
+	if (my_log_open("stderr", MY_LOG_DEBUG) != 0) {
+		return 1;
+	}
+
+	if (argc > 1) {
+		n_sources = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		n_events = atoi(argv[2]);
+	}
+
+	my_bench_pool = my_buf_pool_create(MY_BENCH_OBUF_SIZE, 4);
+	if (!my_bench_pool) {
+		my_log(MY_LOG_ERROR, "error creating buffer pool (%s)", strerror(errno));
+		my_log_close();
+		return 1;
+	}
+
+	sources = my_mem_alloc(n_sources * sizeof(*sources));
+	for (i = 0; i < n_sources; i++) {
+		sources[i].input = my_mem_alloc(MY_BENCH_INPUT_SIZE);
+		sources[i].ibuf = my_mem_alloc_aligned(MY_CACHE_LINE_SIZE, MY_BENCH_IBUF_SIZE);
+		p = (int16_t *)sources[i].input;
+		for (j = 0; j < MY_BENCH_INPUT_SIZE / 2; j++) {
+			p[j] = rand();
+		}
+	}
+
+	my_log(MY_LOG_NOTICE, "%d sources, %d events, %d bytes read & %d bytes decoded per event", n_sources, n_events, MY_BENCH_IBUF_SIZE, MY_BENCH_IBUF_SIZE * 2);
+
+	/* once each to warm up, then for real */
+	my_bench_run("warm-up", my_bench_stack_handler, sources, n_sources, n_events / 10);
+	my_bench_run("warm-up", my_bench_persistent_handler, sources, n_sources, n_events / 10);
+	my_bench_run("stack", my_bench_stack_handler, sources, n_sources, n_events);
+	my_bench_run("persistent", my_bench_persistent_handler, sources, n_sources, n_events);
+
+	for (i = 0; i < n_sources; i++) {
+		my_mem_free(sources[i].ibuf);
+		my_mem_free(sources[i].input);
+	}
+	my_mem_free(sources);
+	my_buf_pool_destroy(my_bench_pool);
+
+	my_log(MY_LOG_DEBUG, "checksum: %08x", my_bench_sum);
+	my_log_close();
+
+	return 0;
+}
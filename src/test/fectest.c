@@ -0,0 +1,513 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Sends numbered packets, with a parity packet every 'k' of them, over the
+ * loopback interface while dropping some at random, as the udp ports do
+ * with their 'fec' property, and reports how many of the lost ones were
+ * rebuilt, failing unless every group missing a single packet was. Then
+ * does the same, also swapping packets around, to an udp source port with
+ * rtp framing, checking that what it reads comes out in sequence. Last,
+ * times the XOR kernel in use against a byte at a time loop.
+ *
+ * usage: fectest [k] [loss %] [packets] [packet size]
+ */
+
+#include "conf.h"
+#include "core.h"
+#include "core/ports.h"
+
+#include "util/buf.h"
+#include "util/fec.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/prop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* kind (0: data, 1: parity), sequence number & media time */
+#define MY_TEST_HDR_SIZE 7
+#define MY_TEST_SIZE_MAX 2048
+#define MY_TEST_XOR_ROUNDS 100000
+
+/* audio frames per packet, so that media times soon outgrow sequence numbers */
+#define MY_TEST_FRAMES 480
+
+#define MY_TEST_RTP_HDR_SIZE 12
+#define MY_TEST_RTP_PAYLOAD_TYPE 96
+#define MY_TEST_FEC_PAYLOAD_TYPE 127
+#define MY_TEST_GROUP "239.255.42.42"
+#define MY_TEST_PORT "42424"
+
+static void my_test_fill(char *data, int seq, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		data[i] = seq * 31 + i;
+	}
+}
+
+static int my_test_check(my_buf_t *buf, int size)
+{
+	char data[MY_TEST_SIZE_MAX];
+
+	my_test_fill(data, buf->seq, size);
+
+	if ((uint16_t)(buf->media_time / MY_TEST_FRAMES) != buf->seq) {
+		return 0;
+	}
+
+	return (buf->len == size) && (memcmp(buf->data, data, size) == 0);
+}
+
+static int my_test_send(int fd, struct sockaddr_in *sa, int kind, uint16_t seq, uint32_t media_time, char *data, int len)
+{
+	char dgram[MY_TEST_HDR_SIZE + MY_FEC_HDR_SIZE + MY_TEST_SIZE_MAX];
+
+	dgram[0] = kind;
+	dgram[1] = seq >> 8;
+	dgram[2] = seq;
+	dgram[3] = media_time >> 24;
+	dgram[4] = media_time >> 16;
+	dgram[5] = media_time >> 8;
+	dgram[6] = media_time;
+	memcpy(dgram + MY_TEST_HDR_SIZE, data, len);
+
+	return sendto(fd, dgram, MY_TEST_HDR_SIZE + len, 0, (struct sockaddr *)sa, sizeof(*sa));
+}
+
+static int my_test_run(int rx, int tx, struct sockaddr_in *sa, int k, int loss, int count, int size)
+{
+	char data[MY_TEST_SIZE_MAX];
+	char dgram[MY_TEST_HDR_SIZE + MY_FEC_HDR_SIZE + MY_TEST_SIZE_MAX];
+	my_buf_pool_t *pool;
+	my_fec_enc_t *enc;
+	my_fec_dec_t *dec;
+	my_buf_t *buf;
+	unsigned int seed = 1;
+	char *parity;
+	uint32_t media_time;
+	int dropped, received, bad, n, i;
+	int lost, rebuildable, ret;
+
+	pool = my_buf_pool_create(MY_TEST_SIZE_MAX, 4 * k);
+	enc = my_fec_enc_create(k, size);
+	dec = my_fec_dec_create(2 * k);
+	if (!pool || !enc || !dec) {
+		my_log(MY_LOG_ERROR, "error creating encoder & decoder");
+		return -1;
+	}
+
+	dropped = received = bad = 0;
+	lost = rebuildable = 0;
+
+	for (i = 0; i < count; i++) {
+		media_time = (uint32_t)i * MY_TEST_FRAMES;
+		my_test_fill(data, i, size);
+		if ((rand_r(&seed) % 100) < loss) {
+			dropped++;
+			lost++;
+		} else {
+			my_test_send(tx, sa, 0, i, media_time, data, size);
+		}
+
+		/* groups missing a single packet must be rebuilt, from their parity */
+		n = my_fec_enc_add(enc, i, media_time, data, size, &parity);
+		if (n > 0) {
+			if ((rand_r(&seed) % 100) >= loss) {
+				my_test_send(tx, sa, 1, 0, 0, parity, n);
+				if (lost == 1) {
+					rebuildable++;
+				}
+			}
+			lost = 0;
+		}
+
+		while ((n = recv(rx, dgram, sizeof(dgram), MSG_DONTWAIT)) >= MY_TEST_HDR_SIZE) {
+			n -= MY_TEST_HDR_SIZE;
+			if (dgram[0] == 1) {
+				buf = my_fec_dec_recover(dec, dgram + MY_TEST_HDR_SIZE, n, pool);
+			} else {
+				buf = my_buf_alloc(pool);
+				if (buf) {
+					memcpy(buf->data, dgram + MY_TEST_HDR_SIZE, n);
+					buf->len = n;
+					buf->flags |= MY_BUF_SEQUENCED;
+					buf->seq = ((uint8_t)dgram[1] << 8) | (uint8_t)dgram[2];
+					buf->media_time = ((uint32_t)(uint8_t)dgram[3] << 24) | ((uint8_t)dgram[4] << 16) | ((uint8_t)dgram[5] << 8) | (uint8_t)dgram[6];
+					my_fec_dec_add(dec, buf);
+				}
+			}
+			if (buf) {
+				received++;
+				if (!my_test_check(buf, size)) {
+					bad++;
+				}
+				my_buf_unref(buf);
+			}
+		}
+	}
+
+	my_log(MY_LOG_NOTICE, "k %2d, loss %2d%%: %d packets, %d dropped, %llu recovered (%d expected), %llu unrecoverable, %d received, %d corrupted",
+		k, loss, count, dropped, (unsigned long long)my_fec_dec_get_recovered(dec), rebuildable,
+		(unsigned long long)my_fec_dec_get_unrecoverable(dec), received, bad);
+
+	ret = 0;
+	if (bad) {
+		my_log(MY_LOG_ERROR, "%d packets corrupted", bad);
+		ret = -1;
+	}
+	if (my_fec_dec_get_recovered(dec) < rebuildable) {
+		my_log(MY_LOG_ERROR, "%d packets rebuilt out of %d", (int)my_fec_dec_get_recovered(dec), rebuildable);
+		ret = -1;
+	}
+
+	my_fec_dec_destroy(dec);
+	my_fec_enc_destroy(enc);
+	my_buf_pool_destroy(pool);
+
+	return ret;
+}
+
+static int my_test_rtp_send(int fd, struct sockaddr_in *sa, int payload_type, uint16_t seq, uint32_t media_time, char *data, int len)
+{
+	unsigned char dgram[MY_TEST_RTP_HDR_SIZE + MY_FEC_HDR_SIZE + MY_TEST_SIZE_MAX];
+
+	memset(dgram, 0, MY_TEST_RTP_HDR_SIZE);
+	dgram[0] = 2 << 6;
+	dgram[1] = payload_type;
+	dgram[2] = seq >> 8;
+	dgram[3] = seq;
+	dgram[4] = media_time >> 24;
+	dgram[5] = media_time >> 16;
+	dgram[6] = media_time >> 8;
+	dgram[7] = media_time;
+	memcpy(dgram + MY_TEST_RTP_HDR_SIZE, data, len);
+
+	return sendto(fd, dgram, MY_TEST_RTP_HDR_SIZE + len, 0, (struct sockaddr *)sa, sizeof(*sa));
+}
+
+/* port payloads start with the packet index, so that the order can be told */
+static void my_test_port_fill(char *data, uint32_t index, int len)
+{
+	my_test_fill(data, index, len);
+	data[0] = index >> 24;
+	data[1] = index >> 16;
+	data[2] = index >> 8;
+	data[3] = index;
+}
+
+/* reads all that the port lets through, checking it comes in sequence */
+static int my_test_port_read(my_port_t *port, int size, int64_t *last, int *delivered, int *bad, int *disorder)
+{
+	char out[16 * MY_TEST_SIZE_MAX];
+	char data[MY_TEST_SIZE_MAX];
+	uint32_t index;
+	int n, off;
+
+	while ((n = my_port_get(port, out, sizeof(out))) > 0) {
+		if (n % size) {
+			(*bad)++;
+		}
+		for (off = 0; off + size <= n; off += size) {
+			index = ((uint32_t)(uint8_t)out[off] << 24) | ((uint8_t)out[off + 1] << 16) | ((uint8_t)out[off + 2] << 8) | (uint8_t)out[off + 3];
+			my_test_port_fill(data, index, size);
+			if (memcmp(out + off, data, size) != 0) {
+				(*bad)++;
+				continue;
+			}
+			if ((int64_t)index <= *last) {
+				(*disorder)++;
+			}
+			*last = index;
+			(*delivered)++;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Sends rtp packets to an udp source port, dropping some and swapping
+ * others with the one after them, as a network would, then reads them
+ * back through the port, which is to hand them over in sequence, lost
+ * ones rebuilt where possible and late ones left out.
+ */
+static int my_test_port(int tx, int k, int loss, int count, int size)
+{
+	char data[MY_TEST_SIZE_MAX];
+	char held[MY_TEST_SIZE_MAX];
+	char k_str[16], size_str[16];
+	struct sockaddr_in sa;
+	my_port_conf_t *port_conf;
+	my_conf_t *conf;
+	my_core_t *core;
+	my_port_t *port;
+	my_fec_enc_t *enc;
+	unsigned int seed = 2;
+	char *parity;
+	uint32_t media_time, held_time = 0;
+	uint16_t fec_seq = 0;
+	int64_t last = -1;
+	int sent, delivered, bad, disorder;
+	int held_seq = -1;
+	int n, i, ret = -1;
+
+	snprintf(k_str, sizeof(k_str), "%d", k);
+	snprintf(size_str, sizeof(size_str), "%d", MY_FEC_HDR_SIZE + size);
+
+	conf = my_conf_create();
+	if (!conf) {
+		goto _MY_ERR_conf_create;
+	}
+	conf->reactors = 1;
+
+	port_conf = my_port_conf_create(0, "fec");
+	if (!port_conf) {
+		goto _MY_ERR_port_conf_create;
+	}
+	my_prop_add(port_conf->properties, "type", "udp");
+	my_prop_add(port_conf->properties, "host", MY_TEST_GROUP);
+	my_prop_add(port_conf->properties, "port", MY_TEST_PORT);
+	my_prop_add(port_conf->properties, "framing", "rtp");
+	my_prop_add(port_conf->properties, "fec", k_str);
+	my_prop_add(port_conf->properties, "datagram-size", size_str);
+	my_prop_add(port_conf->properties, "audio-format", "null");
+	my_list_enqueue(conf->sources, port_conf);
+
+	core = my_core_create();
+	if (!core) {
+		goto _MY_ERR_core_create;
+	}
+
+	if (my_core_init(core, conf) != 0) {
+		goto _MY_ERR_core_init;
+	}
+
+	port = my_port_lookup_by_name(core->sources, "fec");
+	enc = my_fec_enc_create(k, size);
+	if (!port || !enc) {
+		my_log(MY_LOG_ERROR, "error creating port & encoder");
+		goto _MY_ERR_port;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr(MY_TEST_GROUP);
+	sa.sin_port = htons(atoi(MY_TEST_PORT));
+
+	sent = delivered = bad = disorder = 0;
+
+	for (i = 0; i < count; i++) {
+		media_time = (uint32_t)i * MY_TEST_FRAMES;
+		my_test_port_fill(data, i, size);
+		if ((rand_r(&seed) % 100) < loss) {
+			/* dropped */
+		} else if ((held_seq < 0) && ((rand_r(&seed) % 100) < loss)) {
+			memcpy(held, data, size);
+			held_seq = i;
+			held_time = media_time;
+		} else {
+			my_test_rtp_send(tx, &sa, MY_TEST_RTP_PAYLOAD_TYPE, i, media_time, data, size);
+			sent++;
+		}
+
+		n = my_fec_enc_add(enc, i, media_time, data, size, &parity);
+		if ((n > 0) && ((rand_r(&seed) % 100) >= loss)) {
+			my_test_rtp_send(tx, &sa, MY_TEST_FEC_PAYLOAD_TYPE, fec_seq++, media_time, parity, n);
+		}
+
+		if ((held_seq >= 0) && (held_seq != i)) {
+			my_test_rtp_send(tx, &sa, MY_TEST_RTP_PAYLOAD_TYPE, held_seq, held_time, held, size);
+			held_seq = -1;
+			sent++;
+		}
+
+		if (my_test_port_read(port, size, &last, &delivered, &bad, &disorder) < 0) {
+			goto _MY_ERR_read;
+		}
+	}
+
+	my_log(MY_LOG_NOTICE, "k %2d, loss %2d%%: %d packets, %d sent to port, %d read in sequence, %d out of sequence, %d corrupted",
+		k, loss, count, sent, delivered, disorder, bad);
+
+	ret = 0;
+	if (bad || disorder) {
+		my_log(MY_LOG_ERROR, "port output corrupted or out of sequence");
+		ret = -1;
+	}
+	/* everything without loss, more than was sent, once rebuilt, otherwise */
+	if ((!loss && (delivered != count)) || (loss && (delivered <= sent))) {
+		my_log(MY_LOG_ERROR, "port output short of what was sent");
+		ret = -1;
+	}
+
+_MY_ERR_read:
+_MY_ERR_port:
+	if (enc) {
+		my_fec_enc_destroy(enc);
+	}
+_MY_ERR_core_init:
+	my_core_destroy(core);
+_MY_ERR_core_create:
+_MY_ERR_port_conf_create:
+	my_conf_destroy(conf);
+_MY_ERR_conf_create:
+	return ret;
+}
+
+static void my_test_xor_bytes(char *dst, const char *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
+static double my_test_elapsed(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void my_test_xor(int size)
+{
+	static char dst[MY_TEST_SIZE_MAX], src[MY_TEST_SIZE_MAX];
+	struct timespec t0;
+	double bytes = (double)size * MY_TEST_XOR_ROUNDS;
+	double elapsed;
+	int i;
+
+	memset(src, 0x5a, sizeof(src));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < MY_TEST_XOR_ROUNDS; i++) {
+		my_test_xor_bytes(dst, src, size);
+		__asm__ __volatile__("" : : "r" (dst) : "memory");
+	}
+	elapsed = my_test_elapsed(&t0);
+	my_log(MY_LOG_NOTICE, "xor %-6s: %8.1f MB/s", "bytes", bytes / elapsed / 1e6);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < MY_TEST_XOR_ROUNDS; i++) {
+		my_fec_xor(dst, src, size);
+		__asm__ __volatile__("" : : "r" (dst) : "memory");
+	}
+	elapsed = my_test_elapsed(&t0);
+	my_log(MY_LOG_NOTICE, "xor %-6s: %8.1f MB/s", my_fec_get_impl(), bytes / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	int k = 4, loss = 5, count = 100000, size = 1280;
+	int rx, tx, n, ret;
+	char *me;
+
+	me = strrchr(argv[0], '/');
+	if (me == NULL ) {
+		me = argv[0];
+	} else {
+		me++;
+	}
+
+	my_log_init(me);
+
+	if (my_log_open("stderr", MY_LOG_DEBUG) != 0) {
+		return 1;
+	}
+
+	if (argc > 1) {
+		k = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		loss = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		count = atoi(argv[3]);
+	}
+	if (argc > 4) {
+		size = atoi(argv[4]);
+	}
+	if ((k < 1) || (k > MY_FEC_K_MAX) || (loss < 0) || (loss > 100) || (count < 1) || (size < 4) || (size > MY_TEST_SIZE_MAX)) {
+		my_log(MY_LOG_ERROR, "argument out of range (k: 1 - %d, loss: 0 - 100, size: 4 - %d)", MY_FEC_K_MAX, MY_TEST_SIZE_MAX);
+		goto _MY_ERR_args;
+	}
+
+	rx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	if ((rx < 0) || (tx < 0)) {
+		my_log(MY_LOG_ERROR, "error creating sockets (%s)", strerror(errno));
+		goto _MY_ERR_socket;
+	}
+
+	n = 1024 * 1024;
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(rx, (struct sockaddr *)&sa, sizeof(sa)) != 0) || (getsockname(rx, (struct sockaddr *)&sa, &sa_len) != 0)) {
+		my_log(MY_LOG_ERROR, "error binding socket (%s)", strerror(errno));
+		goto _MY_ERR_bind;
+	}
+
+	ret = my_test_run(rx, tx, &sa, k, loss, count, size);
+	if (my_test_port(tx, k, loss, count, size) != 0) {
+		ret = -1;
+	}
+	my_test_xor(size);
+
+	close(tx);
+	close(rx);
+	my_log_close();
+
+	return ret ? 1 : 0;
+
+_MY_ERR_bind:
+_MY_ERR_socket:
+	if (tx >= 0) {
+		close(tx);
+	}
+	if (rx >= 0) {
+		close(rx);
+	}
+_MY_ERR_args:
+	my_log_close();
+	return 1;
+}
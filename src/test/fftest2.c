@@ -65,7 +65,6 @@ struct my_target_s
 };
 
 uint8_t ibuf[AVCODEC_MAX_AUDIO_FRAME_SIZE];
-uint8_t obuf[AVCODEC_MAX_AUDIO_FRAME_SIZE];
 
 
 static char *me;
@@ -100,7 +99,7 @@ static int my_source_open(char *name)
 	}
 
 	my_log(MY_LOG_NOTICE, "source: creating ring buffer");
-	my_source.rb = my_rbuf_create(MY_SOURCE_SIZE);
+	my_source.rb = my_rbuf_create(MY_SOURCE_SIZE, 0);
 	if (my_source.rb == NULL) {
 		my_log(MY_LOG_ERROR, "source: creating ring buffer");
 		goto _MY_ERR_rbuf_create;
@@ -244,7 +243,7 @@ static int my_target_open(char *name)
 	}
 
 	my_log(MY_LOG_NOTICE, "target: creating ring buffer");
-	my_target.rb = my_rbuf_create(MY_TARGET_SIZE);
+	my_target.rb = my_rbuf_create(MY_TARGET_SIZE, MY_RBUF_FLAG_MIRRORED);
 	if (my_target.rb == NULL) {
 		my_log(MY_LOG_ERROR, "target: creating ring buffer");
 		goto _MY_ERR_rbuf_create;
@@ -376,6 +375,7 @@ static int my_loop(void)
 	int nfds;
 	fd_set rfds, wfds;
 	struct timeval tv;
+	struct iovec iov[2];
 	int n;
 	int init_done = 0;
 	ReSampleContext *resamplec = NULL;
@@ -404,11 +404,9 @@ static int my_loop(void)
 			}
 		} else if (n > 0) {
 			if (FD_ISSET(my_source.fd, &rfds)) {
-				n = my_rbuf_put_avail(my_source.rb);
-				if (n > MY_RBLOCK_SIZE) {
-					n = MY_RBLOCK_SIZE;
-				}
-				n = read(my_source.fd, ibuf, n);
+				/* read straight into the ring buffer */
+				my_rbuf_reserve_write(my_source.rb, iov, MY_RBLOCK_SIZE);
+				n = readv(my_source.fd, iov, 2);
 /*
 				my_log(MY_LOG_NOTICE, "source: read %d bytes", n);
 */
@@ -420,20 +418,20 @@ static int my_loop(void)
 				} else if (n == 0) {
 					my_source.eof = 1;
 				} else {
-					n = my_rbuf_put(my_source.rb, ibuf, n);
+					n = my_rbuf_commit_write(my_source.rb, n);
 /*
 					my_log(MY_LOG_NOTICE, "source: put %d bytes in ring buffer", n);
 */
 				}
 			}
 			if (FD_ISSET(my_target.fd, &wfds)) {
-				n = MY_WBLOCK_SIZE;
-				n = my_rbuf_get(my_target.rb, obuf, n);
+				/* write straight from the ring buffer */
+				n = my_rbuf_peek_read(my_target.rb, iov, MY_WBLOCK_SIZE);
 /*
 				my_log(MY_LOG_NOTICE, "target: got %d bytes from ring buffer", n);
 */
 				if (n > 0) {
-					n = write(my_target.fd, obuf, n);
+					n = writev(my_target.fd, iov, 2);
 /*
 					my_log(MY_LOG_NOTICE, "target: wrote %d bytes", n);
 */
@@ -442,6 +440,8 @@ static int my_loop(void)
 							my_log(MY_LOG_ERROR, "write '%d: %s'", errno, strerror(errno));
 							goto _MY_ERR_write;
 						}
+					} else {
+						my_rbuf_consume(my_target.rb, n);
 					}
 				}
 			}
@@ -459,23 +459,27 @@ static int my_loop(void)
 			if (av_read_frame(my_source.ff_fc, &av_pk) == 0) {
 				if (av_pk.stream_index == my_source.stream_index) {
 					my_log(MY_LOG_NOTICE, "source: read frame (pts=%lld, dts=%lld, size=%d, duration=%d, pos=%lld)", av_pk.pts, av_pk.dts, av_pk.size, av_pk.duration, av_pk.pos);
+					/* the target ring buffer is mirrored, so free space is always contiguous */
+					my_rbuf_reserve_write(my_target.rb, iov, AVCODEC_MAX_AUDIO_FRAME_SIZE);
 					target_size = sizeof(ibuf);
-					source_size = avcodec_decode_audio2(my_source.ff_cc, (int16_t *)ibuf, &target_size, av_pk.data, av_pk.size);
+					if (resamplec) {
+						source_size = avcodec_decode_audio2(my_source.ff_cc, (int16_t *)ibuf, &target_size, av_pk.data, av_pk.size);
+					} else {
+						source_size = avcodec_decode_audio2(my_source.ff_cc, (int16_t *)iov[0].iov_base, &target_size, av_pk.data, av_pk.size);
+					}
 					av_free_packet(&av_pk);
 					if (source_size < 0) {
 						my_log(MY_LOG_ERROR, "source: decoding frame");
+						target_size = 0;
 					}
 					my_log(MY_LOG_NOTICE, "source: decoded frame (size in=%d, out=%d)", source_size, target_size);
-					if (resamplec) {
+					if (resamplec && target_size > 0) {
 						source_size = target_size;
-						target_size = audio_resample(resamplec, (uint16_t *)obuf, (uint16_t *)ibuf, source_size / isize);
+						target_size = audio_resample(resamplec, (uint16_t *)iov[0].iov_base, (uint16_t *)ibuf, source_size / isize);
 						target_size *= osize;
 						my_log(MY_LOG_NOTICE, "source: resampled frame (size i=%d, o=%d)", source_size, target_size);
-					} else {
-						memcpy(obuf, ibuf, target_size);
 					}
-					source_size = target_size;
-					target_size = my_rbuf_put(my_target.rb, obuf, source_size);
+					target_size = my_rbuf_commit_write(my_target.rb, target_size);
 					if (target_size < 0) {
 						my_log(MY_LOG_ERROR, "target: writing frame");
 					}
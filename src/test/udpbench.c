@@ -0,0 +1,185 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Receives bursts of small datagrams over the loopback interface, either
+ * one read() at a time or 'batch' at a time with recvmmsg(), as the udp
+ * source does with its 'batch' property, and reports the system calls &
+ * time spent per datagram.
+ *
+ * usage: udpbench [datagram size] [datagrams]
+ */
+
+#define _GNU_SOURCE
+
+#include "util/log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define MY_BENCH_BURST 64
+#define MY_BENCH_BATCH_MAX 64
+
+static char my_bench_buf[MY_BENCH_BATCH_MAX * 2048];
+
+static int my_bench_recv(int fd, int batch, int size, int *calls)
+{
+	struct mmsghdr msgs[MY_BENCH_BATCH_MAX];
+	struct iovec iovs[MY_BENCH_BATCH_MAX];
+	int i, n;
+
+	(*calls)++;
+
+	if (batch == 1) {
+		n = read(fd, my_bench_buf, size);
+		return (n < 0) ? -1 : 1;
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < batch; i++) {
+		iovs[i].iov_base = my_bench_buf + i * size;
+		iovs[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return recvmmsg(fd, msgs, batch, MSG_DONTWAIT, NULL);
+}
+
+static int my_bench_run(int rx, int tx, struct sockaddr_in *sa, int batch, int size, int count)
+{
+	char dgram[2048];
+	struct timespec t0, t1;
+	double elapsed = 0;
+	int sent, received, calls, n, i;
+
+	memset(dgram, 0x55, sizeof(dgram));
+	received = calls = 0;
+
+	for (sent = 0; sent < count; sent += MY_BENCH_BURST) {
+		for (i = 0; i < MY_BENCH_BURST; i++) {
+			if (sendto(tx, dgram, size, 0, (struct sockaddr *)sa, sizeof(*sa)) != size) {
+				my_log(MY_LOG_ERROR, "error sending datagram (%s)", strerror(errno));
+				return -1;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		while ((n = my_bench_recv(rx, batch, size, &calls)) > 0) {
+			received += n;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	}
+
+	my_log(MY_LOG_NOTICE, "batch %2d: %6d datagrams in %6d calls (%5.3f calls/datagram), %7.1f ns/datagram",
+		batch, received, calls, (double)calls / received, elapsed * 1e9 / received);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int batches[] = { 1, 4, 16, 64 };
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	int size = 172, count = 100000;
+	int rx, tx, n, i;
+	char *me;
+
+	me = strrchr(argv[0], '/');
+	if (me == NULL ) {
+		me = argv[0];
+	} else {
+		me++;
+	}
+
+	my_log_init(me);
+
+	if (my_log_open("stderr", MY_LOG_DEBUG) != 0) {
+		return 1;
+	}
+
+	if (argc > 1) {
+		size = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		count = atoi(argv[2]);
+	}
+	if ((size <= 0) || (size > 2048)) {
+		my_log(MY_LOG_ERROR, "datagram size out of range (1 - 2048)");
+		goto _MY_ERR_args;
+	}
+
+	rx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	if ((rx < 0) || (tx < 0)) {
+		my_log(MY_LOG_ERROR, "error creating sockets (%s)", strerror(errno));
+		goto _MY_ERR_socket;
+	}
+
+	/* room for a whole burst */
+	n = 1024 * 1024;
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(rx, (struct sockaddr *)&sa, sizeof(sa)) != 0) || (getsockname(rx, (struct sockaddr *)&sa, &sa_len) != 0)) {
+		my_log(MY_LOG_ERROR, "error binding socket (%s)", strerror(errno));
+		goto _MY_ERR_bind;
+	}
+
+	my_log(MY_LOG_NOTICE, "%d datagrams of %d bytes, in bursts of %d", count, size, MY_BENCH_BURST);
+
+	for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+		if (my_bench_run(rx, tx, &sa, batches[i], size, count) != 0) {
+			break;
+		}
+	}
+
+	close(tx);
+	close(rx);
+	my_log_close();
+
+	return 0;
+
+_MY_ERR_bind:
+_MY_ERR_socket:
+	if (tx >= 0) {
+		close(tx);
+	}
+	if (rx >= 0) {
+		close(rx);
+	}
+_MY_ERR_args:
+	my_log_close();
+	return 1;
+}
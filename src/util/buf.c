@@ -0,0 +1,206 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "util/buf.h"
+
+#include "util/mem.h"
+
+struct my_buf_pool_s {
+	pthread_mutex_t lock;
+	my_buf_t *free_list;
+	int size;
+	int count;
+	/* handed out, & whether the pool goes away with the last of them */
+	int used;
+	int destroyed;
+};
+
+/* header & data in a single block, the data starting on its own cache line */
+static my_buf_t *my_buf_create(my_buf_pool_t *pool)
+{
+	my_buf_t *buf;
+
+	buf = my_mem_alloc_aligned(MY_CACHE_LINE_SIZE, sizeof(my_buf_t) + pool->size);
+	if (!buf) {
+		return NULL;
+	}
+
+	buf->pool = pool;
+	buf->size = pool->size;
+	buf->data = (char *)(buf + 1);
+
+	return buf;
+}
+
+my_buf_pool_t *my_buf_pool_create(int size, int count)
+{
+	my_buf_pool_t *pool;
+	my_buf_t *buf;
+
+	if (size <= 0) {
+		errno = EINVAL;
+		goto _MY_ERR_size;
+	}
+
+	pool = my_mem_alloc(sizeof(*pool));
+	if (!pool) {
+		goto _MY_ERR_alloc;
+	}
+
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		goto _MY_ERR_mutex_init;
+	}
+
+	pool->size = size;
+
+	while (pool->count < count) {
+		buf = my_buf_create(pool);
+		if (!buf) {
+			goto _MY_ERR_create_buf;
+		}
+		buf->next = pool->free_list;
+		pool->free_list = buf;
+		pool->count++;
+	}
+
+	return pool;
+
+_MY_ERR_create_buf:
+	while ((buf = pool->free_list)) {
+		pool->free_list = buf->next;
+		my_mem_free(buf);
+	}
+	pthread_mutex_destroy(&pool->lock);
+_MY_ERR_mutex_init:
+	my_mem_free(pool);
+_MY_ERR_alloc:
+_MY_ERR_size:
+	return NULL;
+}
+
+static void my_buf_pool_free(my_buf_pool_t *pool)
+{
+	pthread_mutex_destroy(&pool->lock);
+	my_mem_free(pool);
+}
+
+/* buffers still held elsewhere are freed as they are given back, the pool with the last one */
+void my_buf_pool_destroy(my_buf_pool_t *pool)
+{
+	my_buf_t *buf;
+	int used;
+
+	pthread_mutex_lock(&pool->lock);
+	while ((buf = pool->free_list)) {
+		pool->free_list = buf->next;
+		my_mem_free(buf);
+	}
+	pool->destroyed = 1;
+	used = pool->used;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (used == 0) {
+		my_buf_pool_free(pool);
+	}
+}
+
+int my_buf_pool_get_size(my_buf_pool_t *pool)
+{
+	return pool->size;
+}
+
+
+my_buf_t *my_buf_alloc(my_buf_pool_t *pool)
+{
+	my_buf_t *buf;
+
+	pthread_mutex_lock(&pool->lock);
+	buf = pool->free_list;
+	if (buf) {
+		pool->free_list = buf->next;
+		pool->used++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!buf) {
+		buf = my_buf_create(pool);
+		if (!buf) {
+			return NULL;
+		}
+		pthread_mutex_lock(&pool->lock);
+		pool->count++;
+		pool->used++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	buf->next = NULL;
+	buf->refs = 1;
+	buf->len = 0;
+	buf->timestamp = 0;
+	buf->flags = 0;
+	my_mem_zero(&buf->format, sizeof(buf->format));
+
+	return buf;
+}
+
+my_buf_t *my_buf_ref(my_buf_t *buf)
+{
+	__atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+
+	return buf;
+}
+
+void my_buf_unref(my_buf_t *buf)
+{
+	my_buf_pool_t *pool = buf->pool;
+	int last;
+
+	/* the last holder must see whatever the others did to it */
+	if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->used--;
+	if (!pool->destroyed) {
+		buf->next = pool->free_list;
+		pool->free_list = buf;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+	last = (pool->used == 0);
+	pthread_mutex_unlock(&pool->lock);
+
+	my_mem_free(buf);
+	if (last) {
+		my_buf_pool_free(pool);
+	}
+}
+
+int my_buf_is_shared(my_buf_t *buf)
+{
+	return __atomic_load_n(&buf->refs, __ATOMIC_ACQUIRE) > 1;
+}
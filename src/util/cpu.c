@@ -0,0 +1,66 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "util/cpu.h"
+
+int my_cpu_get_features(void)
+{
+	int features = 0;
+
+#ifdef MY_CPU_HAVE_SSE2
+	features |= MY_CPU_SSE2;
+#endif
+#ifdef MY_CPU_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		features |= MY_CPU_AVX2;
+	}
+#endif
+#ifdef MY_CPU_HAVE_NEON
+	features |= MY_CPU_NEON;
+#endif
+
+	return features;
+}
+
+/* racing callers all pick the same one */
+void *my_cpu_impl_select(void **cache, void **impls, int count)
+{
+	void *impl = __atomic_load_n(cache, __ATOMIC_RELAXED);
+	int features;
+	int i;
+
+	if (impl) {
+		return impl;
+	}
+
+	features = my_cpu_get_features();
+	for (i = 0; i < count; i++) {
+		if ((MY_CPU_IMPL(impls[i])->features & features) == MY_CPU_IMPL(impls[i])->features) {
+			impl = impls[i];
+		}
+	}
+
+	__atomic_store_n(cache, impl, __ATOMIC_RELAXED);
+
+	return impl;
+}
@@ -0,0 +1,415 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "util/buf.h"
+#include "util/cpu.h"
+#include "util/fec.h"
+#include "util/mem.h"
+
+#ifdef MY_CPU_HAVE_SSE2
+# include <emmintrin.h>
+#endif
+#ifdef MY_CPU_HAVE_AVX2
+# include <immintrin.h>
+#endif
+#ifdef MY_CPU_HAVE_NEON
+# include <arm_neon.h>
+#endif
+
+typedef struct my_fec_impl_s my_fec_impl_t;
+
+struct my_fec_impl_s {
+	my_cpu_impl_t _inherited;
+	void (*xor)(uint8_t *dst, const uint8_t *src, int n);
+};
+
+
+static void my_fec_xor_scalar(uint8_t *dst, const uint8_t *src, int n)
+{
+	uint64_t a, b;
+	int i;
+
+	/* a word at a time, through memcpy() as nothing is aligned */
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&a, dst + i, 8);
+		memcpy(&b, src + i, 8);
+		a ^= b;
+		memcpy(dst + i, &a, 8);
+	}
+
+	for (; i < n; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
+static my_fec_impl_t my_fec_scalar = {
+	._inherited = { .name = "scalar", .features = 0 },
+	.xor = my_fec_xor_scalar,
+};
+
+
+#ifdef MY_CPU_HAVE_SSE2
+
+static void my_fec_xor_sse2(uint8_t *dst, const uint8_t *src, int n)
+{
+	__m128i a, b;
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm_loadu_si128((__m128i *)(dst + i));
+		b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, b));
+	}
+
+	my_fec_xor_scalar(dst + i, src + i, n - i);
+}
+
+static my_fec_impl_t my_fec_sse2 = {
+	._inherited = { .name = "sse2", .features = MY_CPU_SSE2 },
+	.xor = my_fec_xor_sse2,
+};
+
+#endif /* MY_CPU_HAVE_SSE2 */
+
+
+#ifdef MY_CPU_HAVE_AVX2
+
+MY_CPU_TARGET_AVX2
+static void my_fec_xor_avx2(uint8_t *dst, const uint8_t *src, int n)
+{
+	__m256i a, b;
+	int i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		a = _mm256_loadu_si256((__m256i *)(dst + i));
+		b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, b));
+	}
+
+	my_fec_xor_scalar(dst + i, src + i, n - i);
+}
+
+static my_fec_impl_t my_fec_avx2 = {
+	._inherited = { .name = "avx2", .features = MY_CPU_AVX2 },
+	.xor = my_fec_xor_avx2,
+};
+
+#endif /* MY_CPU_HAVE_AVX2 */
+
+
+#ifdef MY_CPU_HAVE_NEON
+
+static void my_fec_xor_neon(uint8_t *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+	}
+
+	my_fec_xor_scalar(dst + i, src + i, n - i);
+}
+
+static my_fec_impl_t my_fec_neon = {
+	._inherited = { .name = "neon", .features = MY_CPU_NEON },
+	.xor = my_fec_xor_neon,
+};
+
+#endif /* MY_CPU_HAVE_NEON */
+
+
+static my_fec_impl_t *my_fec_impls[] = {
+	&my_fec_scalar,
+#ifdef MY_CPU_HAVE_SSE2
+	&my_fec_sse2,
+#endif
+#ifdef MY_CPU_HAVE_AVX2
+	&my_fec_avx2,
+#endif
+#ifdef MY_CPU_HAVE_NEON
+	&my_fec_neon,
+#endif
+};
+
+static my_fec_impl_t *my_fec_impl;
+
+static my_fec_impl_t *my_fec_impl_get(void)
+{
+	return my_cpu_impl_select((void **)&my_fec_impl, (void **)my_fec_impls, sizeof(my_fec_impls) / sizeof(my_fec_impls[0]));
+}
+
+void my_fec_xor(void *dst, const void *src, int n)
+{
+	my_fec_impl_get()->xor(dst, src, n);
+}
+
+const char *my_fec_get_impl(void)
+{
+	return MY_CPU_IMPL(my_fec_impl_get())->name;
+}
+
+
+struct my_fec_enc_s {
+	int k;
+	int size;
+	/* header, then payloads XOR, zeroed up to 'len' when a group starts */
+	uint8_t *parity;
+	int len;
+	int count;
+	uint16_t base;
+	uint32_t media_time;
+	uint16_t lens;
+};
+
+my_fec_enc_t *my_fec_enc_create(int k, int size)
+{
+	my_fec_enc_t *enc;
+
+	enc = my_mem_alloc(sizeof(*enc));
+	if (!enc) {
+		goto _MY_ERR_alloc;
+	}
+
+	enc->parity = my_mem_alloc(MY_FEC_HDR_SIZE + size);
+	if (!enc->parity) {
+		goto _MY_ERR_alloc_parity;
+	}
+
+	enc->k = k;
+	enc->size = size;
+
+	return enc;
+
+_MY_ERR_alloc_parity:
+	my_mem_free(enc);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+void my_fec_enc_destroy(my_fec_enc_t *enc)
+{
+	my_mem_free(enc->parity);
+	my_mem_free(enc);
+}
+
+int my_fec_enc_add(my_fec_enc_t *enc, uint16_t seq, uint32_t media_time, const void *data, int len, char **parity)
+{
+	uint8_t *p = enc->parity + MY_FEC_HDR_SIZE;
+	uint8_t *hdr = enc->parity;
+
+	if (len > enc->size) {
+		return -1;
+	}
+
+	if (enc->count == 0) {
+		my_mem_zero(p, enc->len);
+		enc->len = 0;
+		enc->base = seq;
+		enc->media_time = 0;
+		enc->lens = 0;
+	}
+
+	if (len > enc->len) {
+		my_mem_zero(p + enc->len, len - enc->len);
+		enc->len = len;
+	}
+
+	my_fec_xor(p, data, len);
+	enc->media_time ^= media_time;
+	enc->lens ^= len;
+
+	if (++enc->count < enc->k) {
+		return 0;
+	}
+	enc->count = 0;
+
+	hdr[0] = enc->base >> 8;
+	hdr[1] = enc->base;
+	hdr[2] = enc->k;
+	hdr[3] = 0;
+	hdr[4] = enc->media_time >> 24;
+	hdr[5] = enc->media_time >> 16;
+	hdr[6] = enc->media_time >> 8;
+	hdr[7] = enc->media_time;
+	hdr[8] = enc->lens >> 8;
+	hdr[9] = enc->lens;
+	hdr[10] = 0;
+	hdr[11] = 0;
+
+	*parity = (char *)enc->parity;
+
+	return MY_FEC_HDR_SIZE + enc->len;
+}
+
+struct my_fec_dec_s {
+	my_buf_t **slots;
+	int mask;
+	uint64_t recovered;
+	uint64_t unrecoverable;
+};
+
+my_fec_dec_t *my_fec_dec_create(int window)
+{
+	my_fec_dec_t *dec;
+	int size = 2;
+
+	while (size < window) {
+		size <<= 1;
+	}
+
+	dec = my_mem_alloc(sizeof(*dec));
+	if (!dec) {
+		goto _MY_ERR_alloc;
+	}
+
+	dec->slots = my_mem_alloc(size * sizeof(my_buf_t *));
+	if (!dec->slots) {
+		goto _MY_ERR_alloc_slots;
+	}
+	dec->mask = size - 1;
+
+	return dec;
+
+_MY_ERR_alloc_slots:
+	my_mem_free(dec);
+_MY_ERR_alloc:
+	return NULL;
+}
+
+void my_fec_dec_destroy(my_fec_dec_t *dec)
+{
+	int i;
+
+	for (i = 0; i <= dec->mask; i++) {
+		if (dec->slots[i]) {
+			my_buf_unref(dec->slots[i]);
+		}
+	}
+
+	my_mem_free(dec->slots);
+	my_mem_free(dec);
+}
+
+void my_fec_dec_add(my_fec_dec_t *dec, my_buf_t *buf)
+{
+	my_buf_t **slot = &dec->slots[buf->seq & dec->mask];
+
+	if (*slot) {
+		my_buf_unref(*slot);
+	}
+	*slot = my_buf_ref(buf);
+}
+
+static my_buf_t *my_fec_dec_find(my_fec_dec_t *dec, uint16_t seq)
+{
+	my_buf_t *buf = dec->slots[seq & dec->mask];
+
+	return (buf && (buf->seq == seq)) ? buf : NULL;
+}
+
+my_buf_t *my_fec_dec_recover(my_fec_dec_t *dec, const void *parity, int len, my_buf_pool_t *pool)
+{
+	const uint8_t *hdr = parity;
+	my_buf_t *bufs[MY_FEC_K_MAX];
+	my_buf_t *buf;
+	uint16_t base, seq, lens;
+	uint32_t media_time;
+	int k, missing, found;
+	int i, n;
+
+	if (len < MY_FEC_HDR_SIZE) {
+		return NULL;
+	}
+
+	base = (hdr[0] << 8) | hdr[1];
+	k = hdr[2];
+	media_time = ((uint32_t)hdr[4] << 24) | (hdr[5] << 16) | (hdr[6] << 8) | hdr[7];
+	lens = (hdr[8] << 8) | hdr[9];
+
+	if ((k < 1) || (k > MY_FEC_K_MAX) || (k > dec->mask + 1)) {
+		return NULL;
+	}
+
+	missing = -1;
+	for (i = 0, found = 0; i < k; i++) {
+		seq = base + i;
+		buf = my_fec_dec_find(dec, seq);
+		if (buf) {
+			bufs[found++] = buf;
+			continue;
+		}
+		if (missing >= 0) {
+			dec->unrecoverable++;
+			return NULL;
+		}
+		missing = seq;
+	}
+
+	if (missing < 0) {
+		return NULL;
+	}
+
+	for (i = 0; i < found; i++) {
+		lens ^= bufs[i]->len;
+		media_time ^= bufs[i]->media_time;
+	}
+
+	buf = my_buf_alloc(pool);
+	if (!buf) {
+		return NULL;
+	}
+
+	if ((lens > len - MY_FEC_HDR_SIZE) || (lens > buf->size)) {
+		my_buf_unref(buf);
+		dec->unrecoverable++;
+		return NULL;
+	}
+
+	my_mem_copy(buf->data, (void *)(hdr + MY_FEC_HDR_SIZE), lens);
+	for (i = 0; i < found; i++) {
+		n = (bufs[i]->len < lens) ? bufs[i]->len : lens;
+		my_fec_xor(buf->data, bufs[i]->data, n);
+	}
+
+	buf->len = lens;
+	buf->flags |= MY_BUF_SEQUENCED;
+	buf->seq = missing;
+	buf->media_time = media_time;
+
+	my_fec_dec_add(dec, buf);
+	dec->recovered++;
+
+	return buf;
+}
+
+uint64_t my_fec_dec_get_recovered(my_fec_dec_t *dec)
+{
+	return dec->recovered;
+}
+
+uint64_t my_fec_dec_get_unrecoverable(my_fec_dec_t *dec)
+{
+	return dec->unrecoverable;
+}
@@ -32,11 +32,13 @@ static void my_list_init(my_list_t *list) {
 
 static void my_list_add_head(my_list_t *list, my_node_t *node)
 {
+	node->prev = NULL;
 	if (list->head) {
 		node->next = list->head;
 		list->head->prev = node;
 		list->head = node;
 	} else {
+		node->next = NULL;
 		list->head = list->tail = node;
 	}
 }
@@ -45,7 +47,7 @@ void my_list_insert_before(my_list_t *list, my_node_t *node, void *data)
 {
 	my_node_t *new_node;
 
-	new_node = my_mem_alloc(sizeof(*new_node));
+	new_node = my_mem_alloc_nozero(sizeof(*new_node));
 	if (!new_node)
 		return;
 
@@ -65,11 +67,13 @@ void my_list_insert_before(my_list_t *list, my_node_t *node, void *data)
 
 static void my_list_add_tail(my_list_t *list, my_node_t *node)
 {
+	node->next = NULL;
 	if (list->tail) {
 		node->prev = list->tail;
 		list->tail->next = node;
 		list->tail = node;
 	} else {
+		node->prev = NULL;
 		list->tail = list->head = node;
 	}
 }
@@ -190,7 +194,7 @@ int my_list_enqueue_head(my_list_t *list, void *data)
 {
 	my_node_t *node;
 
-	node = my_mem_alloc(sizeof(*node));
+	node = my_mem_alloc_nozero(sizeof(*node));
 	if (node) {
 		my_list_add_head(list, node);
 		node->data = data;
@@ -204,7 +208,7 @@ int my_list_enqueue_tail(my_list_t *list, void *data)
 {
 	my_node_t *node;
 
-	node = my_mem_alloc(sizeof(*node));
+	node = my_mem_alloc_nozero(sizeof(*node));
 	if (node) {
 		my_list_add_tail(list, node);
 		node->data = data;
@@ -247,3 +251,35 @@ void my_list_purge(my_list_t *list, int flags)
 }
 
 
+void my_ilist_init(my_link_t *head)
+{
+	head->prev = head->next = head;
+}
+
+int my_ilist_is_empty(my_link_t *head)
+{
+	return (head->next == head);
+}
+
+void my_ilist_add_head(my_link_t *head, my_link_t *link)
+{
+	link->prev = head;
+	link->next = head->next;
+	head->next->prev = link;
+	head->next = link;
+}
+
+void my_ilist_add_tail(my_link_t *head, my_link_t *link)
+{
+	link->next = head;
+	link->prev = head->prev;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+void my_ilist_remove(my_link_t *link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link->next = link;
+}
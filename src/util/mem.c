@@ -20,14 +20,272 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "util/mem.h"
 
+/*
+ * Blocks up to MY_MEM_CLASS_MAX bytes come from size classes, carved out of
+ * slabs which are never given back, and are recycled through a cache kept
+ * by each thread, so that the hot paths (list nodes, alarms, event handlers)
+ * don't go through the heap & its lock. Caches exchange blocks in batches
+ * with a shared depot. Larger blocks come from the heap.
+ *
+ * Every block is preceded by a header telling my_mem_free() where it came
+ * from, so that blocks may be freed by any thread.
+ */
+
+/* address sanitizers only see what goes through the heap */
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define MY_MEM_NO_SLABS
+#endif
+
+#define MY_MEM_HDR_SIZE (sizeof(my_mem_hdr_t))
+#define MY_MEM_SLAB_SIZE 65536
+#define MY_MEM_CLASS_MAX 2048
+/* blocks of a class kept by a thread, & moved at once from/to the depot */
+#define MY_MEM_CACHE_MAX 128
+#define MY_MEM_CACHE_BATCH 32
+
+#define MY_MEM_CLASS_HEAP    -1
+#define MY_MEM_CLASS_ALIGNED -2
+#define MY_MEM_CLASS_ARENA   -3
+
+#define MY_MEM_ARENA_ALIGN 16
+
+typedef struct my_mem_hdr_s my_mem_hdr_t;
+
+struct my_mem_hdr_s {
+	int cls;
+	/* start of the allocation, for aligned blocks */
+	void *base;
+} __attribute__((aligned(16)));
+
+/* a free block, linked through its payload */
+typedef struct my_mem_free_s my_mem_free_t;
+
+struct my_mem_free_s {
+	my_mem_free_t *next;
+};
+
+typedef struct my_mem_cache_s my_mem_cache_t;
+
+static const int my_mem_class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+#define MY_MEM_CLASS_COUNT ((int)(sizeof(my_mem_class_sizes) / sizeof(my_mem_class_sizes[0])))
+
+struct my_mem_cache_s {
+	my_mem_free_t *free_list[MY_MEM_CLASS_COUNT];
+	int count[MY_MEM_CLASS_COUNT];
+	int registered;
+};
+
+typedef struct my_mem_arena_chunk_s my_mem_arena_chunk_t;
+
+struct my_mem_arena_chunk_s {
+	my_mem_arena_chunk_t *next;
+	int size;
+	int used;
+} __attribute__((aligned(MY_MEM_ARENA_ALIGN)));
+
+struct my_mem_arena_s {
+	my_mem_arena_chunk_t *chunks;
+	int chunk_size;
+};
+
+static pthread_mutex_t my_mem_depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static my_mem_free_t *my_mem_depot[MY_MEM_CLASS_COUNT];
+
+static pthread_once_t my_mem_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t my_mem_key;
+
+static __thread my_mem_cache_t my_mem_cache;
+static __thread my_mem_arena_t *my_mem_arena;
+
+#define MY_MEM_HDR(p) ((my_mem_hdr_t *)((char *)(p) - MY_MEM_HDR_SIZE))
+#define MY_MEM_DATA(h) ((void *)((char *)(h) + MY_MEM_HDR_SIZE))
+
+static int my_mem_class_lookup(int n)
+{
+#ifdef MY_MEM_NO_SLABS
+	return MY_MEM_CLASS_HEAP;
+#else
+	int cls;
+
+	if (n > MY_MEM_CLASS_MAX) {
+		return MY_MEM_CLASS_HEAP;
+	}
+
+	for (cls = 0; my_mem_class_sizes[cls] < n; cls++);
+
+	return cls;
+#endif
+}
+
+/* give the blocks cached by an exiting thread back to the depot */
+static void my_mem_cache_release(void *p)
+{
+	my_mem_cache_t *cache = p;
+	my_mem_free_t *block;
+	int cls;
+
+	pthread_mutex_lock(&my_mem_depot_lock);
+	for (cls = 0; cls < MY_MEM_CLASS_COUNT; cls++) {
+		while ((block = cache->free_list[cls])) {
+			cache->free_list[cls] = block->next;
+			block->next = my_mem_depot[cls];
+			my_mem_depot[cls] = block;
+		}
+		cache->count[cls] = 0;
+	}
+	pthread_mutex_unlock(&my_mem_depot_lock);
+}
+
+static void my_mem_key_create(void)
+{
+	pthread_key_create(&my_mem_key, my_mem_cache_release);
+}
+
+/* with the depot lock held */
+static int my_mem_slab_create(int cls)
+{
+	int block_size = MY_MEM_HDR_SIZE + my_mem_class_sizes[cls];
+	my_mem_hdr_t *hdr;
+	my_mem_free_t *block;
+	char *slab;
+	int i;
+
+	slab = malloc(MY_MEM_SLAB_SIZE);
+	if (!slab) {
+		return -1;
+	}
+
+	for (i = 0; i + block_size <= MY_MEM_SLAB_SIZE; i += block_size) {
+		hdr = (my_mem_hdr_t *)(slab + i);
+		hdr->cls = cls;
+		hdr->base = NULL;
+		block = MY_MEM_DATA(hdr);
+		block->next = my_mem_depot[cls];
+		my_mem_depot[cls] = block;
+	}
+
+	return 0;
+}
+
+static int my_mem_cache_refill(my_mem_cache_t *cache, int cls)
+{
+	my_mem_free_t *block;
+	int i;
+
+	if (!cache->registered) {
+		pthread_once(&my_mem_key_once, my_mem_key_create);
+		pthread_setspecific(my_mem_key, cache);
+		cache->registered = 1;
+	}
+
+	pthread_mutex_lock(&my_mem_depot_lock);
+	if (!my_mem_depot[cls] && (my_mem_slab_create(cls) != 0)) {
+		pthread_mutex_unlock(&my_mem_depot_lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; (i < MY_MEM_CACHE_BATCH) && (block = my_mem_depot[cls]); i++) {
+		my_mem_depot[cls] = block->next;
+		block->next = cache->free_list[cls];
+		cache->free_list[cls] = block;
+		cache->count[cls]++;
+	}
+	pthread_mutex_unlock(&my_mem_depot_lock);
+
+	return 0;
+}
+
+static void my_mem_cache_spill(my_mem_cache_t *cache, int cls)
+{
+	my_mem_free_t *block;
+	int i;
+
+	pthread_mutex_lock(&my_mem_depot_lock);
+	for (i = 0; i < MY_MEM_CACHE_BATCH; i++) {
+		block = cache->free_list[cls];
+		cache->free_list[cls] = block->next;
+		block->next = my_mem_depot[cls];
+		my_mem_depot[cls] = block;
+	}
+	cache->count[cls] -= MY_MEM_CACHE_BATCH;
+	pthread_mutex_unlock(&my_mem_depot_lock);
+}
+
+static void *my_mem_arena_carve(my_mem_arena_t *arena, int n)
+{
+	my_mem_arena_chunk_t *chunk = arena->chunks;
+	my_mem_hdr_t *hdr;
+	int size, chunk_size;
+
+	size = (MY_MEM_HDR_SIZE + n + MY_MEM_ARENA_ALIGN - 1) & ~(MY_MEM_ARENA_ALIGN - 1);
+
+	if (!chunk || (chunk->used + size > chunk->size)) {
+		chunk_size = (size > arena->chunk_size) ? size : arena->chunk_size;
+		chunk = malloc(sizeof(*chunk) + chunk_size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	hdr = (my_mem_hdr_t *)((char *)(chunk + 1) + chunk->used);
+	chunk->used += size;
+	hdr->cls = MY_MEM_CLASS_ARENA;
+	hdr->base = arena;
+
+	return MY_MEM_DATA(hdr);
+}
+
+void *my_mem_alloc_nozero(int n)
+{
+	my_mem_cache_t *cache = &my_mem_cache;
+	my_mem_free_t *block;
+	my_mem_hdr_t *hdr;
+	int cls;
+
+	if (my_mem_arena) {
+		return my_mem_arena_carve(my_mem_arena, n);
+	}
+
+	cls = my_mem_class_lookup(n);
+	if (cls == MY_MEM_CLASS_HEAP) {
+		hdr = malloc(MY_MEM_HDR_SIZE + n);
+		if (!hdr) {
+			return NULL;
+		}
+		hdr->cls = MY_MEM_CLASS_HEAP;
+		hdr->base = NULL;
+		return MY_MEM_DATA(hdr);
+	}
+
+	if (!cache->free_list[cls] && (my_mem_cache_refill(cache, cls) != 0)) {
+		return NULL;
+	}
+
+	block = cache->free_list[cls];
+	cache->free_list[cls] = block->next;
+	cache->count[cls]--;
+
+	return block;
+}
+
 void *my_mem_alloc(int n)
 {
-	void *p = malloc(n);
+	void *p = my_mem_alloc_nozero(n);
 	
 	if (p) {
 		memset(p, 0, n);
@@ -36,9 +294,62 @@ void *my_mem_alloc(int n)
 	return p;
 }
 
+void *my_mem_alloc_aligned(int align, int n)
+{
+	my_mem_hdr_t *hdr;
+	void *base;
+	int rc;
+
+	/* the header goes just below the returned block, in what alignment wastes */
+	if (align < MY_MEM_HDR_SIZE) {
+		align = MY_MEM_HDR_SIZE;
+	}
+
+	rc = posix_memalign(&base, align, align + n);
+	if (rc != 0) {
+		errno = rc;
+		return NULL;
+	}
+
+	hdr = (my_mem_hdr_t *)((char *)base + align - MY_MEM_HDR_SIZE);
+	hdr->cls = MY_MEM_CLASS_ALIGNED;
+	hdr->base = base;
+	memset(MY_MEM_DATA(hdr), 0, n);
+
+	return MY_MEM_DATA(hdr);
+}
+
 void my_mem_free(void *p)
 {
-	free(p);
+	my_mem_cache_t *cache = &my_mem_cache;
+	my_mem_free_t *block = p;
+	my_mem_hdr_t *hdr;
+	int cls;
+
+	if (!p) {
+		return;
+	}
+
+	hdr = MY_MEM_HDR(p);
+	cls = hdr->cls;
+
+	switch (cls) {
+	case MY_MEM_CLASS_HEAP:
+		free(hdr);
+		return;
+	case MY_MEM_CLASS_ALIGNED:
+		free(hdr->base);
+		return;
+	case MY_MEM_CLASS_ARENA:
+		/* released along with its arena */
+		return;
+	}
+
+	block->next = cache->free_list[cls];
+	cache->free_list[cls] = block;
+	if (++cache->count[cls] > MY_MEM_CACHE_MAX) {
+		my_mem_cache_spill(cache, cls);
+	}
 }
 
 void my_mem_zero(void *p, int n)
@@ -51,3 +362,42 @@ void my_mem_copy(void *pt, void *ps, int n)
 	memcpy(pt, ps, n);
 }
 
+my_mem_arena_t *my_mem_arena_create(int chunk_size)
+{
+	my_mem_arena_t *arena;
+
+	arena = my_mem_alloc(sizeof(*arena));
+	if (!arena) {
+		return NULL;
+	}
+
+	arena->chunk_size = (chunk_size > 0) ? chunk_size : MY_MEM_ARENA_CHUNK_SIZE;
+
+	return arena;
+}
+
+void my_mem_arena_destroy(my_mem_arena_t *arena)
+{
+	my_mem_arena_chunk_t *chunk;
+
+	while ((chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	my_mem_free(arena);
+}
+
+my_mem_arena_t *my_mem_arena_enter(my_mem_arena_t *arena)
+{
+	my_mem_arena_t *prev = my_mem_arena;
+
+	my_mem_arena = arena;
+
+	return prev;
+}
+
+void my_mem_arena_leave(my_mem_arena_t *prev)
+{
+	my_mem_arena = prev;
+}
@@ -0,0 +1,291 @@
+/*
+ *  ummd ( Micro MultiMedia Daemon )
+ *
+ *  Copyright (C) 2010 Nicolas Thill <nicolas.thill@gmail.com>
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdint.h>
+
+#include "util/cpu.h"
+#include "util/mix.h"
+
+#ifdef MY_CPU_HAVE_SSE2
+# include <emmintrin.h>
+#endif
+#ifdef MY_CPU_HAVE_AVX2
+# include <immintrin.h>
+#endif
+#ifdef MY_CPU_HAVE_NEON
+# include <arm_neon.h>
+#endif
+
+typedef struct my_mix_impl_s my_mix_impl_t;
+
+struct my_mix_impl_s {
+	my_cpu_impl_t _inherited;
+	void (*add_s16)(int16_t *dst, const int16_t *src, int n);
+	void (*add_f32)(float *dst, const float *src, int n);
+	void (*clamp_f32)(float *dst, int n);
+};
+
+
+static void my_mix_add_s16_scalar(int16_t *dst, const int16_t *src, int n)
+{
+	int i, v;
+
+	for (i = 0; i < n; i++) {
+		v = dst[i] + src[i];
+		if (v > INT16_MAX) {
+			v = INT16_MAX;
+		} else if (v < INT16_MIN) {
+			v = INT16_MIN;
+		}
+		dst[i] = v;
+	}
+}
+
+static void my_mix_add_f32_scalar(float *dst, const float *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] += src[i];
+	}
+}
+
+static void my_mix_clamp_f32_scalar(float *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (dst[i] > 1.0f) {
+			dst[i] = 1.0f;
+		} else if (dst[i] < -1.0f) {
+			dst[i] = -1.0f;
+		}
+	}
+}
+
+static my_mix_impl_t my_mix_scalar = {
+	._inherited = { .name = "scalar", .features = 0 },
+	.add_s16 = my_mix_add_s16_scalar,
+	.add_f32 = my_mix_add_f32_scalar,
+	.clamp_f32 = my_mix_clamp_f32_scalar,
+};
+
+
+#ifdef MY_CPU_HAVE_SSE2
+
+static void my_mix_add_s16_sse2(int16_t *dst, const int16_t *src, int n)
+{
+	__m128i a, b;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm_loadu_si128((__m128i *)(dst + i));
+		b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(a, b));
+	}
+
+	my_mix_add_s16_scalar(dst + i, src + i, n - i);
+}
+
+static void my_mix_add_f32_sse2(float *dst, const float *src, int n)
+{
+	__m128 a, b;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(dst + i);
+		b = _mm_loadu_ps(src + i);
+		_mm_storeu_ps(dst + i, _mm_add_ps(a, b));
+	}
+
+	my_mix_add_f32_scalar(dst + i, src + i, n - i);
+}
+
+static void my_mix_clamp_f32_sse2(float *dst, int n)
+{
+	__m128 hi = _mm_set1_ps(1.0f);
+	__m128 lo = _mm_set1_ps(-1.0f);
+	__m128 a;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(dst + i);
+		_mm_storeu_ps(dst + i, _mm_max_ps(_mm_min_ps(a, hi), lo));
+	}
+
+	my_mix_clamp_f32_scalar(dst + i, n - i);
+}
+
+static my_mix_impl_t my_mix_sse2 = {
+	._inherited = { .name = "sse2", .features = MY_CPU_SSE2 },
+	.add_s16 = my_mix_add_s16_sse2,
+	.add_f32 = my_mix_add_f32_sse2,
+	.clamp_f32 = my_mix_clamp_f32_sse2,
+};
+
+#endif /* MY_CPU_HAVE_SSE2 */
+
+
+#ifdef MY_CPU_HAVE_AVX2
+
+MY_CPU_TARGET_AVX2
+static void my_mix_add_s16_avx2(int16_t *dst, const int16_t *src, int n)
+{
+	__m256i a, b;
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm256_loadu_si256((__m256i *)(dst + i));
+		b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epi16(a, b));
+	}
+
+	my_mix_add_s16_scalar(dst + i, src + i, n - i);
+}
+
+MY_CPU_TARGET_AVX2
+static void my_mix_add_f32_avx2(float *dst, const float *src, int n)
+{
+	__m256 a, b;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm256_loadu_ps(dst + i);
+		b = _mm256_loadu_ps(src + i);
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(a, b));
+	}
+
+	my_mix_add_f32_scalar(dst + i, src + i, n - i);
+}
+
+MY_CPU_TARGET_AVX2
+static void my_mix_clamp_f32_avx2(float *dst, int n)
+{
+	__m256 hi = _mm256_set1_ps(1.0f);
+	__m256 lo = _mm256_set1_ps(-1.0f);
+	__m256 a;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm256_loadu_ps(dst + i);
+		_mm256_storeu_ps(dst + i, _mm256_max_ps(_mm256_min_ps(a, hi), lo));
+	}
+
+	my_mix_clamp_f32_scalar(dst + i, n - i);
+}
+
+static my_mix_impl_t my_mix_avx2 = {
+	._inherited = { .name = "avx2", .features = MY_CPU_AVX2 },
+	.add_s16 = my_mix_add_s16_avx2,
+	.add_f32 = my_mix_add_f32_avx2,
+	.clamp_f32 = my_mix_clamp_f32_avx2,
+};
+
+#endif /* MY_CPU_HAVE_AVX2 */
+
+
+#ifdef MY_CPU_HAVE_NEON
+
+static void my_mix_add_s16_neon(int16_t *dst, const int16_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+	}
+
+	my_mix_add_s16_scalar(dst + i, src + i, n - i);
+}
+
+static void my_mix_add_f32_neon(float *dst, const float *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+	}
+
+	my_mix_add_f32_scalar(dst + i, src + i, n - i);
+}
+
+static void my_mix_clamp_f32_neon(float *dst, int n)
+{
+	float32x4_t hi = vdupq_n_f32(1.0f);
+	float32x4_t lo = vdupq_n_f32(-1.0f);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		vst1q_f32(dst + i, vmaxq_f32(vminq_f32(vld1q_f32(dst + i), hi), lo));
+	}
+
+	my_mix_clamp_f32_scalar(dst + i, n - i);
+}
+
+static my_mix_impl_t my_mix_neon = {
+	._inherited = { .name = "neon", .features = MY_CPU_NEON },
+	.add_s16 = my_mix_add_s16_neon,
+	.add_f32 = my_mix_add_f32_neon,
+	.clamp_f32 = my_mix_clamp_f32_neon,
+};
+
+#endif /* MY_CPU_HAVE_NEON */
+
+
+static my_mix_impl_t *my_mix_impls[] = {
+	&my_mix_scalar,
+#ifdef MY_CPU_HAVE_SSE2
+	&my_mix_sse2,
+#endif
+#ifdef MY_CPU_HAVE_AVX2
+	&my_mix_avx2,
+#endif
+#ifdef MY_CPU_HAVE_NEON
+	&my_mix_neon,
+#endif
+};
+
+static my_mix_impl_t *my_mix_impl;
+
+static my_mix_impl_t *my_mix_impl_get(void)
+{
+	return my_cpu_impl_select((void **)&my_mix_impl, (void **)my_mix_impls, sizeof(my_mix_impls) / sizeof(my_mix_impls[0]));
+}
+
+void my_mix_add_s16(int16_t *dst, const int16_t *src, int n)
+{
+	my_mix_impl_get()->add_s16(dst, src, n);
+}
+
+void my_mix_add_f32(float *dst, const float *src, int n)
+{
+	my_mix_impl_get()->add_f32(dst, src, n);
+}
+
+void my_mix_clamp_f32(float *dst, int n)
+{
+	my_mix_impl_get()->clamp_f32(dst, n);
+}
+
+const char *my_mix_get_impl(void)
+{
+	return MY_CPU_IMPL(my_mix_impl_get())->name;
+}
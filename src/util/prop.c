@@ -20,6 +20,8 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,36 +29,232 @@
 
 #include "util/mem.h"
 
+#define MY_PROPS_INITIAL_SIZE 8
+#define MY_PROP_INTERN_INITIAL_SIZE 256
+
+#define MY_PROP_CACHED_INT      0x0001
+#define MY_PROP_CACHED_FLOAT    0x0002
+#define MY_PROP_CACHED_BOOL     0x0004
+#define MY_PROP_CACHED_DURATION 0x0008
+/* the value didn't parse as the cached type, use the default */
+#define MY_PROP_INVALID_INT      0x0100
+#define MY_PROP_INVALID_FLOAT    0x0200
+#define MY_PROP_INVALID_BOOL     0x0400
+#define MY_PROP_INVALID_DURATION 0x0800
+
 typedef struct my_prop_s my_prop_t;
 
 struct my_prop_s {
 	char *name;
 	char *value;
+	unsigned int hash;
+	int flags;
+	int int_value;
+	int bool_value;
+	double float_value;
+	uint64_t duration_value;
+};
+
+struct my_props_s {
+	/* in insertion order */
+	my_prop_t *entries;
+	int count;
+	int size;
+	/* open addressing, indexes in 'entries' or -1 for empty slots */
+	int *slots;
+	int slot_mask;
 };
 
-#define MY_PROP(p) ((my_prop_t *)(p))
+/*
+ * interned names, shared by all stores & never freed: allocated with libc,
+ * not to end up in whatever memory arena the caller happens to be using
+ */
+static pthread_mutex_t my_prop_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **my_prop_intern_slots;
+static int my_prop_intern_mask;
+static int my_prop_intern_count;
+
+/* FNV-1a */
+static unsigned int my_prop_hash(char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static int my_prop_intern_grow(void)
+{
+	char **slots;
+	int mask, i, j;
+
+	mask = my_prop_intern_slots ? (my_prop_intern_mask << 1) | 1 : MY_PROP_INTERN_INITIAL_SIZE - 1;
+	slots = calloc(mask + 1, sizeof(char *));
+	if (!slots) {
+		return -1;
+	}
+
+	if (my_prop_intern_slots) {
+		for (i = 0; i <= my_prop_intern_mask; i++) {
+			if (!my_prop_intern_slots[i]) {
+				continue;
+			}
+			for (j = my_prop_hash(my_prop_intern_slots[i]) & mask; slots[j]; j = (j + 1) & mask);
+			slots[j] = my_prop_intern_slots[i];
+		}
+		free(my_prop_intern_slots);
+	}
+
+	my_prop_intern_slots = slots;
+	my_prop_intern_mask = mask;
+
+	return 0;
+}
+
+static char *my_prop_intern(char *name, unsigned int hash)
+{
+	char *p = NULL;
+	int i;
+
+	pthread_mutex_lock(&my_prop_intern_lock);
+
+	if (!my_prop_intern_slots || (4 * (my_prop_intern_count + 1) > 3 * (my_prop_intern_mask + 1))) {
+		if (my_prop_intern_grow() != 0) {
+			goto out;
+		}
+	}
+
+	for (i = hash & my_prop_intern_mask; my_prop_intern_slots[i]; i = (i + 1) & my_prop_intern_mask) {
+		if (strcmp(my_prop_intern_slots[i], name) == 0) {
+			p = my_prop_intern_slots[i];
+			goto out;
+		}
+	}
+
+	p = strdup(name);
+	if (p) {
+		my_prop_intern_slots[i] = p;
+		my_prop_intern_count++;
+	}
 
-static my_prop_t *my_prop_priv_find(my_list_t *list, char *name)
+out:
+	pthread_mutex_unlock(&my_prop_intern_lock);
+	return p;
+}
+
+static int my_prop_priv_slot(my_props_t *props, char *name, unsigned int hash)
 {
-	my_node_t *node;
 	my_prop_t *prop;
+	int i, n;
 
-	for (node = list->head; node; node = node->next) {
-		prop = MY_PROP(node->data);
-		if (strcmp(prop->name, name) == 0) {
-			return prop;
+	for (i = hash & props->slot_mask; (n = props->slots[i]) >= 0; i = (i + 1) & props->slot_mask) {
+		prop = &props->entries[n];
+		if ((prop->hash == hash) && ((prop->name == name) || (strcmp(prop->name, name) == 0))) {
+			break;
 		}
 	}
 
+	return i;
+}
+
+static my_prop_t *my_prop_priv_find(my_props_t *props, char *name)
+{
+	int n;
+
+	if (!props->count) {
+		return NULL;
+	}
+
+	n = props->slots[my_prop_priv_slot(props, name, my_prop_hash(name))];
+
+	return (n >= 0) ? &props->entries[n] : NULL;
+}
+
+static int my_props_grow(my_props_t *props)
+{
+	my_prop_t *entries;
+	int *slots;
+	int size, mask, i;
+
+	size = props->size ? props->size * 2 : MY_PROPS_INITIAL_SIZE;
+
+	entries = my_mem_alloc_nozero(size * sizeof(my_prop_t));
+	if (!entries) {
+		goto _MY_ERR_alloc_entries;
+	}
+
+	/* twice as many slots as entries, keeping the load under 1/2 */
+	mask = 2 * size - 1;
+	slots = my_mem_alloc_nozero((mask + 1) * sizeof(int));
+	if (!slots) {
+		goto _MY_ERR_alloc_slots;
+	}
+	memset(slots, 0xff, (mask + 1) * sizeof(int));
+
+	if (props->count) {
+		my_mem_copy(entries, props->entries, props->count * sizeof(my_prop_t));
+	}
+	my_mem_free(props->entries);
+	my_mem_free(props->slots);
+
+	props->entries = entries;
+	props->size = size;
+	props->slots = slots;
+	props->slot_mask = mask;
+
+	for (i = 0; i < props->count; i++) {
+		props->slots[my_prop_priv_slot(props, entries[i].name, entries[i].hash)] = i;
+	}
+
+	return 0;
+
+_MY_ERR_alloc_slots:
+	my_mem_free(entries);
+_MY_ERR_alloc_entries:
+	return -1;
+}
+
+my_props_t *my_props_create(void)
+{
+	my_props_t *props;
+
+	props = my_mem_alloc(sizeof(*props));
+	if (!props) {
+		goto _MY_ERR_alloc;
+	}
+
+	if (my_props_grow(props) != 0) {
+		goto _MY_ERR_grow;
+	}
+
+	return props;
+
+_MY_ERR_grow:
+	my_mem_free(props);
+_MY_ERR_alloc:
 	return NULL;
 }
 
-int my_prop_add(my_list_t *list, char *name, char *value)
+void my_props_destroy(my_props_t *props)
+{
+	my_prop_purge(props);
+	my_mem_free(props->slots);
+	my_mem_free(props->entries);
+	my_mem_free(props);
+}
+
+int my_prop_add(my_props_t *props, char *name, char *value)
 {
 	my_prop_t *prop;
+	unsigned int hash;
 	char *p;
+	int i;
 
-	prop = my_prop_priv_find(list, name);
+	prop = my_prop_priv_find(props, name);
 	if (prop) {
 		p = strdup(value);
 		if (!p) {
@@ -64,45 +262,43 @@ int my_prop_add(my_list_t *list, char *name, char *value)
 		}
 		free(prop->value);
 		prop->value = p;
+		prop->flags = 0;
 		return 0;
 	}
 
-	prop = my_mem_alloc(sizeof(*prop));
-	if (!prop) {
-		goto _MY_ERR_alloc;
+	if ((props->count == props->size) && (my_props_grow(props) != 0)) {
+		goto _MY_ERR_grow;
 	}
-	p = strdup(name);
-	if (!p) {
+
+	hash = my_prop_hash(name);
+	prop = &props->entries[props->count];
+	prop->hash = hash;
+	prop->flags = 0;
+	prop->name = my_prop_intern(name, hash);
+	if (!prop->name) {
 		goto _MY_ERR_set_name;
 	}
-	prop->name = p;
-	p = strdup(value);
-	if (!p) {
+	prop->value = strdup(value);
+	if (!prop->value) {
 		goto _MY_ERR_set_value;
 	}
-	prop->value = p;
-	if (my_list_enqueue(list, prop) != 0) {
-		goto _MY_ERR_add;
-	}
+
+	i = my_prop_priv_slot(props, prop->name, hash);
+	props->slots[i] = props->count++;
 
 	return 0;
 
-	my_list_dequeue(list);
-_MY_ERR_add:
-	free(prop->value);
 _MY_ERR_set_value:
-	free(prop->name);
 _MY_ERR_set_name:
-	my_mem_free(prop);
-_MY_ERR_alloc:
+_MY_ERR_grow:
 	return -1;
 }
 
-char *my_prop_lookup(my_list_t *list, char *name)
+char *my_prop_lookup(my_props_t *props, char *name)
 {
 	my_prop_t *prop;
 
-	prop = my_prop_priv_find(list, name);
+	prop = my_prop_priv_find(props, name);
 	if (prop) {
 		return prop->value;
 	}
@@ -110,30 +306,143 @@ char *my_prop_lookup(my_list_t *list, char *name)
 	return NULL;
 }
 
-void my_prop_purge(my_list_t *list)
+int my_prop_lookup_int(my_props_t *props, char *name, int def)
 {
 	my_prop_t *prop;
+	char *end;
+	long n;
 
-	while (prop = my_list_dequeue(list)) {
-		free(prop->name);
-		free(prop->value);
-		my_mem_free(prop);
+	prop = my_prop_priv_find(props, name);
+	if (!prop) {
+		return def;
+	}
+
+	if (!(prop->flags & MY_PROP_CACHED_INT)) {
+		errno = 0;
+		n = strtol(prop->value, &end, 0);
+		if ((end == prop->value) || (*end != '\0') || errno || (n != (int)n)) {
+			prop->flags |= MY_PROP_INVALID_INT;
+		}
+		prop->int_value = n;
+		prop->flags |= MY_PROP_CACHED_INT;
+	}
+
+	return (prop->flags & MY_PROP_INVALID_INT) ? def : prop->int_value;
+}
+
+double my_prop_lookup_float(my_props_t *props, char *name, double def)
+{
+	my_prop_t *prop;
+	char *end;
+
+	prop = my_prop_priv_find(props, name);
+	if (!prop) {
+		return def;
+	}
+
+	if (!(prop->flags & MY_PROP_CACHED_FLOAT)) {
+		prop->float_value = strtod(prop->value, &end);
+		if ((end == prop->value) || (*end != '\0')) {
+			prop->flags |= MY_PROP_INVALID_FLOAT;
+		}
+		prop->flags |= MY_PROP_CACHED_FLOAT;
+	}
+
+	return (prop->flags & MY_PROP_INVALID_FLOAT) ? def : prop->float_value;
+}
+
+int my_prop_lookup_bool(my_props_t *props, char *name, int def)
+{
+	my_prop_t *prop;
+
+	prop = my_prop_priv_find(props, name);
+	if (!prop) {
+		return def;
+	}
+
+	if (!(prop->flags & MY_PROP_CACHED_BOOL)) {
+		if (my_prop_is_true(prop->value)) {
+			prop->bool_value = 1;
+		} else if ((strcmp(prop->value, "0") == 0) || (strcmp(prop->value, "disabled") == 0) || (strcmp(prop->value, "false") == 0)) {
+			prop->bool_value = 0;
+		} else {
+			prop->flags |= MY_PROP_INVALID_BOOL;
+		}
+		prop->flags |= MY_PROP_CACHED_BOOL;
+	}
+
+	return (prop->flags & MY_PROP_INVALID_BOOL) ? def : prop->bool_value;
+}
+
+int my_prop_parse_duration(char *value, uint64_t *duration)
+{
+	double n, unit;
+	char *end;
+
+	n = strtod(value, &end);
+	if ((*end == '\0') || (strcmp(end, "ms") == 0)) {
+		unit = 1e6;
+	} else if (strcmp(end, "s") == 0) {
+		unit = 1e9;
+	} else if (strcmp(end, "us") == 0) {
+		unit = 1e3;
+	} else if (strcmp(end, "ns") == 0) {
+		unit = 1;
+	} else {
+		unit = 0;
+	}
+	if ((end == value) || (unit == 0) || (n < 0)) {
+		return -1;
+	}
+
+	*duration = n * unit;
+
+	return 0;
+}
+
+uint64_t my_prop_lookup_duration(my_props_t *props, char *name, uint64_t def)
+{
+	my_prop_t *prop;
+
+	prop = my_prop_priv_find(props, name);
+	if (!prop) {
+		return def;
+	}
+
+	if (!(prop->flags & MY_PROP_CACHED_DURATION)) {
+		if (my_prop_parse_duration(prop->value, &prop->duration_value) != 0) {
+			prop->flags |= MY_PROP_INVALID_DURATION;
+		}
+		prop->flags |= MY_PROP_CACHED_DURATION;
+	}
+
+	return (prop->flags & MY_PROP_INVALID_DURATION) ? def : prop->duration_value;
+}
+
+void my_prop_purge(my_props_t *props)
+{
+	int i;
+
+	for (i = 0; i < props->count; i++) {
+		free(props->entries[i].value);
 	}
+	props->count = 0;
+	memset(props->slots, 0xff, (props->slot_mask + 1) * sizeof(int));
 }
 
-int my_prop_iter(my_list_t *list, my_prop_iter_fn_t func, void *user)
+int my_prop_iter(my_props_t *props, my_prop_iter_fn_t func, void *user)
 {
-	my_node_t *node;
 	my_prop_t *prop;
 	int flags;
 	int rc;
+	int i;
 
 	flags = MY_LIST_ITER_FLAG_FIRST;
-	for (node = list->head; node; node = node->next) {
-		if (!(node->next)) {
+	for (i = 0; i < props->count; i++) {
+		if (i == props->count - 1) {
 			flags |= MY_LIST_ITER_FLAG_LAST;
 		}
-		prop = MY_PROP(node->data);
+		prop = &props->entries[i];
 		rc = (func)(prop->name, prop->value, user, flags);
 		if (rc) {
 			return rc;
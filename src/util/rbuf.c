@@ -20,34 +20,123 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "autoconf.h"
 
 #include "util/rbuf.h"
 
 #include "util/mem.h"
 
-my_rbuf_t *my_rbuf_create(int size)
+/* the other side's offset, acquiring what it published along with it */
+static inline unsigned int my_rbuf_load(my_rbuf_t *rbuf, unsigned int *off)
+{
+	if (rbuf->flags & MY_RBUF_FLAG_SPSC) {
+		return __atomic_load_n(off, __ATOMIC_ACQUIRE);
+	}
+
+	return *off;
+}
+
+/* our own offset, releasing the data moved before it */
+static inline void my_rbuf_store(my_rbuf_t *rbuf, unsigned int *off, unsigned int val)
+{
+	if (rbuf->flags & MY_RBUF_FLAG_SPSC) {
+		__atomic_store_n(off, val, __ATOMIC_RELEASE);
+	} else {
+		*off = val;
+	}
+}
+
+/* map the same 'size' bytes twice in a row */
+static char *my_rbuf_mirror_map(unsigned int size)
+{
+#ifdef HAVE_MEMFD_CREATE
+	char *data;
+	int fd;
+
+	fd = memfd_create("my_rbuf", MFD_CLOEXEC);
+	if (fd < 0) {
+		goto _MY_ERR_memfd_create;
+	}
+
+	if (ftruncate(fd, size) != 0) {
+		goto _MY_ERR_ftruncate;
+	}
+
+	/* reserve the whole range first, so that nothing can sneak in between */
+	data = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) {
+		goto _MY_ERR_mmap_reserve;
+	}
+
+	if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		goto _MY_ERR_mmap_mirror;
+	}
+
+	if (mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		goto _MY_ERR_mmap_mirror;
+	}
+
+	/* the mappings keep the pages alive */
+	close(fd);
+
+	return data;
+
+_MY_ERR_mmap_mirror:
+	munmap(data, 2 * size);
+_MY_ERR_mmap_reserve:
+_MY_ERR_ftruncate:
+	close(fd);
+_MY_ERR_memfd_create:
+	return NULL;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+my_rbuf_t *my_rbuf_create(int size, int flags)
 {
 	my_rbuf_t *rbuf;
-	
-	rbuf = my_mem_alloc(sizeof(my_rbuf_t));
+	unsigned int n;
+
+	rbuf = my_mem_alloc_aligned(MY_CACHE_LINE_SIZE, sizeof(my_rbuf_t));
 	if (!rbuf) {
 		goto _MY_ERR_alloc;
 	}
 
-	rbuf->size = size + 1;
+	n = 1;
+	if (flags & MY_RBUF_FLAG_MIRRORED) {
+		n = sysconf(_SC_PAGESIZE);
+	}
+	while (n < size) {
+		n <<= 1;
+	}
+
+	rbuf->size = n;
+	rbuf->mask = n - 1;
+	rbuf->flags = flags;
 	rbuf->off_get = 0;
 	rbuf->off_put = 0;
-	
-	rbuf->data = my_mem_alloc(rbuf->size);
+
+	if (flags & MY_RBUF_FLAG_MIRRORED) {
+		rbuf->data = my_rbuf_mirror_map(rbuf->size);
+	} else {
+		rbuf->data = my_mem_alloc_aligned(MY_CACHE_LINE_SIZE, rbuf->size);
+	}
 	if( !(rbuf->data)) {
 		goto _MY_ERR_alloc_data;
 	}
-	
+
 	return rbuf;
 
-	my_mem_free(rbuf->data);
 _MY_ERR_alloc_data:
 	my_mem_free(rbuf);
 _MY_ERR_alloc:
@@ -56,44 +145,76 @@ _MY_ERR_alloc:
 
 void my_rbuf_destroy(my_rbuf_t *rbuf)
 {
-	my_mem_free(rbuf->data);
+	if (rbuf->flags & MY_RBUF_FLAG_MIRRORED) {
+		munmap(rbuf->data, 2 * rbuf->size);
+	} else {
+		my_mem_free(rbuf->data);
+	}
 	my_mem_free(rbuf);
 }
 
 int my_rbuf_get_avail(my_rbuf_t *rbuf)
 {
-	int avail;
+	return my_rbuf_load(rbuf, &rbuf->off_put) - my_rbuf_load(rbuf, &rbuf->off_get);
+}
 
-	if (rbuf->off_get < rbuf->off_put) {
-		avail = rbuf->off_put - rbuf->off_get;
-	} else {
-		avail = (rbuf->off_put - rbuf->off_get + rbuf->size) % rbuf->size;
+int my_rbuf_put_avail(my_rbuf_t *rbuf)
+{
+	return rbuf->size - (my_rbuf_load(rbuf, &rbuf->off_put) - my_rbuf_load(rbuf, &rbuf->off_get));
+}
+
+/* contiguous bytes from position 'pos' */
+static inline unsigned int my_rbuf_span(my_rbuf_t *rbuf, unsigned int pos)
+{
+	if (rbuf->flags & MY_RBUF_FLAG_MIRRORED) {
+		return rbuf->size;
 	}
 
-	return avail;
+	return rbuf->size - pos;
 }
 
-int my_rbuf_put_avail(my_rbuf_t *rbuf)
+/* copy out 'size' bytes from offset 'off', wrapping if needed */
+static void my_rbuf_copy_out(my_rbuf_t *rbuf, unsigned int off, char *data, int size)
 {
-	int avail;
+	unsigned int pos = off & rbuf->mask;
+	unsigned int n = my_rbuf_span(rbuf, pos);
 
-	if (rbuf->off_get > rbuf->off_put) {
-		avail = rbuf->off_get - rbuf->off_put;
-	} else if (rbuf->off_get < rbuf->off_put) {
-		avail = (rbuf->off_get - rbuf->off_put + rbuf->size) % rbuf->size;
-	} else {
-		avail = rbuf->size;
+	if (n > size) {
+		n = size;
 	}
-
-	return avail - 1;
+	memcpy(data, rbuf->data + pos, n);
+	memcpy(data + n, rbuf->data, size - n);
 }
 
+/* copy in 'size' bytes at offset 'off', wrapping if needed */
+static void my_rbuf_copy_in(my_rbuf_t *rbuf, unsigned int off, char *data, int size)
+{
+	unsigned int pos = off & rbuf->mask;
+	unsigned int n = my_rbuf_span(rbuf, pos);
+
+	if (n > size) {
+		n = size;
+	}
+	memcpy(rbuf->data + pos, data, n);
+	memcpy(rbuf->data, data + n, size - n);
+}
 
 int my_rbuf_get(my_rbuf_t *rbuf, char *data, int size)
 {
-	int avail, off;
-	
-	avail = my_rbuf_get_avail(rbuf);
+	size = my_rbuf_peek(rbuf, data, size);
+	if (size > 0) {
+		my_rbuf_store(rbuf, &rbuf->off_get, rbuf->off_get + size);
+	}
+
+	return size;
+}
+
+int my_rbuf_put(my_rbuf_t *rbuf, char *data, int size)
+{
+	unsigned int off_put = rbuf->off_put;
+	int avail;
+
+	avail = rbuf->size - (off_put - my_rbuf_load(rbuf, &rbuf->off_get));
 	if (!avail) {
 		return 0;
 	}
@@ -101,24 +222,18 @@ int my_rbuf_get(my_rbuf_t *rbuf, char *data, int size)
 	if (size > avail) {
 		size = avail;
 	}
-	avail = size;
-	off = rbuf->off_get + size;
-	if (off > rbuf->size) {
-		off %= rbuf->size;
-		memcpy(data + rbuf->size - rbuf->off_get, rbuf->data, off);
-		avail -= off;
-	}
-	memcpy(data, rbuf->data + rbuf->off_get, avail);
-	rbuf->off_get = off;
+	my_rbuf_copy_in(rbuf, off_put, data, size);
+	my_rbuf_store(rbuf, &rbuf->off_put, off_put + size);
 
 	return size;
 }
 
-int my_rbuf_put(my_rbuf_t *rbuf, char *data, int size)
+int my_rbuf_peek(my_rbuf_t *rbuf, char *data, int size)
 {
-	int avail, off;
-	
-	avail = my_rbuf_put_avail(rbuf);
+	unsigned int off_get = rbuf->off_get;
+	int avail;
+
+	avail = my_rbuf_load(rbuf, &rbuf->off_put) - off_get;
 	if (!avail) {
 		return 0;
 	}
@@ -126,40 +241,78 @@ int my_rbuf_put(my_rbuf_t *rbuf, char *data, int size)
 	if (size > avail) {
 		size = avail;
 	}
-	avail = size;
-	off = rbuf->off_put + size;
-	if (off > rbuf->size) {
-		off %= rbuf->size;
-		memcpy(rbuf->data, data + rbuf->size - rbuf->off_put, off);
-		avail -= off;
+	my_rbuf_copy_out(rbuf, off_get, data, size);
+
+	return size;
+}
+
+int my_rbuf_consume(my_rbuf_t *rbuf, int size)
+{
+	unsigned int off_get = rbuf->off_get;
+	int avail;
+
+	avail = my_rbuf_load(rbuf, &rbuf->off_put) - off_get;
+	if (size > avail) {
+		size = avail;
 	}
-	memcpy(rbuf->data + rbuf->off_put, data, avail);
-	rbuf->off_put = off;
+	my_rbuf_store(rbuf, &rbuf->off_get, off_get + size);
 
 	return size;
 }
 
-int my_rbuf_peek(my_rbuf_t *rbuf, char *data, int size)
+/* describe 'size' bytes from offset 'off', wrapping if needed */
+static void my_rbuf_iov_set(my_rbuf_t *rbuf, unsigned int off, struct iovec *iov, int size)
 {
-	int avail, off;
-	
-	avail = my_rbuf_get_avail(rbuf);
-	if (!avail) {
-		return 0;
+	unsigned int pos = off & rbuf->mask;
+	unsigned int n = my_rbuf_span(rbuf, pos);
+
+	if (n > size) {
+		n = size;
 	}
+	iov[0].iov_base = rbuf->data + pos;
+	iov[0].iov_len = n;
+	iov[1].iov_base = rbuf->data;
+	iov[1].iov_len = size - n;
+}
 
+int my_rbuf_reserve_write(my_rbuf_t *rbuf, struct iovec *iov, int size)
+{
+	unsigned int off_put = rbuf->off_put;
+	int avail;
+
+	avail = rbuf->size - (off_put - my_rbuf_load(rbuf, &rbuf->off_get));
 	if (size > avail) {
 		size = avail;
 	}
-	avail = size;
-	off = rbuf->off_get + size;
-	if (off > rbuf->size) {
-		off %= rbuf->size;
-		memcpy(data + rbuf->size - rbuf->off_get, rbuf->data, off);
-		avail -= off;
+	my_rbuf_iov_set(rbuf, off_put, iov, size);
+
+	return size;
+}
+
+int my_rbuf_commit_write(my_rbuf_t *rbuf, int size)
+{
+	unsigned int off_put = rbuf->off_put;
+	int avail;
+
+	avail = rbuf->size - (off_put - my_rbuf_load(rbuf, &rbuf->off_get));
+	if (size > avail) {
+		size = avail;
 	}
-	memcpy(data, rbuf->data + rbuf->off_get, avail);
+	my_rbuf_store(rbuf, &rbuf->off_put, off_put + size);
 
 	return size;
 }
 
+int my_rbuf_peek_read(my_rbuf_t *rbuf, struct iovec *iov, int size)
+{
+	unsigned int off_get = rbuf->off_get;
+	int avail;
+
+	avail = my_rbuf_load(rbuf, &rbuf->off_put) - off_get;
+	if (size > avail) {
+		size = avail;
+	}
+	my_rbuf_iov_set(rbuf, off_get, iov, size);
+
+	return size;
+}